@@ -59,6 +59,8 @@ if ([string]::IsNullOrEmpty($modelBlobPath)) {
     } elseif (Test-Path $candidateB) {
         $modelBlobPath = $candidateB
     }
+} elseif (-not (Test-Path $modelBlobPath)) {
+    throw "Model blob not found: $modelBlobPath"
 }
 
 if ($Target -eq "clean") {
@@ -72,7 +74,6 @@ if ($Target -eq "clean") {
 }
 
 $cc = Find-FirstCommand @("i686-elf-gcc", "i686-linux-gnu-gcc")
-$objcopy = Find-FirstCommand @("i686-elf-objcopy", "i686-linux-gnu-objcopy")
 Require-Command "nasm"
 
 if (-not (Test-Path $ldScript)) {
@@ -90,9 +91,6 @@ $objPaths = @()
 
 $asFlags = @("-f", "elf32")
 $cFlags = @("-ffreestanding", "-O2", "-Wall", "-Wextra", "-m32", "-fno-pie", "-fno-PIC", "-fno-stack-protector", "-nostdlib", "-nostdinc", "-msse", "-msse2", "-Iinclude")
-if ([string]::IsNullOrEmpty($modelBlobPath)) {
-    $cFlags += "-DNO_AI_MODEL"
-}
 
 foreach ($src in $asmSrcs) {
     $obj = Get-ObjPath $src.FullName $srcDir $buildDir
@@ -114,22 +112,7 @@ foreach ($src in $cSrcs) {
     $objPaths += $obj
 }
 
-if (-not [string]::IsNullOrEmpty($modelBlobPath)) {
-    if (-not (Test-Path $modelBlobPath)) {
-        throw "Model blob not found: $modelBlobPath"
-    }
-    $modelObj = Join-Path $buildDir "model.o"
-    Invoke-Checked $objcopy @(
-        "-I", "binary",
-        "-O", "elf32-i386",
-        "-B", "i386",
-        "--rename-section", ".data=.ai_model,alloc,load,readonly,data,contents",
-        $modelBlobPath,
-        $modelObj
-    )
-    $objPaths += $modelObj
-}
-
+# The model is not linked in; the iso target stages it as a multiboot module.
 $ldFlags = @("-T", $ldScript, "-ffreestanding", "-O2", "-nostdlib", "-m32", "-no-pie", "-Wl,-z,noexecstack", "-Wl,--build-id=none")
 Invoke-Checked $cc ($ldFlags + @("-o", $kernelBin) + $objPaths)
 
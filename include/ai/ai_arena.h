@@ -0,0 +1,14 @@
+#ifndef AI_ARENA_H
+#define AI_ARENA_H
+
+#include "types.h"
+
+// Boot-lifetime bump allocator for AI tables and scratch buffers.
+// Backed by physically contiguous PMM runs (identity mapped), never freed.
+#define AI_ARENA_CHUNK_BLOCKS 256u
+
+void* ai_arena_alloc(uint32_t size, uint32_t align);
+uint32_t ai_arena_used_bytes(void);
+uint32_t ai_arena_reserved_bytes(void);
+
+#endif
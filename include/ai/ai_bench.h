@@ -0,0 +1,40 @@
+#ifndef AI_BENCH_H
+#define AI_BENCH_H
+
+#include "types.h"
+
+// Shapes follow SmolLM2-135M: 576-wide residual, 1536-wide FFN, 64-dim
+// heads, prompt chunks of AI_PREFILL_BATCH tokens.
+#define AI_BENCH_DIM 576u
+#define AI_BENCH_FF 1536u
+#define AI_BENCH_HEAD_DIM 64u
+#define AI_BENCH_VOCAB 49152u
+#define AI_BENCH_DOT_ROWS 64u
+#define AI_BENCH_DECODE_TOKENS 16u
+
+// One benchmark line. ops is the work per rep (2 * m * n * k for products,
+// a nominal per-element count for the rest); tokens is set only for the
+// end-to-end runs.
+typedef struct {
+    const char* name;
+    uint32_t m;
+    uint32_t n;
+    uint32_t k;
+    uint32_t reps;
+    uint64_t ops;
+    uint64_t cycles;      // per rep
+    uint64_t mops;        // million ops per second
+    uint32_t tokens;
+    uint64_t tps_x100;    // tokens per second, in hundredths
+} ai_bench_result_t;
+
+typedef void (*ai_bench_report_fn)(const ai_bench_result_t* result);
+
+// TSC rate measured against the PIT; 0 if the timer is not running.
+uint64_t ai_bench_tsc_khz(void);
+// Runs every kernel `reps` times, then prefill and decode if a model is
+// loaded. Each result goes to serial as one "AIBENCH key=value ..." line
+// and then to report, which may be null. Returns the number of results.
+uint32_t ai_bench_run(uint32_t reps, ai_bench_report_fn report);
+
+#endif
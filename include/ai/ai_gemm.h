@@ -0,0 +1,32 @@
+#ifndef AI_GEMM_H
+#define AI_GEMM_H
+
+#include "fixedpoint.h"
+#include "types.h"
+
+// Micro-kernel variants, in order of preference.
+#define AI_GEMM_SCALAR 0u
+#define AI_GEMM_SSE2   1u
+#define AI_GEMM_SSE41  2u
+#define AI_GEMM_AVX2   3u
+
+// Budget for one N panel of packed B (n rows of k); sized for a 256KB L2.
+#define AI_GEMM_L2_BYTES (128u * 1024u)
+
+// Picks the widest kernel the CPU supports; call after SSE/AVX are enabled.
+void ai_gemm_init(void);
+uint32_t ai_gemm_isa(void);
+const char* ai_gemm_isa_name(uint32_t isa);
+// Forces a kernel (clamped to what the CPU supports); returns the one chosen.
+uint32_t ai_gemm_set_isa(uint32_t isa);
+
+// C[m x n] = A[m x k] * B[k x n], with B given packed as bt[n][k] (see
+// ai_matmul_pack_b). Products are summed exactly in 64 bits and rounded to
+// q16.16 once per output.
+int ai_gemm_q16(const q16_16_t* a, const q16_16_t* bt, q16_16_t* c, uint32_t m, uint32_t n, uint32_t k);
+// As ai_gemm_q16, writing row i of C at c + i * ldc (a column slice of a
+// wider output).
+int ai_gemm_q16_ldc(const q16_16_t* a, const q16_16_t* bt, q16_16_t* c, uint32_t ldc,
+                    uint32_t m, uint32_t n, uint32_t k);
+
+#endif
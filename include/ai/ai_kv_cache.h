@@ -0,0 +1,49 @@
+#ifndef AI_KV_CACHE_H
+#define AI_KV_CACHE_H
+
+#include "fixedpoint.h"
+#include "types.h"
+
+// Smallest cache kv_cache_init will settle for when PMM cannot supply the
+// requested run.
+#define AI_KV_MIN_TOKENS 64u
+
+enum {
+    AI_KV_LINEAR = 0,
+    AI_KV_SLIDING = 1
+};
+
+// K and V each live in one physically contiguous PMM run laid out
+// [layer][kv_head][slot][head_dim], so a head's history is unit-stride.
+// Absolute position p lives in slot p % capacity; in sliding mode the oldest
+// position is overwritten in place once the ring is full.
+typedef struct {
+    q16_16_t* k;
+    q16_16_t* v;
+    uint32_t n_layer;
+    uint32_t n_head_kv;
+    uint32_t head_dim;
+    uint32_t capacity;
+    uint32_t region_bytes;
+    uint32_t n_past;
+    uint32_t mode;
+} ai_kv_cache_t;
+
+int ai_kv_cache_create(ai_kv_cache_t* cache, uint32_t n_layer, uint32_t n_head_kv,
+                       uint32_t head_dim, uint32_t capacity, uint32_t mode);
+void ai_kv_cache_destroy(ai_kv_cache_t* cache);
+void ai_kv_cache_reset(ai_kv_cache_t* cache);
+int ai_kv_cache_can_append(const ai_kv_cache_t* cache);
+void ai_kv_cache_store(ai_kv_cache_t* cache, uint32_t layer, uint32_t pos,
+                       const q16_16_t* k, const q16_16_t* v);
+uint32_t ai_kv_cache_valid(const ai_kv_cache_t* cache, uint32_t pos);
+
+static inline const q16_16_t* ai_kv_cache_k_head(const ai_kv_cache_t* cache, uint32_t layer, uint32_t head) {
+    return cache->k + ((layer * cache->n_head_kv + head) * cache->capacity) * cache->head_dim;
+}
+
+static inline const q16_16_t* ai_kv_cache_v_head(const ai_kv_cache_t* cache, uint32_t layer, uint32_t head) {
+    return cache->v + ((layer * cache->n_head_kv + head) * cache->capacity) * cache->head_dim;
+}
+
+#endif
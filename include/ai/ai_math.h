@@ -0,0 +1,33 @@
+#ifndef AI_MATH_H
+#define AI_MATH_H
+
+#include "fixedpoint.h"
+#include "types.h"
+
+// 2^-f for f in [0, 1) is split into 8 high and 8 low fraction bits, each
+// looked up in its own table.
+#define AI_EXP2_LUT_BITS 8u
+// sigmoid(x) is tabulated on [0, AI_SIGMOID_RANGE) every 1/AI_SIGMOID_STEPS
+// and interpolated linearly; past the range it is 0 or 1 to q16 precision.
+#define AI_SIGMOID_RANGE 16u
+#define AI_SIGMOID_STEPS 64u
+
+// Builds the lookup tables; call once before any kernel below.
+void ai_math_init(void);
+
+// 2^(-e) in 0.32 fixed point for a q16.16 exponent e >= 0, evaluated bit by
+// bit. Exact but slow: for one-off tables such as the RoPE frequencies.
+uint64_t ai_exp2_neg_q32(uint32_t e_q16);
+
+// e^x for x <= 0 (returns 1.0 for x > 0): one range reduction, two table
+// lookups and one 32x32 multiply.
+q16_16_t ai_exp_q16(q16_16_t x);
+q16_16_t ai_silu_q16(q16_16_t x);
+
+// In-place softmax of one row. The sum is inverted once, so the row costs a
+// single 64-bit divide instead of one per element.
+void ai_softmax_q16(q16_16_t* data, uint32_t n);
+// gate[i] = silu(gate[i]) * up[i], the SwiGLU step of the FFN.
+void ai_silu_mul_q16(q16_16_t* gate, const q16_16_t* up, uint32_t n);
+
+#endif
@@ -3,9 +3,19 @@
 
 #include "fixedpoint.h"
 #include "ai/gguf.h"
+#include "arch/x86/multiboot.h"
 #include "types.h"
 
+// The model is mapped in place with 4MB pages from AI_MODEL_VIRT_BASE up to
+// the IOAPIC window, which bounds its size to about 492MB.
 #define AI_MODEL_VIRT_BASE 0xE0000000u
+#define AI_MODEL_VIRT_LIMIT 0xFEC00000u
+// Boot module command-line word that marks the GGUF (grub.cfg: module
+// /boot/model.gguf "ai_model").
+#define AI_MODEL_MODULE_TAG "ai_model"
+#define AI_RMS_EPS_Q32 42950ull
+#define AI_LOG2E_Q16 94548ull
+#define AI_GENERATE_MAX_TOKENS 64u
 
 enum {
     GGML_TYPE_F32 = 0,
@@ -46,16 +56,32 @@ typedef struct {
 } ai_context_t;
 
 typedef struct ai_job_s {
-    struct ai_job_s* next;
     void (*func)(void* arg);
     void* arg;
     uint32_t priority;
     volatile int completed;
 } ai_job_t;
 
+// Upper bound on parallel lanes (the caller plus pinned AP workers).
+#define AI_SCHED_MAX_LANES 8u
+
+typedef void (*ai_rows_fn)(void* ctx, uint32_t start, uint32_t end);
+
+// Starts one worker thread pinned to each online AP, capped at n_workers
+// (0 = one per AP). Must run after scheduler_init().
 void ai_scheduler_init(uint32_t n_workers);
+// Pushes onto the calling CPU's deque and wakes one parked worker.
 void ai_scheduler_submit(ai_job_t* job);
+// Offers a job to the next idle worker; never runs it on the caller. Holds
+// one job at a time: returns 0 (job left completed) if the slot is taken or
+// there are no workers.
+int ai_scheduler_submit_background(ai_job_t* job);
+// Waits for a job, running or stealing queued jobs meanwhile.
 void ai_scheduler_wait(ai_job_t* job);
+uint32_t ai_scheduler_lanes(void);
+// Splits [0, rows) into blocks of at least min_rows across the workers and
+// the caller; returns the number of blocks run.
+uint32_t ai_scheduler_run_rows(uint32_t rows, uint32_t min_rows, ai_rows_fn fn, void* ctx);
 
 typedef struct {
     char name[64];
@@ -72,24 +98,53 @@ typedef struct {
     uint32_t block_bytes;
 } ai_quant_info_t;
 
-void ai_model_init(void);
+// Finds the model among the multiboot modules, reserves and maps it in place,
+// and indexes its tensors. Without one, the AI stays offline.
+void ai_model_init(const multiboot_info_t* info);
+// Physical start of the boot module holding the model; 0 if none.
+uint32_t ai_model_module_phys(void);
 const void* ai_model_data(void);
 uint32_t ai_model_size(void);
 int ai_model_read_header(gguf_header_t* out);
+int ai_model_kv_find(const char* key, uint32_t* type, gguf_reader_t* value);
+int ai_model_kv_u32(const char* key, uint32_t* out);
+int ai_model_kv_f32_bits(const char* key, uint32_t* out);
+int ai_model_kv_string(const char* key, const uint8_t** str, uint64_t* len);
+int ai_model_kv_array(const char* key, uint32_t* elem_type, uint64_t* count, gguf_reader_t* items);
 int ai_tensor_get(uint32_t index, ai_tensor_desc_t* out);
+int ai_tensor_find(const char* name, ai_tensor_desc_t* out);
+const ai_tensor_desc_t* ai_tensor_lookup(const char* name);
+uint32_t ai_tensor_count(void);
 int ai_tensor_data_start(uint64_t* out);
 const char* ai_tensor_type_name(uint32_t type);
 int ai_quant_info(uint32_t type, ai_quant_info_t* out);
 uint32_t ai_quant_read_q16(uint32_t type, const uint8_t* src, q16_16_t* dst, uint32_t max);
 void ai_set_simd_enabled(int enabled);
+// B is row-major k x n. For n > 1 it is packed an L2-sized column panel at
+// a time into a heap buffer and run on the GEMM engine; the strided kernel
+// is only the fallback when that buffer cannot be allocated.
 int ai_matmul_q16_16(const q16_16_t* a, const q16_16_t* b, q16_16_t* c, uint32_t m, uint32_t n, uint32_t k);
+// Transposes a row-major k x n B into n rows of k (bt[j * k + p]), so every
+// dot product in ai_matmul_q16_16_packed reads both operands unit-stride.
+// The packed product runs on the GEMM engine (ai_gemm.h).
+void ai_matmul_pack_b(const q16_16_t* b, q16_16_t* bt, uint32_t n, uint32_t k);
+int ai_matmul_q16_16_packed(const q16_16_t* a, const q16_16_t* bt, q16_16_t* c, uint32_t m, uint32_t n, uint32_t k);
 int gguf_parse(gguf_header_t* out);
 int gguf_get_tensor(uint32_t index, ai_tensor_desc_t* out);
 int matmul(const q16_16_t* a, const q16_16_t* b, q16_16_t* c, uint32_t m, uint32_t n, uint32_t k);
+// Unit-stride dot; takes the SSE4.1 path when AI SIMD is enabled.
 q16_16_t dot_product(const q16_16_t* a, const q16_16_t* b, uint32_t n);
 void rmsnorm(q16_16_t* data, uint32_t n);
 void softmax(q16_16_t* data, uint32_t n);
-void rope_apply(q16_16_t* data, uint32_t n);
+// Returns 0 for a head size it cannot rotate (odd, or more than 256).
+int rope_init(uint32_t head_dim, uint32_t freq_base);
+// Tabulates cos/sin for positions [0, positions) from the arena, so
+// rope_apply is a streaming multiply. Later positions (a slid window) are
+// computed per call. Returns 0 if the table could not be allocated.
+int rope_precompute(uint32_t positions);
+// Rotates each head of data by pos. The first call sets the head size if
+// rope_init has not; callers must pass that head size from then on.
+void rope_apply(q16_16_t* data, uint32_t n, uint32_t head_dim, uint32_t pos);
 uint32_t tokenizer_encode(const char* text, uint32_t* out, uint32_t max);
 uint32_t tokenizer_decode(uint32_t token, char* out, uint32_t max);
 void ai_context_init(ai_context_t* context);
@@ -0,0 +1,36 @@
+#ifndef AI_PREFIX_CACHE_H
+#define AI_PREFIX_CACHE_H
+
+#include "ai/ai_kv_cache.h"
+#include "ai/ai_session.h"
+#include "types.h"
+
+#define AI_PREFIX_ENTRIES 8u
+// Shorter prefixes are cheaper to recompute than to look up. The key hashes
+// exactly this many leading tokens, so every usable match shares it.
+#define AI_PREFIX_MIN_TOKENS 8u
+// PMM held by snapshots before inserts start evicting.
+#define AI_PREFIX_BUDGET_BYTES (32u * 1024u * 1024u)
+
+typedef struct {
+    uint32_t entries;
+    uint32_t bytes;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t tokens_reused;
+    uint32_t evictions;
+} ai_prefix_stats_t;
+
+// Registers the kswapd reclaimer; call once the transformer is bound.
+void ai_prefix_cache_init(void);
+// Restores the longest cached prefix of tokens[0..max) into an empty cache
+// and sets its n_past. Returns the prefix length, 0 on a miss.
+uint32_t ai_prefix_cache_restore(ai_kv_cache_t* kv, const uint32_t* tokens, uint32_t max);
+// Snapshots positions [0, count) of kv, which must hold exactly tokens.
+int ai_prefix_cache_store(const ai_kv_cache_t* kv, const uint32_t* tokens, uint32_t count);
+void ai_prefix_cache_clear(void);
+// Evicts least recently used snapshots; returns PMM blocks freed.
+uint32_t ai_prefix_cache_reclaim(uint32_t target_pages);
+void ai_prefix_cache_stats(ai_prefix_stats_t* out);
+
+#endif
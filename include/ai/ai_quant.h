@@ -0,0 +1,43 @@
+#ifndef AI_QUANT_H
+#define AI_QUANT_H
+
+#include "fixedpoint.h"
+#include "types.h"
+
+// Fused dequantize-and-dot over ggml blocks: weights are consumed in place and
+// only the per-block scales are applied, never a materialized q16.16 row.
+int ai_quant_dot_supported(uint32_t type);
+q16_16_t ai_quant_dot_q16(uint32_t type, const uint8_t* row, const q16_16_t* x, uint32_t n);
+void ai_quant_matvec_q16(uint32_t type, const uint8_t* data, uint32_t row_bytes,
+                         const q16_16_t* x, q16_16_t* y, uint32_t rows, uint32_t cols);
+
+// Activation precision for the fused projections. AI_ACT_Q8 quantizes the
+// input vector to int8 in blocks of AI_Q8_BLOCK with one scale each, so
+// the per-block dots are integer-only (W8A8 for Q8_0, W4A8 for Q4_0/Q4_K).
+#define AI_ACT_Q16 0u
+#define AI_ACT_Q8  1u
+#define AI_Q8_BLOCK 32u
+
+// x[i] ~= qs[i] * d / 256 in q16.16; sum is the sum of qs, for the weight
+// offset and min terms.
+typedef struct {
+    int8_t qs[AI_Q8_BLOCK];
+    int32_t sum;
+    uint32_t d;
+} ai_q8_block_t;
+
+// Picks the SSSE3 int8 kernels when the CPU has them.
+void ai_quant_init(void);
+uint32_t ai_quant_act_mode(void);
+uint32_t ai_quant_set_act_mode(uint32_t mode);
+int ai_quant_q8_simd(void);
+int ai_quant_q8_supported(uint32_t type);
+// n must be a multiple of AI_Q8_BLOCK.
+void ai_quant_x_q8(const q16_16_t* x, ai_q8_block_t* out, uint32_t n);
+q16_16_t ai_quant_dot_q8(uint32_t type, const uint8_t* row, const ai_q8_block_t* xq, uint32_t n);
+void ai_quant_matvec_q8(uint32_t type, const uint8_t* data, uint32_t row_bytes,
+                        const ai_q8_block_t* xq, q16_16_t* y, uint32_t rows, uint32_t cols);
+
+void ai_q4k_scale_min(const uint8_t* scales, uint32_t j, uint32_t* sc, uint32_t* m);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef AI_SAMPLER_H
+#define AI_SAMPLER_H
+
+#include "fixedpoint.h"
+#include "types.h"
+
+// Largest top-k the candidate heap can hold.
+#define AI_SAMPLER_MAX_K 64u
+// Recent tokens the repetition penalty looks back over.
+#define AI_SAMPLER_HISTORY 64u
+#define AI_SAMPLER_DEFAULT_SEED 0x2545F491u
+
+typedef struct {
+    q16_16_t temperature;    // 0 = greedy
+    uint32_t top_k;          // 1..AI_SAMPLER_MAX_K
+    q16_16_t top_p;          // cut on the sorted top-k prefix; 1.0 = off
+    q16_16_t repeat_penalty; // divides positive logits of recent tokens; <= 1.0 = off
+    uint32_t seed;
+} ai_sampler_params_t;
+
+// All sampling state and scratch; nothing is allocated per token.
+typedef struct {
+    ai_sampler_params_t params;
+    uint32_t rng;
+    uint32_t history[AI_SAMPLER_HISTORY];
+    uint32_t history_len;
+    uint32_t history_head;
+    uint32_t cand_id[AI_SAMPLER_MAX_K];
+    q16_16_t cand_logit[AI_SAMPLER_MAX_K];
+    q16_16_t cand_prob[AI_SAMPLER_MAX_K];
+} ai_sampler_t;
+
+void ai_sampler_defaults(ai_sampler_params_t* params);
+void ai_sampler_init(ai_sampler_t* s, const ai_sampler_params_t* params);
+// Clears the history and restarts the random stream from params.seed.
+void ai_sampler_reset(ai_sampler_t* s);
+// Records a token fed to the model, for the repetition penalty.
+void ai_sampler_accept(ai_sampler_t* s, uint32_t token);
+// Applies the repetition penalty to logits in place, then picks a token.
+uint32_t ai_sampler_sample(ai_sampler_t* s, q16_16_t* logits, uint32_t n_vocab);
+// Top-k / temperature / top-p pick without the penalty. One pass over the
+// vocabulary keeps the k best in a bounded min-heap.
+uint32_t ai_sampler_pick(ai_sampler_t* s, const q16_16_t* logits, uint32_t n_vocab);
+
+#endif
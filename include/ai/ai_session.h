@@ -0,0 +1,98 @@
+#ifndef AI_SESSION_H
+#define AI_SESSION_H
+
+#include "ai/ai_kv_cache.h"
+#include "ai/ai_sampler.h"
+#include "fixedpoint.h"
+#include "types.h"
+
+// Slot 0 is the console session that ask/infer use.
+#define AI_SESSION_MAX 8u
+#define AI_SESSION_PROMPT_MAX 128u
+// Generated tokens buffered per session; a full ring pauses its decoding.
+#define AI_SESSION_OUT 256u
+
+enum {
+    AI_SESSION_FREE = 0,
+    AI_SESSION_IDLE = 1,
+    AI_SESSION_PREFILL = 2,
+    AI_SESSION_DECODE = 3
+};
+
+// Generated tokens, single producer (the engine) and single consumer. The
+// same layout is mapped into a user process for sessions opened by syscall:
+// the reader polls head and state, consumes tokens[tail % capacity] and
+// advances tail. state mirrors the session, so IDLE with head == tail means
+// the answer is complete.
+typedef struct {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint32_t capacity;
+    volatile uint32_t state;
+    uint32_t tokens[AI_SESSION_OUT];
+} ai_token_ring_t;
+
+// One conversation: its own KV cache (and so its own n_past), sampler and
+// queues. Only the engine step touches a session in PREFILL or DECODE.
+typedef struct {
+    uint32_t id;
+    // pid of the process that opened it by syscall; 0 for kernel sessions.
+    uint32_t owner;
+    // Set when the owner exits; the next step frees the session.
+    volatile uint32_t orphaned;
+    volatile uint32_t state;
+    ai_kv_cache_t kv;
+    ai_sampler_t sampler;
+    uint32_t prompt[AI_SESSION_PROMPT_MAX];
+    uint32_t prompt_len;
+    uint32_t prompt_pos;
+    // Set while the prompt starts the conversation, so its prefill can be
+    // snapshotted into the prefix cache.
+    uint32_t prompt_cacheable;
+    uint32_t next_token;
+    uint32_t remaining;
+    // Set once the last token is emitted: one more DECODE row feeds it into
+    // the cache, without logits, so the next prompt continues after it.
+    uint32_t flush;
+    ai_token_ring_t out;
+    // &out, or a ring in a page shared with the owner.
+    ai_token_ring_t* ring;
+} ai_session_t;
+
+// Opens the console session; called once the transformer is bound.
+int ai_session_init(void);
+// Starts the engine thread that steps sessions nobody is driving. Must run
+// after scheduler_init().
+void ai_session_start_engine(void);
+ai_session_t* ai_session_console(void);
+// ctx_tokens is clamped to the model context and AI_CTX_MAX (0 = maximum).
+ai_session_t* ai_session_create(uint32_t ctx_tokens);
+void ai_session_destroy(ai_session_t* s);
+// Looks up a live session by id.
+ai_session_t* ai_session_get(uint32_t id);
+// Releases every session a process opened; for process teardown. Does not
+// block, so process_exit can call it from any context: the sessions are
+// freed by the next ai_session_step.
+void ai_session_destroy_owned(uint32_t owner);
+// Delivers an idle session's tokens into ring (kernel-addressable) instead
+// of its own buffer; 0 switches back.
+int ai_session_attach_ring(ai_session_t* s, ai_token_ring_t* ring);
+// Drops the session's history. Fails while it is generating.
+int ai_session_reset(ai_session_t* s);
+// Queues a prompt on an idle session; it extends the cached conversation.
+int ai_session_submit(ai_session_t* s, const char* prompt, uint32_t max_tokens);
+int ai_session_busy(const ai_session_t* s);
+// Drains generated tokens; returns how many were copied.
+uint32_t ai_session_read(ai_session_t* s, uint32_t* tokens, uint32_t max);
+// Runs one continuous-batching step: a decode token from every decoding
+// session plus prompt chunks, all in one batch. Returns rows processed, or 0
+// if there was nothing to do or another CPU holds the step.
+uint32_t ai_session_step(void);
+// Holds the engine off (waiting out a running step) so a caller can use the
+// transformer directly, e.g. to benchmark it.
+void ai_session_lock(void);
+void ai_session_unlock(void);
+// Submits to a session and steps until it finishes, streaming its tokens.
+uint32_t ai_session_generate(ai_session_t* s, const char* prompt, uint32_t max_tokens);
+
+#endif
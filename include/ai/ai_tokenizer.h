@@ -0,0 +1,22 @@
+#ifndef AI_TOKENIZER_H
+#define AI_TOKENIZER_H
+
+#include "types.h"
+
+#define AI_TOKEN_NONE 0xFFFFFFFFu
+// Pre-tokenized words longer than this are split before BPE, which keeps
+// the per-word merge loop bounded and the whole encode linear in the input.
+#define AI_TOKENIZER_MAX_WORD 64u
+
+enum {
+    AI_TOKENIZER_BYTES = 0,
+    AI_TOKENIZER_BPE = 1,
+    AI_TOKENIZER_SPM = 2
+};
+
+int ai_tokenizer_init(void);
+uint32_t ai_tokenizer_mode(void);
+uint32_t ai_tokenizer_vocab_size(void);
+uint32_t ai_tokenizer_lookup(const uint8_t* text, uint32_t len);
+
+#endif
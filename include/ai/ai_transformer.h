@@ -0,0 +1,90 @@
+#ifndef AI_TRANSFORMER_H
+#define AI_TRANSFORMER_H
+
+#include "ai/ai_model.h"
+#include "ai/ai_sampler.h"
+#include "ai/ai_session.h"
+#include "fixedpoint.h"
+#include "types.h"
+
+// Upper bound on cached positions; the KV ring slides past it.
+#define AI_CTX_MAX 1024u
+#define AI_TOP_P (q16_16_t)(58982)
+// Rows (prompt tokens or decode steps) per batched forward pass.
+#define AI_PREFILL_BATCH 32u
+
+typedef struct {
+    uint32_t n_vocab;
+    uint32_t n_embd;
+    uint32_t n_layer;
+    uint32_t n_head;
+    uint32_t n_head_kv;
+    uint32_t head_dim;
+    uint32_t n_ff;
+    uint32_t n_ctx;
+    uint32_t rope_freq_base;
+    uint32_t bos_token;
+    uint32_t eos_token;
+} ai_model_config_t;
+
+// A 2-D GGUF weight: `rows` output rows of `cols` contiguous input elements.
+typedef struct {
+    const uint8_t* data;
+    uint32_t type;
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t row_bytes;
+    uint32_t block_elems;
+    uint32_t block_bytes;
+} ai_weight_t;
+
+typedef struct {
+    q16_16_t* attn_norm;
+    q16_16_t* ffn_norm;
+    ai_weight_t wq;
+    ai_weight_t wk;
+    ai_weight_t wv;
+    ai_weight_t wo;
+    ai_weight_t w_gate;
+    ai_weight_t w_up;
+    ai_weight_t w_down;
+} ai_layer_weights_t;
+
+int ai_transformer_init(void);
+int ai_transformer_ready(void);
+const ai_model_config_t* ai_transformer_config(void);
+void ai_transformer_reset(void);
+uint32_t ai_transformer_position(void);
+// The console session's sampler; ai_transformer_reset restarts its seed.
+ai_sampler_t* ai_transformer_sampler(void);
+// Layer-ahead weight prefetch on an idle AI worker; on by default. Its
+// effect on tok/s has not been measured yet (see docs/ai_architecture.md).
+void ai_transformer_set_prefetch(int enabled);
+int ai_transformer_prefetch(void);
+// One token on the console session, under the session step lock. Fails
+// while the console is generating.
+int ai_transformer_forward(uint32_t token, q16_16_t* logits);
+uint32_t ai_transformer_generate(const char* prompt, uint32_t max_tokens, uint64_t* ticks_out);
+void ai_transformer_fill_context(ai_context_t* context);
+
+// One token of a batch. Rows of the same session must be in position order.
+// want_logits asks for the next-token logits after this row; on return
+// logits points at them (valid until the next batch).
+typedef struct {
+    ai_session_t* session;
+    uint32_t token;
+    uint32_t want_logits;
+    q16_16_t* logits;
+} ai_batch_row_t;
+
+// Runs rows from any mix of sessions through the model with each projection
+// as one GEMM, appending to each session's KV cache.
+int ai_transformer_batch(ai_batch_row_t* rows, uint32_t n);
+// Largest batch, and most rows per batch that may ask for logits.
+uint32_t ai_transformer_batch_rows(void);
+uint32_t ai_transformer_batch_outputs(void);
+
+void ai_weight_row_q16(const ai_weight_t* w, uint32_t row, q16_16_t* out);
+void ai_weight_matvec(const ai_weight_t* w, const q16_16_t* x, q16_16_t* y);
+
+#endif
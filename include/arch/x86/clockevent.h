@@ -0,0 +1,35 @@
+#ifndef CLOCKEVENT_H
+#define CLOCKEVENT_H
+
+#include "types.h"
+
+// One PIT jiffy at the 100Hz tick.
+#define CLOCK_NS_PER_TICK 10000000ull
+
+#define CLOCKEVENT_NONE 0
+#define CLOCKEVENT_ONESHOT 1
+#define CLOCKEVENT_TSC_DEADLINE 2
+
+// Measures the TSC and LAPIC timer rates against PIT channel 2. Polls the
+// channel, so it works before interrupts are enabled.
+void clock_init(void);
+uint64_t clock_tsc_khz(void);
+// LAPIC timer counts per millisecond at divide-by-16.
+uint32_t clock_lapic_khz(void);
+// Monotonic nanoseconds since clock_init, from the TSC; falls back to PIT
+// ticks if the TSC could not be calibrated.
+uint64_t clock_now_ns(void);
+void clock_delay_ns(uint64_t ns);
+
+// Puts this CPU's LAPIC timer in one-shot (or TSC-deadline) mode on
+// INT_LOCAL_TIMER. Returns 0 if the rates are unknown and the caller should
+// keep a periodic tick.
+int clockevent_init_cpu(void);
+// CLOCKEVENT_NONE until clockevent_init_cpu succeeds on this CPU.
+uint32_t clockevent_mode(void);
+// Arms this CPU's one-shot to fire at deadline_ns (clock_now_ns time). A
+// deadline already past fires at once; one more than ~4s out is cut short.
+void clockevent_program(uint64_t deadline_ns);
+void clockevent_stop(void);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include "types.h"
+#include "process.h"
+
+// Keeps the compiler from using x87/SSE registers in a function, for code
+// that runs before the interrupted task's SIMD state is saved.
+#define FPU_NO_SIMD __attribute__((target("general-regs-only")))
+
+// Turns on lazy SIMD switching once CR4.OSFXSR (and OSXSAVE, with AVX) is
+// set. Uses XSAVE when AVX state is enabled, FXSAVE otherwise.
+void fpu_init(void);
+int fpu_lazy_enabled(void);
+
+// Wrapped around every interrupt, exception and syscall. On the outermost
+// entry the interrupted task's registers are saved if it touched SIMD since
+// it last entered the kernel (CR0.TS clear), and the kernel gets the unit.
+// The outermost exit sets CR0.TS, so the next SIMD instruction of whichever
+// task resumes raises #NM.
+void fpu_enter(uint32_t vector) FPU_NO_SIMD;
+void fpu_leave(uint32_t vector) FPU_NO_SIMD;
+// #NM: clears CR0.TS and loads the current task's saved state, or the
+// initial state if it has none.
+void fpu_handle_nm(void) FPU_NO_SIMD;
+
+// Copies a parent's saved state into a forked child.
+void fpu_copy(process_t* dst, const process_t* src);
+// Drops a task's saved state, as on exec.
+void fpu_reset(process_t* proc);
+
+#endif
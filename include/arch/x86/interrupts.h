@@ -27,5 +27,8 @@ void interrupts_send_ipi(uint32_t target_cpu, uint32_t vector);
 #define INT_TIMER    32
 #define INT_KEYBOARD 33
 #define INT_SYSCALL  128
+#define INT_LOCAL_TIMER 239 // LAPIC one-shot; also the reschedule IPI and yield
+#define INT_WAKEUP   240 // IPI that only ends a hlt; no handler
+#define INT_SPURIOUS 255 // LAPIC spurious vector; never EOI'd
 
 #endif
@@ -4,6 +4,7 @@
 #include "types.h"
 
 uint64_t bench_matmul(uint32_t size);
+int bench_matmul_layouts(uint32_t size, uint32_t reps, uint64_t* strided_ticks, uint64_t* packed_ticks);
 uint64_t bench_last_ticks(void);
 
 #endif
@@ -13,6 +13,16 @@ int cpu_has_feature(uint32_t feature);
 #define CPU_FEATURE_SSE   1
 #define CPU_FEATURE_SSE41 2
 #define CPU_FEATURE_FPU   3
+#define CPU_FEATURE_SSE2  4
+#define CPU_FEATURE_AVX2  5
+#define CPU_FEATURE_SSSE3 6
+#define CPU_FEATURE_TSC   7
+#define CPU_FEATURE_TSC_DEADLINE 8
+#define CPU_FEATURE_APIC  9
+
+// APIC ID bits below smt_bits pick the thread within a core, bits below
+// pkg_bits the logical CPU within a package.
+void cpu_get_topology(uint32_t* smt_bits, uint32_t* pkg_bits);
 
 // Feature enablement
 void cpu_enable_feature(uint32_t feature);
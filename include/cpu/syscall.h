@@ -38,7 +38,11 @@ enum {
     SYS_AUDIT_GET = 31,
     SYS_POLICY_ADD = 32,
     SYS_EXEC_ELF = 33,
-    SYS_MAX = 34
+    SYS_AI_OPEN = 34,
+    SYS_AI_SUBMIT = 35,
+    SYS_AI_READ = 36,
+    SYS_AI_CLOSE = 37,
+    SYS_MAX = 38
 };
 
 #define OS_OK 0u
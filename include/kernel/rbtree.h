@@ -0,0 +1,39 @@
+#ifndef RBTREE_H
+#define RBTREE_H
+
+#include "types.h"
+
+// Intrusive red-black tree: the node is embedded in the owning struct and
+// the caller supplies the ordering, so inserting and erasing never allocate.
+// Equal keys go right of each other, so ties come out in insertion order.
+typedef struct rb_node {
+    struct rb_node* parent;
+    struct rb_node* left;
+    struct rb_node* right;
+    uint32_t red;
+} rb_node_t;
+
+typedef struct {
+    rb_node_t* root;
+    // Cached minimum, so the first node is O(1).
+    rb_node_t* leftmost;
+    uint32_t count;
+} rb_tree_t;
+
+typedef int (*rb_less_fn)(const rb_node_t* a, const rb_node_t* b);
+
+#define rb_entry(node, type, member) \
+    ((type*)((uint8_t*)(node) - __builtin_offsetof(type, member)))
+
+void rb_init(rb_tree_t* tree);
+void rb_insert(rb_tree_t* tree, rb_node_t* node, rb_less_fn less);
+void rb_erase(rb_tree_t* tree, rb_node_t* node);
+rb_node_t* rb_next(const rb_node_t* node);
+rb_node_t* rb_prev(const rb_node_t* node);
+rb_node_t* rb_last(const rb_tree_t* tree);
+
+static inline rb_node_t* rb_first(const rb_tree_t* tree) {
+    return tree->leftmost;
+}
+
+#endif
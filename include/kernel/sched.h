@@ -8,6 +8,9 @@ void scheduler_init(void);
 process_t* process_create(void (*entry)(void), uint32_t* page_directory);
 process_t* switch_task(registers_t* saved_stack, process_t** previous);
 process_t* scheduler_current(void);
+// Called by the interrupt exit stub once it is on the next task's stack;
+// releases the task this CPU switched away from to other CPUs.
+void scheduler_finish_switch(void);
 void context_switch(process_t* current, process_t* next, registers_t* saved_stack);
 process_t* scheduler_process_list(void);
 uint32_t scheduler_process_count(void);
@@ -20,6 +23,7 @@ void scheduler_set_cgroup(uint32_t pid, uint32_t cgroup_id, uint32_t share);
 void scheduler_set_rt(uint32_t pid, uint32_t priority, uint64_t budget, uint64_t period);
 void scheduler_set_deadline(uint32_t pid, uint64_t budget, uint64_t period, uint64_t deadline);
 void scheduler_sleep(uint64_t ticks);
+void scheduler_sleep_ns(uint64_t ns);
 int scheduler_wake(uint32_t pid);
 void scheduler_yield(void);
 void scheduler_balance_load(void);
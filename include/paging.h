@@ -12,6 +12,9 @@ int vm_unmap_region(process_t* proc, uint32_t start, uint32_t size);
 int vm_handle_page_fault(process_t* proc, uint32_t addr, uint32_t err_code);
 int vm_create_shared(uint32_t pages);
 int vm_map_shared(process_t* proc, uint32_t shared_id, uint32_t start);
+// vm_map_shared with extra region flags, e.g. VM_NOFORK.
+int vm_map_shared_ex(process_t* proc, uint32_t shared_id, uint32_t start, uint32_t extra_flags);
+uint32_t vm_shared_phys(uint32_t shared_id, uint32_t page);
 void vm_init_process(process_t* proc);
 int paging_clone_cow_range(uint32_t* parent, uint32_t* child, uint32_t start, uint32_t end);
 
@@ -41,6 +44,8 @@ static inline int is_addr_valid(uint32_t addr) { return mmu_get_phys(addr) != 0;
 #define VM_SHARED 0x20u
 #define VM_COW 0x40u
 #define VM_DEMAND 0x80u
+// Not inherited by fork: the mapping belongs to the process that made it.
+#define VM_NOFORK 0x100u
 #define VM_USER_BASE 0x00001000u
 #define VM_USER_LIMIT 0xBFFFFFFFu
 #define VM_KERNEL_BASE 0xC0000000u
@@ -1,6 +1,7 @@
 #ifndef PROCESS_H
 #define PROCESS_H
 
+#include "kernel/rbtree.h"
 #include "security/secure_caps.h"
 #include "types.h"
 
@@ -21,6 +22,8 @@ typedef struct {
 
 #define PROCESS_MAX_FDS 8
 #define PROCESS_MAX_REGIONS 16
+// Room for the x87, SSE and AVX XSAVE components, plus 64 bytes to align.
+#define PROCESS_FPU_AREA 1024
 
 typedef struct {
     uint32_t start;
@@ -75,7 +78,8 @@ typedef struct process {
     uint64_t rt_runtime;
     uint64_t rt_release;
     uint64_t vruntime;
-    uint64_t wake_tick;
+    // clock_now_ns time a timed sleep ends; 0 for none.
+    uint64_t wake_ns;
     uint64_t runtime_ticks;
     uint64_t ready_ticks;
     uint32_t switches;
@@ -104,7 +108,38 @@ typedef struct process {
     vm_region_t regions[PROCESS_MAX_REGIONS];
     struct process* next;
     struct process* wait_next;
+    // Runqueue linkage: run_node in the CFS or deadline tree, run_next and
+    // run_prev in an RT level list. run_class and run_key are the class and
+    // key it was queued under, so a later change to either cannot strand it.
     struct process* run_next;
+    struct process* run_prev;
+    rb_node_t run_node;
+    uint64_t run_key;
+    uint32_t run_class;
+    uint32_t on_rq;
+    // Set while a CPU still runs on the task's kernel stack: from when it is
+    // picked until the interrupt exit that switched it out has left its
+    // frame. Another CPU must not resume it before then.
+    uint32_t on_cpu;
+    // Tick it was queued at; waiting time and boost are derived from it
+    // instead of being counted up every tick.
+    uint64_t ready_since;
+    // Sleeping tasks wait in their CPU's tree, ordered by wake_ns.
+    rb_node_t sleep_node;
+    uint32_t on_sleep;
+    // Load balancing: run_weight is the weight the task was queued with,
+    // last_ran the tick it was last switched out, run_start its runtime_ticks
+    // when switched in and avg_run a running average of ticks per run.
+    uint32_t run_weight;
+    uint64_t last_ran;
+    uint64_t run_start;
+    uint64_t avg_run;
+    // SIMD registers saved by fpu_enter; fpu_valid once anything was saved.
+    // fpu_nest counts the kernel entries the task is inside. A new task
+    // starts at 1, since its first run leaves through the interrupt exit.
+    uint8_t fpu_area[PROCESS_FPU_AREA + 64];
+    uint32_t fpu_valid;
+    uint32_t fpu_nest;
     wait_queue_t wait_queue;
 } process_t;
 
@@ -0,0 +1,62 @@
+#include "ai/ai_arena.h"
+#include "mem/pmm.h"
+#include "types.h"
+#include "util.h"
+
+static uint8_t* arena_cursor = 0;
+static uint8_t* arena_limit = 0;
+static uint32_t arena_used = 0;
+static uint32_t arena_reserved = 0;
+static spinlock_t arena_lock = 0;
+
+static uint32_t align_up(uint32_t value, uint32_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+void* ai_arena_alloc(uint32_t size, uint32_t align) {
+    if (size == 0) {
+        return 0;
+    }
+    if (align < 16) {
+        align = 16;
+    }
+    uint32_t flags = spin_lock_irqsave(&arena_lock);
+    uint32_t start = align_up((uint32_t)arena_cursor, align);
+    if (!arena_cursor || start + size > (uint32_t)arena_limit || start + size < start) {
+        // Oversized requests get a dedicated run so the current chunk keeps its tail.
+        uint32_t block_size = pmm_block_size();
+        uint32_t blocks = (size + block_size - 1) / block_size;
+        int dedicated = blocks > AI_ARENA_CHUNK_BLOCKS / 2;
+        if (!dedicated) {
+            blocks = AI_ARENA_CHUNK_BLOCKS;
+        }
+        uint32_t phys = pmm_alloc_contiguous(blocks);
+        if (!phys) {
+            spin_unlock_irqrestore(&arena_lock, flags);
+            return 0;
+        }
+        arena_reserved += blocks * block_size;
+        if (dedicated) {
+            arena_used += size;
+            spin_unlock_irqrestore(&arena_lock, flags);
+            memset((void*)phys, 0, size);
+            return (void*)phys;
+        }
+        arena_cursor = (uint8_t*)phys;
+        arena_limit = (uint8_t*)(phys + blocks * block_size);
+        start = align_up((uint32_t)arena_cursor, align);
+    }
+    arena_cursor = (uint8_t*)(start + size);
+    arena_used += size;
+    spin_unlock_irqrestore(&arena_lock, flags);
+    memset((void*)start, 0, size);
+    return (void*)start;
+}
+
+uint32_t ai_arena_used_bytes(void) {
+    return arena_used;
+}
+
+uint32_t ai_arena_reserved_bytes(void) {
+    return arena_reserved;
+}
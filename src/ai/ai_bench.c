@@ -0,0 +1,456 @@
+#include "ai/ai_bench.h"
+#include "ai/ai_gemm.h"
+#include "ai/ai_math.h"
+#include "ai/ai_model.h"
+#include "ai/ai_quant.h"
+#include "ai/ai_sampler.h"
+#include "ai/ai_session.h"
+#include "ai/ai_transformer.h"
+#include "arch/x86/timer.h"
+#include "diag.h"
+#include "drivers/serial.h"
+#include "mem/pmm.h"
+#include "types.h"
+#include "util.h"
+
+#define AI_BENCH_TIMER_HZ 100u
+#define AI_BENCH_CAL_TICKS 10u
+// Give up calibrating if no tick arrives in this many cycles (seconds on
+// any machine this runs on).
+#define AI_BENCH_CAL_GUARD (1ull << 34)
+#define AI_BENCH_GEMM_ROWS AI_PREFILL_BATCH
+#define AI_BENCH_SOFTMAX_N 1024u
+
+// Block layouts of the formats the fused dot handles; d_off and dmin_off
+// are where the f16 scales sit, so synthetic blocks decode to sane values.
+typedef struct {
+    const char* name;
+    const char* name_a8;
+    uint32_t type;
+    uint32_t elems;
+    uint32_t bytes;
+    uint32_t d_off;
+    uint32_t dmin_off;
+} bench_format_t;
+
+#define NO_DMIN 0xFFFFFFFFu
+
+static const bench_format_t formats[] = {
+    { "dot_q8_0", "dot_q8_0_a8", GGML_TYPE_Q8_0, 32, 34, 0, NO_DMIN },
+    { "dot_q4_0", "dot_q4_0_a8", GGML_TYPE_Q4_0, 32, 18, 0, NO_DMIN },
+    { "dot_q5_0", "dot_q5_0_a8", GGML_TYPE_Q5_0, 32, 22, 0, NO_DMIN },
+    { "dot_q4_k", "dot_q4_k_a8", GGML_TYPE_Q4_K, 256, 144, 0, 2 },
+    { "dot_q6_k", "dot_q6_k_a8", GGML_TYPE_Q6_K, 256, 210, 208, NO_DMIN },
+};
+
+// Everything one kernel call needs; each runner reads the fields it uses.
+typedef struct {
+    uint32_t type;
+    const uint8_t* w;
+    uint32_t row_bytes;
+    const ai_weight_t* weight;
+    q16_16_t* x;
+    ai_q8_block_t* xq;
+    q16_16_t* y;
+    const q16_16_t* a;
+    const q16_16_t* b;
+    q16_16_t* c;
+    uint32_t m;
+    uint32_t n;
+    uint32_t k;
+    ai_sampler_t* sampler;
+} bench_args_t;
+
+typedef void (*bench_fn)(bench_args_t* args);
+
+static uint64_t tsc_khz = 0;
+static uint32_t bench_rng = 0x9E3779B9u;
+static ai_sampler_t bench_sampler;
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo;
+    uint32_t hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+uint64_t ai_bench_tsc_khz(void) {
+    if (tsc_khz) {
+        return tsc_khz;
+    }
+    // Start on a tick edge so the window is whole ticks.
+    uint64_t guard = rdtsc();
+    uint64_t t0 = timer_get_ticks();
+    while (timer_get_ticks() == t0) {
+        if (rdtsc() - guard > AI_BENCH_CAL_GUARD) {
+            return 0;
+        }
+        __asm__ __volatile__("pause");
+    }
+    uint64_t start = rdtsc();
+    uint64_t t1 = timer_get_ticks();
+    while (timer_get_ticks() - t1 < AI_BENCH_CAL_TICKS) {
+        __asm__ __volatile__("pause");
+    }
+    uint64_t cycles = rdtsc() - start;
+    tsc_khz = cycles * AI_BENCH_TIMER_HZ / (AI_BENCH_CAL_TICKS * 1000u);
+    return tsc_khz;
+}
+
+static uint32_t bench_rand(void) {
+    uint32_t x = bench_rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    bench_rng = x;
+    return x;
+}
+
+static void fill_bytes(uint8_t* p, uint32_t n) {
+    for (uint32_t i = 0; i < n; ++i) {
+        p[i] = (uint8_t)bench_rand();
+    }
+}
+
+// Uniform in [-1, 1).
+static void fill_q16(q16_16_t* p, uint32_t n) {
+    for (uint32_t i = 0; i < n; ++i) {
+        p[i] = (q16_16_t)(bench_rand() & 0x1FFFFu) - 0x10000;
+    }
+}
+
+static void put_f16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+// Random blocks with d = 1/16 and dmin = 1/64.
+static void fill_blocks(const bench_format_t* f, uint8_t* p, uint32_t blocks) {
+    fill_bytes(p, blocks * f->bytes);
+    for (uint32_t i = 0; i < blocks; ++i) {
+        uint8_t* b = p + i * f->bytes;
+        put_f16(b + f->d_off, 0x2C00);
+        if (f->dmin_off != NO_DMIN) {
+            put_f16(b + f->dmin_off, 0x2400);
+        }
+    }
+}
+
+static uint8_t* carve(uint8_t** cursor, uint32_t bytes) {
+    uint8_t* p = *cursor;
+    *cursor += (bytes + 63u) & ~63u;
+    return p;
+}
+
+static void write_dec(uint64_t v) {
+    char buf[21];
+    uint32_t i = sizeof(buf) - 1;
+    buf[i] = 0;
+    do {
+        buf[--i] = (char)('0' + (uint32_t)(v % 10u));
+        v /= 10u;
+    } while (v && i);
+    serial_write_string(buf + i);
+}
+
+static void write_field(const char* key, uint64_t v) {
+    serial_write_string(" ");
+    serial_write_string(key);
+    serial_write_string("=");
+    write_dec(v);
+}
+
+static void emit(ai_bench_result_t* r, ai_bench_report_fn report) {
+    r->mops = 0;
+    if (r->cycles && tsc_khz) {
+        r->mops = r->ops * tsc_khz / (r->cycles * 1000u);
+    }
+    serial_write_string("AIBENCH name=");
+    serial_write_string(r->name);
+    write_field("m", r->m);
+    write_field("n", r->n);
+    write_field("k", r->k);
+    write_field("reps", r->reps);
+    write_field("ops", r->ops);
+    write_field("cycles", r->cycles);
+    write_field("mops", r->mops);
+    write_field("tokens", r->tokens);
+    write_field("tps_x100", r->tps_x100);
+    serial_write_string("\n");
+    if (report) {
+        report(r);
+    }
+}
+
+// One untimed call to fault in and warm the operands, then the mean of reps.
+static uint64_t time_reps(bench_fn fn, bench_args_t* args, uint32_t reps) {
+    fn(args);
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < reps; ++i) {
+        fn(args);
+    }
+    return (rdtsc() - start) / reps;
+}
+
+static uint32_t run_one(const char* name, bench_fn fn, bench_args_t* args, uint32_t reps,
+                        uint32_t m, uint32_t n, uint32_t k, uint64_t ops,
+                        ai_bench_report_fn report) {
+    ai_bench_result_t r;
+    memset(&r, 0, sizeof(r));
+    r.name = name;
+    r.m = m;
+    r.n = n;
+    r.k = k;
+    r.reps = reps;
+    r.ops = ops;
+    r.cycles = time_reps(fn, args, reps);
+    emit(&r, report);
+    return 1;
+}
+
+static void run_dot_q16(bench_args_t* a) {
+    ai_quant_matvec_q16(a->type, a->w, a->row_bytes, a->x, a->y, a->m, a->k);
+}
+
+static void run_dot_q8(bench_args_t* a) {
+    ai_quant_matvec_q8(a->type, a->w, a->row_bytes, a->xq, a->y, a->m, a->k);
+}
+
+static void run_quant_x(bench_args_t* a) {
+    ai_quant_x_q8(a->x, a->xq, a->k);
+}
+
+static void run_gemv_q16(bench_args_t* a) {
+    ai_matmul_q16_16(a->a, a->x, a->y, a->m, 1, a->k);
+}
+
+static void run_gemv_weight(bench_args_t* a) {
+    ai_weight_matvec(a->weight, a->x, a->y);
+}
+
+static void run_gemm(bench_args_t* a) {
+    ai_gemm_q16(a->a, a->b, a->c, a->m, a->n, a->k);
+}
+
+static void run_softmax(bench_args_t* a) {
+    ai_softmax_q16(a->x, a->n);
+}
+
+static void run_rmsnorm(bench_args_t* a) {
+    rmsnorm(a->x, a->n);
+}
+
+static void run_rope(bench_args_t* a) {
+    rope_apply(a->x, a->n, a->k, 7);
+}
+
+static void run_sample(bench_args_t* a) {
+    ai_sampler_pick(a->sampler, a->y, a->n);
+}
+
+// Prompt-sized batch, then single-token decode steps, on a throwaway
+// session. The caller holds the engine off.
+static uint32_t bench_e2e(ai_session_t* s, ai_bench_report_fn report) {
+    const ai_model_config_t* config = ai_transformer_config();
+    uint32_t vocab = config->n_vocab;
+    uint32_t n = ai_transformer_batch_rows();
+    if (n > AI_PREFILL_BATCH) {
+        n = AI_PREFILL_BATCH;
+    }
+    ai_batch_row_t rows[AI_PREFILL_BATCH];
+    for (uint32_t i = 0; i < n; ++i) {
+        rows[i].session = s;
+        rows[i].token = (config->bos_token + 1u + i * 7919u) % vocab;
+        rows[i].want_logits = (i + 1 == n);
+        rows[i].logits = 0;
+    }
+    uint64_t start = rdtsc();
+    if (!ai_transformer_batch(rows, n)) {
+        return 0;
+    }
+    uint64_t prefill = rdtsc() - start;
+
+    uint32_t token = rows[n - 1].token;
+    start = rdtsc();
+    for (uint32_t i = 0; i < AI_BENCH_DECODE_TOKENS; ++i) {
+        rows[0].session = s;
+        rows[0].token = token;
+        rows[0].want_logits = 1;
+        rows[0].logits = 0;
+        if (!ai_transformer_batch(rows, 1)) {
+            return 1;
+        }
+        token = (token * 31u + 7u) % vocab;
+    }
+    uint64_t decode = rdtsc() - start;
+
+    ai_bench_result_t r;
+    memset(&r, 0, sizeof(r));
+    r.name = "prefill";
+    r.m = n;
+    r.n = config->n_embd;
+    r.k = config->n_layer;
+    r.reps = 1;
+    r.cycles = prefill;
+    r.tokens = n;
+    if (prefill) {
+        r.tps_x100 = (uint64_t)n * tsc_khz * 100000u / prefill;
+    }
+    emit(&r, report);
+
+    r.name = "decode";
+    r.m = 1;
+    r.reps = AI_BENCH_DECODE_TOKENS;
+    r.cycles = decode / AI_BENCH_DECODE_TOKENS;
+    r.tokens = AI_BENCH_DECODE_TOKENS;
+    r.tps_x100 = 0;
+    if (decode) {
+        r.tps_x100 = (uint64_t)AI_BENCH_DECODE_TOKENS * tsc_khz * 100000u / decode;
+    }
+    emit(&r, report);
+    return 2;
+}
+
+uint32_t ai_bench_run(uint32_t reps, ai_bench_report_fn report) {
+    if (reps == 0) {
+        reps = 1;
+    }
+    if (!ai_bench_tsc_khz()) {
+        diag_log(DIAG_WARN, "ai bench: timer not running, no TSC rate");
+    }
+
+    const uint32_t dim = AI_BENCH_DIM;
+    const uint32_t ff = AI_BENCH_FF;
+    uint32_t weight_bytes = dim * (ff / 256u) * 144u;
+    uint32_t dot_bytes = AI_BENCH_DOT_ROWS * (ff / 32u) * 34u;
+    if (dot_bytes > weight_bytes) {
+        weight_bytes = dot_bytes;
+    }
+    uint32_t bytes = weight_bytes + 64u;
+    bytes += (ff * sizeof(q16_16_t) + 64u) * 2u;
+    bytes += (ff / AI_Q8_BLOCK) * sizeof(ai_q8_block_t) + 64u;
+    bytes += AI_BENCH_VOCAB * sizeof(q16_16_t) + 64u;
+    bytes += dim * ff * sizeof(q16_16_t) + 64u;
+    bytes += (AI_BENCH_GEMM_ROWS * ff * sizeof(q16_16_t) + 64u) * 2u;
+    uint32_t block = pmm_block_size();
+    uint32_t blocks = (bytes + block - 1) / block;
+    uint32_t phys = pmm_alloc_contiguous(blocks);
+    if (!phys) {
+        diag_log(DIAG_WARN, "ai bench: no memory for buffers");
+        return 0;
+    }
+    uint8_t* cursor = (uint8_t*)phys;
+    uint8_t* wq = carve(&cursor, weight_bytes);
+    q16_16_t* x = (q16_16_t*)carve(&cursor, ff * sizeof(q16_16_t));
+    q16_16_t* x_copy = (q16_16_t*)carve(&cursor, ff * sizeof(q16_16_t));
+    ai_q8_block_t* xq = (ai_q8_block_t*)carve(&cursor, (ff / AI_Q8_BLOCK) * sizeof(ai_q8_block_t));
+    q16_16_t* y = (q16_16_t*)carve(&cursor, AI_BENCH_VOCAB * sizeof(q16_16_t));
+    q16_16_t* w16 = (q16_16_t*)carve(&cursor, dim * ff * sizeof(q16_16_t));
+    q16_16_t* a = (q16_16_t*)carve(&cursor, AI_BENCH_GEMM_ROWS * ff * sizeof(q16_16_t));
+    q16_16_t* c = (q16_16_t*)carve(&cursor, AI_BENCH_GEMM_ROWS * ff * sizeof(q16_16_t));
+
+    fill_q16(x_copy, ff);
+    fill_q16(w16, dim * ff);
+    fill_q16(a, AI_BENCH_GEMM_ROWS * ff);
+    fill_q16(y, AI_BENCH_VOCAB);
+    memcpy(x, x_copy, ff * sizeof(q16_16_t));
+    ai_quant_x_q8(x, xq, ff);
+
+    // Sessions stepping in the background would skew every number.
+    ai_session_lock();
+
+    uint32_t count = 0;
+    bench_args_t args;
+    memset(&args, 0, sizeof(args));
+    args.x = x;
+    args.xq = xq;
+    args.y = y;
+
+    for (uint32_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+        const bench_format_t* f = &formats[i];
+        if (!ai_quant_dot_supported(f->type)) {
+            continue;
+        }
+        uint32_t row_bytes = (ff / f->elems) * f->bytes;
+        fill_blocks(f, wq, AI_BENCH_DOT_ROWS * (ff / f->elems));
+        args.type = f->type;
+        args.w = wq;
+        args.row_bytes = row_bytes;
+        args.m = AI_BENCH_DOT_ROWS;
+        args.k = ff;
+        uint64_t ops = 2ull * AI_BENCH_DOT_ROWS * ff;
+        count += run_one(f->name, run_dot_q16, &args, reps, AI_BENCH_DOT_ROWS, 1, ff, ops, report);
+        if (ai_quant_q8_supported(f->type)) {
+            count += run_one(f->name_a8, run_dot_q8, &args, reps, AI_BENCH_DOT_ROWS, 1, ff, ops, report);
+        }
+    }
+    args.k = ff;
+    count += run_one("quant_x_q8", run_quant_x, &args, reps, 1, 1, ff, 2ull * ff, report);
+
+    args.a = w16;
+    args.m = dim;
+    args.k = ff;
+    count += run_one("gemv_q16", run_gemv_q16, &args, reps, dim, 1, ff, 2ull * dim * ff, report);
+
+    // An FFN down projection as the model stores it.
+    fill_blocks(&formats[3], wq, dim * (ff / 256u));
+    ai_weight_t weight;
+    weight.data = wq;
+    weight.type = GGML_TYPE_Q4_K;
+    weight.rows = dim;
+    weight.cols = ff;
+    weight.row_bytes = (ff / 256u) * 144u;
+    weight.block_elems = 256;
+    weight.block_bytes = 144;
+    args.weight = &weight;
+    count += run_one("gemv_q4_k", run_gemv_weight, &args, reps, dim, 1, ff, 2ull * dim * ff, report);
+
+    // Prompt-chunk GEMMs: the up projection (576 -> 1536) and the down
+    // projection (1536 -> 576), weights pre-transposed as the GEMM takes them.
+    args.a = a;
+    args.b = w16;
+    args.c = c;
+    args.m = AI_BENCH_GEMM_ROWS;
+    args.n = ff;
+    args.k = dim;
+    count += run_one("gemm_up", run_gemm, &args, reps, AI_BENCH_GEMM_ROWS, ff, dim,
+                     2ull * AI_BENCH_GEMM_ROWS * ff * dim, report);
+    args.n = dim;
+    args.k = ff;
+    count += run_one("gemm_down", run_gemm, &args, reps, AI_BENCH_GEMM_ROWS, dim, ff,
+                     2ull * AI_BENCH_GEMM_ROWS * ff * dim, report);
+
+    // Elementwise kernels count nominal ops per element: softmax 4 (max,
+    // sub, exp, scale), rmsnorm 3, RoPE 6 per pair, sampling 1.
+    args.n = AI_BENCH_SOFTMAX_N;
+    count += run_one("softmax", run_softmax, &args, reps, 1, args.n, 0, 4ull * args.n, report);
+    memcpy(x, x_copy, ff * sizeof(q16_16_t));
+    args.n = dim;
+    count += run_one("rmsnorm", run_rmsnorm, &args, reps, 1, dim, 0, 3ull * dim, report);
+    memcpy(x, x_copy, ff * sizeof(q16_16_t));
+    // rope_apply refuses a head size other than the one it was set up
+    // with, so match the loaded model's.
+    const ai_model_config_t* config = ai_transformer_config();
+    args.k = (config && config->head_dim >= 2) ? config->head_dim : AI_BENCH_HEAD_DIM;
+    count += run_one("rope", run_rope, &args, reps, 1, dim, args.k, 3ull * dim, report);
+    ai_sampler_params_t params;
+    ai_sampler_defaults(&params);
+    ai_sampler_init(&bench_sampler, &params);
+    args.sampler = &bench_sampler;
+    args.n = AI_BENCH_VOCAB;
+    count += run_one("sample", run_sample, &args, reps, 1, AI_BENCH_VOCAB, 0, AI_BENCH_VOCAB, report);
+
+    ai_session_t* s = 0;
+    if (ai_transformer_ready()) {
+        s = ai_session_create(0);
+        if (s) {
+            count += bench_e2e(s, report);
+        }
+    }
+    ai_session_unlock();
+    if (s) {
+        ai_session_destroy(s);
+    }
+    pmm_free_region(phys, blocks * block);
+    return count;
+}
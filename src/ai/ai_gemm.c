@@ -0,0 +1,263 @@
+#include "ai/ai_gemm.h"
+#include "ai/ai_model.h"
+#include "cpu.h"
+#include "diag.h"
+#include "types.h"
+
+// All kernels work in dot-product form over packed B (bt[n][k]): a 2x2 tile
+// of C is four dot products of k-contiguous rows, vectorised along k with
+// 32x32->64 multiplies. K stays whole, so partial sums never leave registers;
+// blocking is over N (a panel of bt sized for L2) with the A row pair reused
+// from L1 across the panel.
+#define AI_GEMM_MR 2u
+#define AI_GEMM_NR 2u
+
+typedef int v4si __attribute__((vector_size(16)));
+typedef int v4si_u __attribute__((vector_size(16), aligned(4)));
+typedef long long v2di __attribute__((vector_size(16)));
+typedef unsigned long long v2du __attribute__((vector_size(16)));
+typedef int v8si __attribute__((vector_size(32)));
+typedef int v8si_u __attribute__((vector_size(32), aligned(4)));
+typedef long long v4di __attribute__((vector_size(32)));
+typedef unsigned long long v4du __attribute__((vector_size(32)));
+
+// out[0..3] = a0.b0, a0.b1, a1.b0, a1.b1 as exact 64-bit sums (32.32).
+typedef void (*ai_gemm_kernel_fn)(const q16_16_t* a0, const q16_16_t* a1,
+                                  const q16_16_t* b0, const q16_16_t* b1,
+                                  uint32_t k, int64_t* out);
+
+static void gemm_tail(const q16_16_t* a0, const q16_16_t* a1,
+                      const q16_16_t* b0, const q16_16_t* b1,
+                      uint32_t p, uint32_t k, int64_t* out) {
+    for (; p < k; ++p) {
+        out[0] += (int64_t)a0[p] * b0[p];
+        out[1] += (int64_t)a0[p] * b1[p];
+        out[2] += (int64_t)a1[p] * b0[p];
+        out[3] += (int64_t)a1[p] * b1[p];
+    }
+}
+
+// The 2x2 packed loop that ai_matmul_packed_serial() used to run, now
+// summing exactly in 64 bits like the vector kernels.
+static void gemm_kernel_scalar(const q16_16_t* a0, const q16_16_t* a1,
+                               const q16_16_t* b0, const q16_16_t* b1,
+                               uint32_t k, int64_t* out) {
+    out[0] = 0;
+    out[1] = 0;
+    out[2] = 0;
+    out[3] = 0;
+    gemm_tail(a0, a1, b0, b1, 0, k, out);
+}
+
+// SSE2 has only the unsigned pmuludq; fix up the high dword for negative
+// operands: a*b = ua*ub - 2^32 * ((a < 0 ? b : 0) + (b < 0 ? a : 0)).
+static inline v2di mul_even_sse2(v4si a, v4si b) {
+    v2di u = (v2di)__builtin_ia32_pmuludq128(a, b);
+    v4si fix = ((a >> 31) & b) + ((b >> 31) & a);
+    return u - (v2di)((v2du)fix << 32);
+}
+
+static void gemm_kernel_sse2(const q16_16_t* a0, const q16_16_t* a1,
+                             const q16_16_t* b0, const q16_16_t* b1,
+                             uint32_t k, int64_t* out) {
+    v2di acc00 = { 0, 0 }, acc01 = { 0, 0 }, acc10 = { 0, 0 }, acc11 = { 0, 0 };
+    uint32_t p = 0;
+    for (; p + 4 <= k; p += 4) {
+        v4si va0 = *(const v4si_u*)(a0 + p);
+        v4si va1 = *(const v4si_u*)(a1 + p);
+        v4si vb0 = *(const v4si_u*)(b0 + p);
+        v4si vb1 = *(const v4si_u*)(b1 + p);
+        v4si oa0 = (v4si)((v2du)va0 >> 32);
+        v4si oa1 = (v4si)((v2du)va1 >> 32);
+        v4si ob0 = (v4si)((v2du)vb0 >> 32);
+        v4si ob1 = (v4si)((v2du)vb1 >> 32);
+        acc00 += mul_even_sse2(va0, vb0) + mul_even_sse2(oa0, ob0);
+        acc01 += mul_even_sse2(va0, vb1) + mul_even_sse2(oa0, ob1);
+        acc10 += mul_even_sse2(va1, vb0) + mul_even_sse2(oa1, ob0);
+        acc11 += mul_even_sse2(va1, vb1) + mul_even_sse2(oa1, ob1);
+    }
+    out[0] = acc00[0] + acc00[1];
+    out[1] = acc01[0] + acc01[1];
+    out[2] = acc10[0] + acc10[1];
+    out[3] = acc11[0] + acc11[1];
+    gemm_tail(a0, a1, b0, b1, p, k, out);
+}
+
+__attribute__((target("sse4.1")))
+static void gemm_kernel_sse41(const q16_16_t* a0, const q16_16_t* a1,
+                              const q16_16_t* b0, const q16_16_t* b1,
+                              uint32_t k, int64_t* out) {
+    v2di acc00 = { 0, 0 }, acc01 = { 0, 0 }, acc10 = { 0, 0 }, acc11 = { 0, 0 };
+    uint32_t p = 0;
+    for (; p + 4 <= k; p += 4) {
+        v4si va0 = *(const v4si_u*)(a0 + p);
+        v4si va1 = *(const v4si_u*)(a1 + p);
+        v4si vb0 = *(const v4si_u*)(b0 + p);
+        v4si vb1 = *(const v4si_u*)(b1 + p);
+        v4si oa0 = (v4si)((v2du)va0 >> 32);
+        v4si oa1 = (v4si)((v2du)va1 >> 32);
+        v4si ob0 = (v4si)((v2du)vb0 >> 32);
+        v4si ob1 = (v4si)((v2du)vb1 >> 32);
+        acc00 += __builtin_ia32_pmuldq128(va0, vb0) + __builtin_ia32_pmuldq128(oa0, ob0);
+        acc01 += __builtin_ia32_pmuldq128(va0, vb1) + __builtin_ia32_pmuldq128(oa0, ob1);
+        acc10 += __builtin_ia32_pmuldq128(va1, vb0) + __builtin_ia32_pmuldq128(oa1, ob0);
+        acc11 += __builtin_ia32_pmuldq128(va1, vb1) + __builtin_ia32_pmuldq128(oa1, ob1);
+    }
+    out[0] = acc00[0] + acc00[1];
+    out[1] = acc01[0] + acc01[1];
+    out[2] = acc10[0] + acc10[1];
+    out[3] = acc11[0] + acc11[1];
+    gemm_tail(a0, a1, b0, b1, p, k, out);
+}
+
+__attribute__((target("avx2")))
+static void gemm_kernel_avx2(const q16_16_t* a0, const q16_16_t* a1,
+                             const q16_16_t* b0, const q16_16_t* b1,
+                             uint32_t k, int64_t* out) {
+    v4di acc00 = { 0, 0, 0, 0 }, acc01 = { 0, 0, 0, 0 };
+    v4di acc10 = { 0, 0, 0, 0 }, acc11 = { 0, 0, 0, 0 };
+    uint32_t p = 0;
+    for (; p + 8 <= k; p += 8) {
+        v8si va0 = *(const v8si_u*)(a0 + p);
+        v8si va1 = *(const v8si_u*)(a1 + p);
+        v8si vb0 = *(const v8si_u*)(b0 + p);
+        v8si vb1 = *(const v8si_u*)(b1 + p);
+        v8si oa0 = (v8si)((v4du)va0 >> 32);
+        v8si oa1 = (v8si)((v4du)va1 >> 32);
+        v8si ob0 = (v8si)((v4du)vb0 >> 32);
+        v8si ob1 = (v8si)((v4du)vb1 >> 32);
+        acc00 += __builtin_ia32_pmuldq256(va0, vb0) + __builtin_ia32_pmuldq256(oa0, ob0);
+        acc01 += __builtin_ia32_pmuldq256(va0, vb1) + __builtin_ia32_pmuldq256(oa0, ob1);
+        acc10 += __builtin_ia32_pmuldq256(va1, vb0) + __builtin_ia32_pmuldq256(oa1, ob0);
+        acc11 += __builtin_ia32_pmuldq256(va1, vb1) + __builtin_ia32_pmuldq256(oa1, ob1);
+    }
+    out[0] = acc00[0] + acc00[1] + acc00[2] + acc00[3];
+    out[1] = acc01[0] + acc01[1] + acc01[2] + acc01[3];
+    out[2] = acc10[0] + acc10[1] + acc10[2] + acc10[3];
+    out[3] = acc11[0] + acc11[1] + acc11[2] + acc11[3];
+    gemm_tail(a0, a1, b0, b1, p, k, out);
+}
+
+static const ai_gemm_kernel_fn gemm_kernels[] = {
+    gemm_kernel_scalar,
+    gemm_kernel_sse2,
+    gemm_kernel_sse41,
+    gemm_kernel_avx2,
+};
+
+static const char* const gemm_names[] = { "scalar", "sse2", "sse4.1", "avx2" };
+
+static uint32_t gemm_isa_max = AI_GEMM_SCALAR;
+static uint32_t gemm_isa = AI_GEMM_SCALAR;
+
+void ai_gemm_init(void) {
+    uint32_t isa = AI_GEMM_SCALAR;
+    if (cpu_has_feature(CPU_FEATURE_SSE2)) {
+        isa = AI_GEMM_SSE2;
+    }
+    if (isa == AI_GEMM_SSE2 && cpu_has_feature(CPU_FEATURE_SSE41)) {
+        isa = AI_GEMM_SSE41;
+    }
+    if (isa == AI_GEMM_SSE41 && cpu_has_feature(CPU_FEATURE_AVX2)) {
+        isa = AI_GEMM_AVX2;
+    }
+    gemm_isa_max = isa;
+    gemm_isa = isa;
+    diag_log_hex32(DIAG_INFO, "AI GEMM kernel", isa);
+}
+
+uint32_t ai_gemm_isa(void) {
+    return gemm_isa;
+}
+
+const char* ai_gemm_isa_name(uint32_t isa) {
+    return isa <= AI_GEMM_AVX2 ? gemm_names[isa] : "unknown";
+}
+
+uint32_t ai_gemm_set_isa(uint32_t isa) {
+    gemm_isa = isa > gemm_isa_max ? gemm_isa_max : isa;
+    return gemm_isa;
+}
+
+typedef struct {
+    const q16_16_t* a;
+    const q16_16_t* bt;
+    q16_16_t* c;
+    uint32_t ldc;
+    uint32_t m;
+    uint32_t n;
+    uint32_t k;
+    ai_gemm_kernel_fn kernel;
+} gemm_args_t;
+
+static void gemm_block(const gemm_args_t* g, uint32_t i0, uint32_t i1, uint32_t j0, uint32_t j1) {
+    uint32_t k = g->k;
+    uint32_t nc = AI_GEMM_L2_BYTES / (k * (uint32_t)sizeof(q16_16_t));
+    nc -= nc % AI_GEMM_NR;
+    if (nc < AI_GEMM_NR) {
+        nc = AI_GEMM_NR;
+    }
+    int64_t acc[4];
+    for (uint32_t jc = j0; jc < j1; jc += nc) {
+        uint32_t jend = jc + nc < j1 ? jc + nc : j1;
+        for (uint32_t i = i0; i < i1; i += AI_GEMM_MR) {
+            const q16_16_t* a0 = g->a + i * k;
+            int two_rows = i + 1 < i1;
+            const q16_16_t* a1 = two_rows ? a0 + k : a0;
+            q16_16_t* c0 = g->c + i * g->ldc;
+            for (uint32_t j = jc; j < jend; j += AI_GEMM_NR) {
+                const q16_16_t* b0 = g->bt + j * k;
+                int two_cols = j + 1 < jend;
+                const q16_16_t* b1 = two_cols ? b0 + k : b0;
+                g->kernel(a0, a1, b0, b1, k, acc);
+                c0[j] = (q16_16_t)(acc[0] >> 16);
+                if (two_cols) {
+                    c0[j + 1] = (q16_16_t)(acc[1] >> 16);
+                }
+                if (two_rows) {
+                    c0[g->ldc + j] = (q16_16_t)(acc[2] >> 16);
+                    if (two_cols) {
+                        c0[g->ldc + j + 1] = (q16_16_t)(acc[3] >> 16);
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void gemm_rows_worker(void* arg, uint32_t start, uint32_t end) {
+    const gemm_args_t* g = (const gemm_args_t*)arg;
+    gemm_block(g, start, end, 0, g->n);
+}
+
+static void gemm_cols_worker(void* arg, uint32_t start, uint32_t end) {
+    const gemm_args_t* g = (const gemm_args_t*)arg;
+    gemm_block(g, 0, g->m, start, end);
+}
+
+int ai_gemm_q16(const q16_16_t* a, const q16_16_t* bt, q16_16_t* c, uint32_t m, uint32_t n, uint32_t k) {
+    return ai_gemm_q16_ldc(a, bt, c, n, m, n, k);
+}
+
+int ai_gemm_q16_ldc(const q16_16_t* a, const q16_16_t* bt, q16_16_t* c, uint32_t ldc,
+                    uint32_t m, uint32_t n, uint32_t k) {
+    if (!a || !bt || !c || m == 0 || n == 0 || k == 0 || ldc < n) {
+        return 0;
+    }
+    gemm_args_t g;
+    g.a = a;
+    g.bt = bt;
+    g.c = c;
+    g.ldc = ldc;
+    g.m = m;
+    g.n = n;
+    g.k = k;
+    g.kernel = gemm_kernels[gemm_isa];
+    // Split along the longer side so each worker gets whole panels.
+    if (m >= n) {
+        ai_scheduler_run_rows(m, 4, gemm_rows_worker, &g);
+    } else {
+        ai_scheduler_run_rows(n, 8, gemm_cols_worker, &g);
+    }
+    return 1;
+}
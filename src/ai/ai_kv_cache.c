@@ -0,0 +1,84 @@
+#include "ai/ai_kv_cache.h"
+#include "diag.h"
+#include "mem/pmm.h"
+#include "types.h"
+#include "util.h"
+
+int ai_kv_cache_create(ai_kv_cache_t* cache, uint32_t n_layer, uint32_t n_head_kv,
+                       uint32_t head_dim, uint32_t capacity, uint32_t mode) {
+    if (!cache || n_layer == 0 || n_head_kv == 0 || head_dim == 0 || capacity == 0) {
+        return 0;
+    }
+    memset(cache, 0, sizeof(*cache));
+    uint32_t block_size = pmm_block_size();
+    uint32_t per_token = n_layer * n_head_kv * head_dim * sizeof(q16_16_t);
+    // Halve the window until both runs fit rather than failing outright.
+    for (;;) {
+        uint32_t blocks = (per_token * capacity + block_size - 1) / block_size;
+        uint32_t k_phys = pmm_alloc_contiguous(blocks);
+        uint32_t v_phys = k_phys ? pmm_alloc_contiguous(blocks) : 0;
+        if (v_phys) {
+            cache->k = (q16_16_t*)k_phys;
+            cache->v = (q16_16_t*)v_phys;
+            cache->region_bytes = blocks * block_size;
+            break;
+        }
+        if (k_phys) {
+            pmm_free_region(k_phys, blocks * block_size);
+        }
+        if (capacity <= AI_KV_MIN_TOKENS) {
+            break;
+        }
+        capacity = capacity / 2 > AI_KV_MIN_TOKENS ? capacity / 2 : AI_KV_MIN_TOKENS;
+    }
+    if (!cache->k) {
+        diag_log(DIAG_ERROR, "ai kv cache alloc failed");
+        return 0;
+    }
+    cache->n_layer = n_layer;
+    cache->n_head_kv = n_head_kv;
+    cache->head_dim = head_dim;
+    cache->capacity = capacity;
+    cache->mode = mode;
+    cache->n_past = 0;
+    return 1;
+}
+
+void ai_kv_cache_destroy(ai_kv_cache_t* cache) {
+    if (!cache || !cache->k) {
+        return;
+    }
+    pmm_free_region((uint32_t)cache->k, cache->region_bytes);
+    pmm_free_region((uint32_t)cache->v, cache->region_bytes);
+    memset(cache, 0, sizeof(*cache));
+}
+
+void ai_kv_cache_reset(ai_kv_cache_t* cache) {
+    if (cache) {
+        cache->n_past = 0;
+    }
+}
+
+int ai_kv_cache_can_append(const ai_kv_cache_t* cache) {
+    if (!cache || !cache->k) {
+        return 0;
+    }
+    return cache->mode == AI_KV_SLIDING || cache->n_past < cache->capacity;
+}
+
+void ai_kv_cache_store(ai_kv_cache_t* cache, uint32_t layer, uint32_t pos,
+                       const q16_16_t* k, const q16_16_t* v) {
+    uint32_t slot = pos % cache->capacity;
+    uint32_t hd = cache->head_dim;
+    for (uint32_t h = 0; h < cache->n_head_kv; ++h) {
+        uint32_t base = ((layer * cache->n_head_kv + h) * cache->capacity + slot) * hd;
+        memcpy(cache->k + base, k + h * hd, hd * sizeof(q16_16_t));
+        memcpy(cache->v + base, v + h * hd, hd * sizeof(q16_16_t));
+    }
+}
+
+// Slots holding attendable history once position `pos` has been stored.
+// Attention is order-independent, so the ring is walked by slot, not by age.
+uint32_t ai_kv_cache_valid(const ai_kv_cache_t* cache, uint32_t pos) {
+    return pos + 1 < cache->capacity ? pos + 1 : cache->capacity;
+}
@@ -0,0 +1,116 @@
+#include "ai/ai_math.h"
+#include "ai/ai_model.h"
+#include "types.h"
+
+#define AI_EXP2_LUT_SIZE (1u << AI_EXP2_LUT_BITS)
+#define AI_EXP2_LUT_MASK (AI_EXP2_LUT_SIZE - 1u)
+#define AI_SIGMOID_LUT_SIZE (AI_SIGMOID_RANGE * AI_SIGMOID_STEPS + 1u)
+// q16.16 bits below one table step (65536 / AI_SIGMOID_STEPS = 2^10).
+#define AI_SIGMOID_SHIFT 10u
+
+// 2^(-2^-k) in 0.32 fixed point, k = 1..16.
+static const uint32_t exp2_neg_frac_q32[16] = {
+    3037000500u, 3611622603u, 3938502376u, 4112874773u,
+    4202935003u, 4248701965u, 4271771996u, 4283353945u,
+    4289156690u, 4292061010u, 4293513907u, 4294240540u,
+    4294603903u, 4294785595u, 4294876445u, 4294921870u
+};
+
+// 2^(-i/256) and 2^(-j/65536) in 1.31 fixed point.
+static uint32_t exp2_hi_q31[AI_EXP2_LUT_SIZE];
+static uint32_t exp2_lo_q31[AI_EXP2_LUT_SIZE];
+// sigmoid(i / AI_SIGMOID_STEPS) in 2.30 fixed point.
+static uint32_t sigmoid_q30[AI_SIGMOID_LUT_SIZE];
+
+uint64_t ai_exp2_neg_q32(uint32_t e_q16) {
+    uint32_t ipart = e_q16 >> 16;
+    if (ipart >= 32) {
+        return 0;
+    }
+    uint64_t r = (uint64_t)1 << 32;
+    for (uint32_t k = 0; k < 16; ++k) {
+        if (e_q16 & (0x8000u >> k)) {
+            r = (r * exp2_neg_frac_q32[k]) >> 32;
+        }
+    }
+    return r >> ipart;
+}
+
+void ai_math_init(void) {
+    for (uint32_t i = 0; i < AI_EXP2_LUT_SIZE; ++i) {
+        exp2_hi_q31[i] = (uint32_t)(ai_exp2_neg_q32(i << AI_EXP2_LUT_BITS) >> 1);
+        exp2_lo_q31[i] = (uint32_t)(ai_exp2_neg_q32(i) >> 1);
+    }
+    for (uint32_t i = 0; i < AI_SIGMOID_LUT_SIZE; ++i) {
+        // sigmoid(x) = 1 / (1 + e^-x), with e^-x taken from the exact path.
+        uint64_t x = (uint64_t)i << AI_SIGMOID_SHIFT;
+        uint64_t e = ai_exp2_neg_q32((uint32_t)((x * AI_LOG2E_Q16) >> 16));
+        sigmoid_q30[i] = (uint32_t)(((uint64_t)1 << 62) / (((uint64_t)1 << 32) + e));
+    }
+}
+
+q16_16_t ai_exp_q16(q16_16_t x) {
+    if (x >= 0) {
+        return q16_from_int(1);
+    }
+    uint32_t e = (uint32_t)((((uint64_t)(0u - (uint32_t)x)) * AI_LOG2E_Q16) >> 16);
+    uint32_t ipart = e >> 16;
+    // 2^-17 and below rounds to zero in q16.16.
+    if (ipart >= 17) {
+        return 0;
+    }
+    uint32_t frac = e & 0xFFFFu;
+    uint64_t p = (uint64_t)exp2_hi_q31[frac >> AI_EXP2_LUT_BITS] * exp2_lo_q31[frac & AI_EXP2_LUT_MASK];
+    // p is 2.62; drop to q16.16 and apply the integer part in one shift.
+    uint32_t shift = 46u + ipart;
+    return (q16_16_t)((p + ((uint64_t)1 << (shift - 1))) >> shift);
+}
+
+q16_16_t ai_silu_q16(q16_16_t x) {
+    uint32_t ax = x >= 0 ? (uint32_t)x : 0u - (uint32_t)x;
+    if (ax >= (AI_SIGMOID_RANGE << 16)) {
+        return x >= 0 ? x : 0;
+    }
+    uint32_t idx = ax >> AI_SIGMOID_SHIFT;
+    uint32_t frac = ax & ((1u << AI_SIGMOID_SHIFT) - 1u);
+    uint32_t s0 = sigmoid_q30[idx];
+    uint32_t s = s0 + (uint32_t)(((uint64_t)(sigmoid_q30[idx + 1] - s0) * frac) >> AI_SIGMOID_SHIFT);
+    // sigmoid(-x) = 1 - sigmoid(x).
+    if (x < 0) {
+        s = (1u << 30) - s;
+    }
+    return (q16_16_t)(((int64_t)x * s + ((int64_t)1 << 29)) >> 30);
+}
+
+void ai_softmax_q16(q16_16_t* data, uint32_t n) {
+    if (!data || n == 0) {
+        return;
+    }
+    q16_16_t max = data[0];
+    for (uint32_t i = 1; i < n; ++i) {
+        if (data[i] > max) {
+            max = data[i];
+        }
+    }
+    // The max maps to 1.0, so sum >= 1.0, inv <= 2^32 and every product
+    // below fits in 48 bits.
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        q16_16_t expv = ai_exp_q16(q16_sub(data[i], max));
+        data[i] = expv;
+        sum += (uint32_t)expv;
+    }
+    uint64_t inv = ((uint64_t)1 << 48) / sum;
+    for (uint32_t i = 0; i < n; ++i) {
+        data[i] = (q16_16_t)(((uint64_t)(uint32_t)data[i] * inv + ((uint64_t)1 << 31)) >> 32);
+    }
+}
+
+void ai_silu_mul_q16(q16_16_t* gate, const q16_16_t* up, uint32_t n) {
+    if (!gate || !up) {
+        return;
+    }
+    for (uint32_t i = 0; i < n; ++i) {
+        gate[i] = q16_mul(ai_silu_q16(gate[i]), up[i]);
+    }
+}
@@ -1,4 +1,12 @@
 #include "ai/ai_model.h"
+#include "ai/ai_arena.h"
+#include "ai/ai_gemm.h"
+#include "ai/ai_math.h"
+#include "ai/ai_quant.h"
+#include "ai/ai_sampler.h"
+#include "ai/ai_tokenizer.h"
+#include "ai/ai_transformer.h"
+#include "arch/x86/multiboot.h"
 #include "debug.h"
 #include "diag.h"
 #include "fixedpoint.h"
@@ -12,89 +20,360 @@
 #include "util.h"
 #include "drivers/vga.h"
 #include "arch/x86/smp_rally.h"
+#include "arch/x86/interrupts.h"
 #include "kernel/sched.h"
+#include "smp.h"
 #include "cpu.h"
 
-#ifndef NO_AI_MODEL
-extern uint8_t _ai_model_start;
-extern uint8_t _ai_model_end;
-#else
-static uint8_t _ai_model_start = 0;
-static uint8_t _ai_model_end = 0;
-#endif
-
+// The GGUF stays where the bootloader put it; ai_model_init reserves the
+// module's frames and maps them at AI_MODEL_VIRT_BASE.
+static const multiboot_info_t* boot_info = 0;
+static uint32_t ai_module_phys = 0;
 static uint8_t* ai_mapped_base = 0;
 static uint32_t ai_mapped_size = 0;
 
+// Tensor table and name index, built once by ai_model_init.
+static ai_tensor_desc_t* tensor_table = 0;
+static uint16_t* tensor_index = 0;
+static uint32_t tensor_index_mask = 0;
+static uint32_t tensor_count = 0;
+static uint64_t tensor_data_start = 0;
+
 // Neural Dispatch Scheduler
-static ai_job_t* job_queue_head = 0;
-static ai_job_t* job_queue_tail = 0;
-static int ai_scheduler_running = 0;
+//
+// Each CPU owns a Chase-Lev deque: the owner pushes and pops at the bottom
+// with interrupts off, other CPUs steal from the top with a CAS on `top`.
+// Idle workers spin briefly, then park in hlt until a submitter sends
+// INT_WAKEUP.
+#define AI_DEQUE_SIZE 64
+#define AI_DEQUE_MASK (AI_DEQUE_SIZE - 1)
+#define AI_SCHED_MAX_CPUS 32u
+#define AI_WORKER_SPIN 4096u
+
+typedef struct {
+    volatile int32_t top;
+    volatile int32_t bottom;
+    ai_job_t* volatile jobs[AI_DEQUE_SIZE];
+} ai_deque_t;
+
+static ai_deque_t ai_deques[AI_SCHED_MAX_CPUS];
+static volatile int ai_scheduler_running = 0;
 static uint32_t ai_worker_count = 0;
-// Spinlock for queue
-static spinlock_t job_queue_lock = 0;
+// CPUs that own a pinned worker thread.
+static uint32_t ai_worker_mask = 0;
+// Workers currently halted and waiting for INT_WAKEUP.
+static volatile uint32_t ai_parked_mask = 0;
+// One low-priority job that only idle workers take. Submitters never run it
+// inline, so it cannot hold up the critical path.
+static ai_job_t* volatile ai_background_job = 0;
+
+static uint32_t ai_irq_save(void) {
+    uint32_t flags;
+    asm volatile("pushfl; popl %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static void ai_irq_restore(uint32_t flags) {
+    if (flags & 0x200) {
+        asm volatile("sti" : : : "memory");
+    }
+}
+
+// Owner side; caller has interrupts off.
+static int ai_deque_push(ai_deque_t* d, ai_job_t* job) {
+    int32_t b = d->bottom;
+    int32_t t = d->top;
+    if (b - t >= AI_DEQUE_SIZE) {
+        return 0;
+    }
+    d->jobs[b & AI_DEQUE_MASK] = job;
+    asm volatile("" : : : "memory");
+    d->bottom = b + 1;
+    return 1;
+}
+
+// Owner side; caller has interrupts off.
+static ai_job_t* ai_deque_pop(ai_deque_t* d) {
+    int32_t b = d->bottom - 1;
+    d->bottom = b;
+    __sync_synchronize();
+    int32_t t = d->top;
+    if (t > b) {
+        d->bottom = b + 1;
+        return 0;
+    }
+    ai_job_t* job = d->jobs[b & AI_DEQUE_MASK];
+    if (t == b) {
+        // Last entry: race the thieves for it.
+        if (!__sync_bool_compare_and_swap(&d->top, t, t + 1)) {
+            job = 0;
+        }
+        d->bottom = b + 1;
+    }
+    return job;
+}
+
+static ai_job_t* ai_deque_steal(ai_deque_t* d) {
+    int32_t t = d->top;
+    __sync_synchronize();
+    int32_t b = d->bottom;
+    if (t >= b) {
+        return 0;
+    }
+    ai_job_t* job = d->jobs[t & AI_DEQUE_MASK];
+    if (!__sync_bool_compare_and_swap(&d->top, t, t + 1)) {
+        return 0;
+    }
+    return job;
+}
+
+static int ai_scheduler_has_work(void) {
+    if (ai_background_job) {
+        return 1;
+    }
+    for (uint32_t i = 0; i < AI_SCHED_MAX_CPUS; ++i) {
+        if (ai_deques[i].bottom - ai_deques[i].top > 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Own deque first (newest chunk, still warm), then steal round-robin.
+static ai_job_t* ai_scheduler_find_work(void) {
+    uint32_t flags = ai_irq_save();
+    uint32_t cpu = cpu_get_id();
+    ai_job_t* job = 0;
+    if (cpu < AI_SCHED_MAX_CPUS) {
+        job = ai_deque_pop(&ai_deques[cpu]);
+    }
+    ai_irq_restore(flags);
+    for (uint32_t i = 1; !job && i <= AI_SCHED_MAX_CPUS; ++i) {
+        ai_deque_t* victim = &ai_deques[(cpu + i) % AI_SCHED_MAX_CPUS];
+        if (victim->bottom - victim->top > 0) {
+            job = ai_deque_steal(victim);
+        }
+    }
+    return job;
+}
+
+static void ai_scheduler_run_job(ai_job_t* job) {
+    if (job->func) {
+        job->func(job->arg);
+    }
+    __sync_synchronize();
+    job->completed = 1;
+}
+
+static void ai_scheduler_kick(void) {
+    __sync_synchronize();
+    uint32_t parked = ai_parked_mask;
+    if (!parked) {
+        return;
+    }
+    uint32_t cpu = 0;
+    while (!(parked & (1u << cpu))) {
+        cpu++;
+    }
+    uint32_t bit = 1u << cpu;
+    if (__sync_fetch_and_and(&ai_parked_mask, ~bit) & bit) {
+        uint32_t flags = ai_irq_save();
+        smp_send_ipi(cpu, 0x4000 | INT_WAKEUP);
+        ai_irq_restore(flags);
+    }
+}
 
 void ai_scheduler_submit(ai_job_t* job) {
     if (!job) return;
     job->completed = 0;
-    job->next = 0;
-    
-    uint32_t flags = spin_lock_irqsave(&job_queue_lock);
-    if (job_queue_tail) {
-        job_queue_tail->next = job;
-        job_queue_tail = job;
-    } else {
-        job_queue_head = job;
-        job_queue_tail = job;
+
+    uint32_t flags = ai_irq_save();
+    uint32_t cpu = cpu_get_id();
+    int queued = cpu < AI_SCHED_MAX_CPUS && ai_deque_push(&ai_deques[cpu], job);
+    ai_irq_restore(flags);
+    if (!queued) {
+        // Deque full (or no slot for this CPU): run it here.
+        ai_scheduler_run_job(job);
+        return;
     }
-    spin_unlock_irqrestore(&job_queue_lock, flags);
+    ai_scheduler_kick();
+}
+
+int ai_scheduler_submit_background(ai_job_t* job) {
+    if (!job || !ai_scheduler_running) {
+        return 0;
+    }
+    // Cleared before publishing: a worker may finish it before the CAS returns.
+    job->completed = 0;
+    if (!__sync_bool_compare_and_swap(&ai_background_job, 0, job)) {
+        job->completed = 1;
+        return 0;
+    }
+    ai_scheduler_kick();
+    return 1;
 }
 
 void ai_scheduler_wait(ai_job_t* job) {
     while (!job->completed) {
-        // If we are waiting, we might as well do some work if available
-        // Simple "help yourself" strategy
-        asm volatile("pause");
+        // Help while waiting: run our own queued chunks or steal others',
+        // so a job nobody picked up (no workers, CPU offline) still runs.
+        ai_job_t* other = ai_scheduler_find_work();
+        if (other) {
+            ai_scheduler_run_job(other);
+        } else {
+            asm volatile("pause");
+        }
+    }
+}
+
+static void ai_worker_park(uint32_t cpu) {
+    uint32_t bit = 1u << cpu;
+    asm volatile("cli" : : : "memory");
+    __sync_fetch_and_or(&ai_parked_mask, bit);
+    if (ai_scheduler_has_work() || !ai_scheduler_running) {
+        __sync_fetch_and_and(&ai_parked_mask, ~bit);
+        asm volatile("sti" : : : "memory");
+        return;
     }
+    // sti's interrupt shadow covers hlt, so a wakeup sent after the check
+    // above still ends the halt.
+    asm volatile("sti; hlt" : : : "memory");
+    __sync_fetch_and_and(&ai_parked_mask, ~bit);
 }
 
-static void __attribute__((unused)) ai_worker_loop(void* arg) {
+static void ai_worker_loop(void* arg) {
     (void)arg;
+    uint32_t idle = 0;
     while (ai_scheduler_running) {
-        ai_job_t* job = 0;
-        
-        uint32_t flags = spin_lock_irqsave(&job_queue_lock);
-        if (job_queue_head) {
-            job = job_queue_head;
-            job_queue_head = job->next;
-            if (!job_queue_head) {
-                job_queue_tail = 0;
+        ai_job_t* job = ai_scheduler_find_work();
+        if (!job) {
+            job = ai_background_job;
+            if (job && !__sync_bool_compare_and_swap(&ai_background_job, job, 0)) {
+                job = 0;
             }
         }
-        spin_unlock_irqrestore(&job_queue_lock, flags);
-        
         if (job) {
-            if (job->func) {
-                job->func(job->arg);
-            }
-            job->completed = 1;
-        } else {
+            ai_scheduler_run_job(job);
+            idle = 0;
+        } else if (++idle < AI_WORKER_SPIN) {
             asm volatile("pause");
+        } else {
+            uint32_t cpu = cpu_get_id();
+            if (cpu < AI_SCHED_MAX_CPUS) {
+                ai_worker_park(cpu);
+            }
+            idle = 0;
         }
     }
 }
 
+static void ai_worker_entry(void) {
+    ai_worker_loop(0);
+    for (;;) {
+        asm volatile("hlt");
+    }
+}
+
 void ai_scheduler_init(uint32_t n_workers) {
-    ai_scheduler_running = 1;
-    ai_worker_count = n_workers;
+    if (ai_scheduler_running) {
+        return;
+    }
+    uint32_t online = smp_get_online_mask();
+    uint32_t self = cpu_get_id();
+    if (n_workers == 0 || n_workers > AI_SCHED_MAX_LANES - 1) {
+        n_workers = AI_SCHED_MAX_LANES - 1;
+    }
     vga_set_color(0x0A);
     diag_log(DIAG_INFO, "AI Neural Scheduler: Initializing workers...");
-    
-    // In a real implementation, we would spawn kernel threads here
-    // For now, we assume this is called during SMP init
-    // for (uint32_t i = 0; i < n_workers; ++i) {
-    //     thread_create(ai_worker_loop, 0);
-    // }
+
+    // Running must be visible before the first worker polls it.
+    ai_scheduler_running = 1;
+    for (uint32_t cpu = 0; cpu < AI_SCHED_MAX_CPUS && ai_worker_count < n_workers; ++cpu) {
+        if (cpu == self || !(online & (1u << cpu))) {
+            continue;
+        }
+        process_t* proc = process_create(ai_worker_entry, 0);
+        if (!proc) {
+            break;
+        }
+        scheduler_set_affinity(proc->pid, 1u << cpu);
+        ai_worker_mask |= 1u << cpu;
+        ai_worker_count++;
+    }
+    if (ai_worker_count == 0) {
+        ai_scheduler_running = 0;
+        diag_log(DIAG_INFO, "AI Neural Scheduler: no APs online, running inline");
+        return;
+    }
+    diag_log_hex32(DIAG_INFO, "AI Neural Scheduler: workers", ai_worker_count);
+}
+
+uint32_t ai_scheduler_lanes(void) {
+    if (!ai_scheduler_running) {
+        return 1;
+    }
+    uint32_t live = smp_get_online_mask() & ai_worker_mask;
+    uint32_t lanes = 1;
+    while (live) {
+        live &= live - 1;
+        lanes++;
+    }
+    return lanes > AI_SCHED_MAX_LANES ? AI_SCHED_MAX_LANES : lanes;
+}
+
+typedef struct {
+    ai_rows_fn fn;
+    void* ctx;
+    uint32_t start;
+    uint32_t end;
+} ai_rows_task_t;
+
+static void ai_rows_worker(void* arg) {
+    ai_rows_task_t* task = (ai_rows_task_t*)arg;
+    task->fn(task->ctx, task->start, task->end);
+}
+
+uint32_t ai_scheduler_run_rows(uint32_t rows, uint32_t min_rows, ai_rows_fn fn, void* ctx) {
+    if (!fn || rows == 0) {
+        return 0;
+    }
+    if (min_rows == 0) {
+        min_rows = 1;
+    }
+    uint32_t lanes = ai_scheduler_lanes();
+    if (lanes > rows / min_rows) {
+        lanes = rows / min_rows;
+    }
+    if (lanes <= 1) {
+        fn(ctx, 0, rows);
+        return 1;
+    }
+
+    ai_job_t jobs[AI_SCHED_MAX_LANES];
+    ai_rows_task_t tasks[AI_SCHED_MAX_LANES];
+    uint32_t per = rows / lanes;
+    uint32_t extra = rows % lanes;
+    uint32_t start = 0;
+    for (uint32_t i = 0; i < lanes; ++i) {
+        uint32_t end = start + per + (i < extra ? 1u : 0u);
+        tasks[i].fn = fn;
+        tasks[i].ctx = ctx;
+        tasks[i].start = start;
+        tasks[i].end = end;
+        start = end;
+        if (i > 0) {
+            jobs[i].func = ai_rows_worker;
+            jobs[i].arg = &tasks[i];
+            jobs[i].priority = 0;
+            ai_scheduler_submit(&jobs[i]);
+        }
+    }
+    // The caller takes the first block rather than idling.
+    ai_rows_worker(&tasks[0]);
+    for (uint32_t i = 1; i < lanes; ++i) {
+        ai_scheduler_wait(&jobs[i]);
+    }
+    return lanes;
 }
 
 // Moved matmul_worker to after ai_dot_q16_simd
@@ -104,7 +383,7 @@ static uint32_t token_count = 0;
 static uint32_t token_head = 0;
 static int simd_enabled = 0;
 static q16_16_t ai_temp = 1 << 16;
-static uint32_t kv_cache_tokens = 0;
+static ai_sampler_t top_p_sampler;
 
 static void vga_put(char ch) {
     vga_putc(ch);
@@ -165,6 +444,115 @@ int ai_model_read_header(gguf_header_t* out) {
     return gguf_read_header(ai_mapped_base, out);
 }
 
+int ai_model_kv_find(const char* key, uint32_t* type, gguf_reader_t* value) {
+    if (!key || !type || !value || !ai_mapped_base) {
+        return 0;
+    }
+    gguf_header_t header;
+    if (!gguf_read_header(ai_mapped_base, &header)) {
+        return 0;
+    }
+    gguf_reader_t r;
+    if (!gguf_reader_init(&r, (const uint8_t*)ai_mapped_base, ai_mapped_size)) {
+        return 0;
+    }
+    if (!gguf_reader_seek(&r, sizeof(gguf_header_t))) {
+        return 0;
+    }
+    uint32_t key_len = strlen(key);
+    for (uint64_t i = 0; i < header.kv_count; ++i) {
+        const uint8_t* name;
+        uint64_t name_len;
+        uint32_t t;
+        if (!gguf_read_string(&r, &name, &name_len)) {
+            return 0;
+        }
+        if (!gguf_read_u32(&r, &t)) {
+            return 0;
+        }
+        if (name_len == key_len && memcmp(name, key, key_len) == 0) {
+            *type = t;
+            *value = r;
+            return 1;
+        }
+        if (!gguf_skip_value(&r, t)) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+int ai_model_kv_u32(const char* key, uint32_t* out) {
+    uint32_t type;
+    gguf_reader_t r;
+    if (!out || !ai_model_kv_find(key, &type, &r)) {
+        return 0;
+    }
+    const uint8_t* ptr = r.base + r.offset;
+    uint32_t size = gguf_type_size(type);
+    if (size == 0 || r.offset + size > r.size) {
+        return 0;
+    }
+    switch (type) {
+        case GGUF_TYPE_UINT8:
+        case GGUF_TYPE_BOOL:
+            *out = ptr[0];
+            return 1;
+        case GGUF_TYPE_INT8:
+            *out = (uint32_t)(int32_t)(int8_t)ptr[0];
+            return 1;
+        case GGUF_TYPE_UINT16:
+            *out = *(const uint16_t*)ptr;
+            return 1;
+        case GGUF_TYPE_INT16:
+            *out = (uint32_t)(int32_t)*(const int16_t*)ptr;
+            return 1;
+        case GGUF_TYPE_UINT32:
+        case GGUF_TYPE_INT32:
+        case GGUF_TYPE_UINT64:
+        case GGUF_TYPE_INT64:
+            *out = *(const uint32_t*)ptr;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+int ai_model_kv_f32_bits(const char* key, uint32_t* out) {
+    uint32_t type;
+    gguf_reader_t r;
+    if (!out || !ai_model_kv_find(key, &type, &r)) {
+        return 0;
+    }
+    if (type != GGUF_TYPE_FLOAT32) {
+        return 0;
+    }
+    return gguf_read_u32(&r, out);
+}
+
+int ai_model_kv_string(const char* key, const uint8_t** str, uint64_t* len) {
+    uint32_t type;
+    gguf_reader_t r;
+    if (!str || !len || !ai_model_kv_find(key, &type, &r)) {
+        return 0;
+    }
+    if (type != GGUF_TYPE_STRING) {
+        return 0;
+    }
+    return gguf_read_string(&r, str, len);
+}
+
+int ai_model_kv_array(const char* key, uint32_t* elem_type, uint64_t* count, gguf_reader_t* items) {
+    uint32_t type;
+    if (!elem_type || !count || !items || !ai_model_kv_find(key, &type, items)) {
+        return 0;
+    }
+    if (type != GGUF_TYPE_ARRAY) {
+        return 0;
+    }
+    return gguf_read_u32(items, elem_type) && gguf_read_u64(items, count);
+}
+
 static uint32_t ggml_type_size(uint32_t type) {
     switch (type) {
         case GGML_TYPE_F32:
@@ -238,32 +626,36 @@ int ai_quant_info(uint32_t type, ai_quant_info_t* out) {
     switch (type) {
         case GGML_TYPE_Q4_0:
             out->block_elems = 32;
-            out->block_bytes = 20;
+            out->block_bytes = 18;
             return 1;
         case GGML_TYPE_Q4_1:
             out->block_elems = 32;
-            out->block_bytes = 24;
+            out->block_bytes = 20;
             return 1;
         case GGML_TYPE_Q5_0:
             out->block_elems = 32;
-            out->block_bytes = 24;
+            out->block_bytes = 22;
             return 1;
         case GGML_TYPE_Q5_1:
             out->block_elems = 32;
-            out->block_bytes = 28;
+            out->block_bytes = 24;
             return 1;
         case GGML_TYPE_Q8_0:
             out->block_elems = 32;
-            out->block_bytes = 36;
+            out->block_bytes = 34;
             return 1;
         case GGML_TYPE_Q8_1:
             out->block_elems = 32;
-            out->block_bytes = 40;
+            out->block_bytes = 36;
             return 1;
         case GGML_TYPE_Q4_K:
             out->block_elems = 256;
             out->block_bytes = 144;
             return 1;
+        case GGML_TYPE_Q6_K:
+            out->block_elems = 256;
+            out->block_bytes = 210;
+            return 1;
         default:
             out->block_elems = 0;
             out->block_bytes = 0;
@@ -293,34 +685,29 @@ static q16_16_t q16_from_f32_bits(uint32_t bits) {
     return (q16_16_t)value;
 }
 
-static q16_16_t q16_from_f16_bits(uint16_t bits) {
+// Block scales are kept in 32.32 so tiny f16 deltas survive until the final product.
+static int64_t q32_from_f16_bits(uint16_t bits) {
     uint32_t sign = (bits >> 15) & 1u;
     int32_t exp = (int32_t)((bits >> 10) & 0x1F);
     uint32_t frac = bits & 0x3FF;
-    if (exp == 0) {
+    int64_t value;
+    if (exp == 31) {
         return 0;
     }
-    exp -= 15;
-    uint32_t mant = frac | 0x400;
-    int32_t shift = exp - 9;
-    int64_t value;
-    if (shift >= 0) {
-        value = (int64_t)mant << shift;
+    if (exp == 0) {
+        value = (int64_t)frac << 8;
     } else {
-        value = (int64_t)mant >> (-shift);
-    }
-    if (sign) {
-        value = -value;
+        value = (int64_t)(frac | 0x400) << (exp + 7);
     }
-    return (q16_16_t)value;
+    return sign ? -value : value;
 }
 
-static uint32_t read_bits_6(const uint8_t* data, uint32_t index) {
-    uint32_t bit = index * 6;
-    uint32_t byte = bit >> 3;
-    uint32_t shift = bit & 7;
-    uint32_t v = (uint32_t)data[byte] | ((uint32_t)data[byte + 1] << 8) | ((uint32_t)data[byte + 2] << 16);
-    return (v >> shift) & 0x3F;
+static q16_16_t q16_from_f16_bits(uint16_t bits) {
+    return (q16_16_t)(q32_from_f16_bits(bits) >> 16);
+}
+
+static q16_16_t q16_scaled(int64_t scale_q32, int32_t q) {
+    return (q16_16_t)((scale_q32 * q) >> 16);
 }
 
 static int gguf_read_tensor_desc(gguf_reader_t* r, ai_tensor_desc_t* out, uint64_t* elem_count) {
@@ -371,12 +758,43 @@ static int gguf_read_tensor_desc(gguf_reader_t* r, ai_tensor_desc_t* out, uint64
     return 1;
 }
 
-int ai_tensor_data_start(uint64_t* out) {
-    if (!out || !ai_mapped_base) {
-        return 0;
+// Tensor data begins at the next general.alignment boundary after the descriptors.
+static uint64_t ai_tensor_align_offset(uint64_t offset) {
+    uint32_t align = 32;
+    if (!ai_model_kv_u32("general.alignment", &align) || align == 0) {
+        align = 32;
     }
+    return (offset + align - 1) / align * align;
+}
+
+static uint32_t tensor_name_hash(const char* name) {
+    uint32_t h = 2166136261u;
+    while (*name) {
+        h ^= (uint8_t)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint64_t tensor_data_bytes(uint32_t type, uint64_t elem_count) {
+    uint32_t type_size = ggml_type_size(type);
+    if (type_size) {
+        return elem_count * (uint64_t)type_size;
+    }
+    ai_quant_info_t info;
+    if (ai_quant_info(type, &info) && info.block_elems) {
+        uint64_t blocks = (elem_count + info.block_elems - 1) / info.block_elems;
+        return blocks * info.block_bytes;
+    }
+    return 0;
+}
+
+// Walks the GGUF metadata once and keeps every descriptor, resolved to a mapped
+// address, plus an open-addressed name index (slot value is tensor index + 1).
+static int ai_tensor_index_build(void) {
+    tensor_count = 0;
     gguf_header_t header;
-    if (!gguf_read_header(ai_mapped_base, &header)) {
+    if (!gguf_read_header(ai_mapped_base, &header) || header.tensor_count > 0xFFFFu) {
         return 0;
     }
     gguf_reader_t r;
@@ -389,74 +807,87 @@ int ai_tensor_data_start(uint64_t* out) {
     if (!gguf_skip_kv_pairs(&r, header.kv_count)) {
         return 0;
     }
-    for (uint64_t i = 0; i < header.tensor_count; ++i) {
-        if (!gguf_read_tensor_desc(&r, 0, 0)) {
+    uint32_t count = (uint32_t)header.tensor_count;
+    uint32_t slots = 16;
+    while (slots < count * 2) {
+        slots <<= 1;
+    }
+    ai_tensor_desc_t* table = (ai_tensor_desc_t*)ai_arena_alloc(count ? count * sizeof(ai_tensor_desc_t) : 1, 16);
+    uint16_t* index = (uint16_t*)ai_arena_alloc(slots * sizeof(uint16_t), 16);
+    uint64_t* elems = (uint64_t*)ai_arena_alloc(count ? count * sizeof(uint64_t) : 1, 16);
+    if (!table || !index || !elems) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        if (!gguf_read_tensor_desc(&r, &table[i], &elems[i])) {
             return 0;
         }
     }
-    *out = (uint64_t)(uint32_t)ai_mapped_base + r.offset;
+    uint64_t data_start = ai_tensor_align_offset(r.offset);
+    for (uint32_t i = 0; i < count; ++i) {
+        ai_tensor_desc_t* desc = &table[i];
+        desc->data_bytes = tensor_data_bytes(desc->type, elems[i]);
+        uint64_t offset_bytes = data_start + desc->offset;
+        if (offset_bytes + desc->data_bytes > ai_mapped_size) {
+            diag_log(DIAG_ERROR, "tensor bounds invalid");
+            return 0;
+        }
+        desc->data_offset = (uint64_t)(uint32_t)ai_mapped_base + offset_bytes;
+        uint32_t slot = tensor_name_hash(desc->name) & (slots - 1);
+        while (index[slot]) {
+            slot = (slot + 1) & (slots - 1);
+        }
+        index[slot] = (uint16_t)(i + 1);
+    }
+    tensor_table = table;
+    tensor_index = index;
+    tensor_index_mask = slots - 1;
+    tensor_data_start = (uint64_t)(uint32_t)ai_mapped_base + data_start;
+    tensor_count = count;
     return 1;
 }
 
-int ai_tensor_get(uint32_t index, ai_tensor_desc_t* out) {
-    if (!out || !ai_mapped_base) {
-        return 0;
-    }
-    gguf_header_t header;
-    if (!gguf_read_header(ai_mapped_base, &header)) {
-        return 0;
-    }
-    if (index >= header.tensor_count) {
-        return 0;
-    }
-    gguf_reader_t r;
-    if (!gguf_reader_init(&r, (const uint8_t*)ai_mapped_base, ai_mapped_size)) {
-        return 0;
-    }
-    if (!gguf_reader_seek(&r, sizeof(gguf_header_t))) {
+int ai_tensor_data_start(uint64_t* out) {
+    if (!out || !tensor_table) {
         return 0;
     }
-    if (!gguf_skip_kv_pairs(&r, header.kv_count)) {
+    *out = tensor_data_start;
+    return 1;
+}
+
+uint32_t ai_tensor_count(void) {
+    return tensor_count;
+}
+
+int ai_tensor_get(uint32_t index, ai_tensor_desc_t* out) {
+    if (!out || index >= tensor_count) {
         return 0;
     }
-    uint64_t elem_count = 0;
-    ai_tensor_desc_t temp;
-    int found = 0;
-    for (uint64_t i = 0; i < header.tensor_count; ++i) {
-        ai_tensor_desc_t desc;
-        uint64_t count = 0;
-        if (!gguf_read_tensor_desc(&r, &desc, &count)) {
-            return 0;
-        }
-        if (i == index) {
-            temp = desc;
-            elem_count = count;
-            found = 1;
-        }
-    }
-    if (!found) {
+    *out = tensor_table[index];
+    return 1;
+}
+
+const ai_tensor_desc_t* ai_tensor_lookup(const char* name) {
+    if (!name || tensor_count == 0) {
         return 0;
     }
-    uint64_t data_start = r.offset;
-    uint32_t type_size = ggml_type_size(temp.type);
-    if (type_size) {
-        temp.data_bytes = elem_count * (uint64_t)type_size;
-    } else {
-        ai_quant_info_t info;
-        if (ai_quant_info(temp.type, &info) && info.block_elems) {
-            uint64_t blocks = (elem_count + info.block_elems - 1) / info.block_elems;
-            temp.data_bytes = blocks * info.block_bytes;
-        } else {
-            temp.data_bytes = 0;
+    uint32_t slot = tensor_name_hash(name) & tensor_index_mask;
+    while (tensor_index[slot]) {
+        const ai_tensor_desc_t* desc = &tensor_table[tensor_index[slot] - 1];
+        if (strcmp(desc->name, name) == 0) {
+            return desc;
         }
+        slot = (slot + 1) & tensor_index_mask;
     }
-    uint64_t offset_bytes = data_start + temp.offset;
-    if (offset_bytes + temp.data_bytes > ai_mapped_size) {
-        diag_log(DIAG_ERROR, "tensor bounds invalid");
+    return 0;
+}
+
+int ai_tensor_find(const char* name, ai_tensor_desc_t* out) {
+    const ai_tensor_desc_t* desc = ai_tensor_lookup(name);
+    if (!desc || !out) {
         return 0;
     }
-    temp.data_offset = (uint64_t)(uint32_t)ai_mapped_base + offset_bytes;
-    *out = temp;
+    *out = *desc;
     return 1;
 }
 
@@ -474,118 +905,110 @@ uint32_t ai_quant_read_q16(uint32_t type, const uint8_t* src, q16_16_t* dst, uin
         dst[0] = q16_from_f32_bits(f);
         return 1;
     }
+    // 32-element blocks store element j in the low nibble and j + 16 in the high nibble.
     if (type == GGML_TYPE_Q8_0) {
-        q16_16_t scale = q16_from_f32_bits(*(const uint32_t*)src);
+        int64_t d = q32_from_f16_bits(*(const uint16_t*)src);
+        const int8_t* qs = (const int8_t*)(src + 2);
+        uint32_t count = max < 32 ? max : 32;
+        for (uint32_t i = 0; i < count; ++i) {
+            dst[i] = q16_scaled(d, qs[i]);
+        }
+        return count;
+    }
+    if (type == GGML_TYPE_Q8_1) {
+        int64_t d = q32_from_f16_bits(*(const uint16_t*)src);
         const int8_t* qs = (const int8_t*)(src + 4);
         uint32_t count = max < 32 ? max : 32;
         for (uint32_t i = 0; i < count; ++i) {
-            dst[i] = q16_mul(scale, q16_from_int(qs[i]));
+            dst[i] = q16_scaled(d, qs[i]);
         }
         return count;
     }
     if (type == GGML_TYPE_Q4_0) {
-        q16_16_t scale = q16_from_f32_bits(*(const uint32_t*)src);
-        const uint8_t* qs = src + 4;
+        int64_t d = q32_from_f16_bits(*(const uint16_t*)src);
+        const uint8_t* qs = src + 2;
         uint32_t count = max < 32 ? max : 32;
-        for (uint32_t i = 0; i < count / 2; ++i) {
-            uint8_t byte = qs[i];
-            int32_t lo = (int32_t)(byte & 0x0F) - 8;
-            int32_t hi = (int32_t)(byte >> 4) - 8;
-            uint32_t idx = i * 2;
-            if (idx < count) {
-                dst[idx] = q16_mul(scale, q16_from_int(lo));
-            }
-            if (idx + 1 < count) {
-                dst[idx + 1] = q16_mul(scale, q16_from_int(hi));
-            }
+        for (uint32_t i = 0; i < count; ++i) {
+            uint8_t byte = qs[i & 15u];
+            int32_t q = (int32_t)(i < 16 ? (byte & 0x0F) : (byte >> 4)) - 8;
+            dst[i] = q16_scaled(d, q);
         }
         return count;
     }
     if (type == GGML_TYPE_Q4_1) {
-        q16_16_t scale = q16_from_f16_bits(*(const uint16_t*)src);
+        int64_t d = q32_from_f16_bits(*(const uint16_t*)src);
         q16_16_t min = q16_from_f16_bits(*(const uint16_t*)(src + 2));
         const uint8_t* qs = src + 4;
         uint32_t count = max < 32 ? max : 32;
-        for (uint32_t i = 0; i < count / 2; ++i) {
-            uint8_t byte = qs[i];
-            int32_t lo = (int32_t)(byte & 0x0F);
-            int32_t hi = (int32_t)(byte >> 4);
-            uint32_t idx = i * 2;
-            if (idx < count) {
-                dst[idx] = q16_add(q16_mul(scale, q16_from_int(lo)), min);
-            }
-            if (idx + 1 < count) {
-                dst[idx + 1] = q16_add(q16_mul(scale, q16_from_int(hi)), min);
-            }
+        for (uint32_t i = 0; i < count; ++i) {
+            uint8_t byte = qs[i & 15u];
+            int32_t q = (int32_t)(i < 16 ? (byte & 0x0F) : (byte >> 4));
+            dst[i] = q16_add(q16_scaled(d, q), min);
         }
         return count;
     }
     if (type == GGML_TYPE_Q5_0) {
-        q16_16_t scale = q16_from_f16_bits(*(const uint16_t*)src);
-        const uint8_t* qh = src + 2;
+        int64_t d = q32_from_f16_bits(*(const uint16_t*)src);
+        uint32_t qh = *(const uint32_t*)(src + 2);
         const uint8_t* qs = src + 6;
         uint32_t count = max < 32 ? max : 32;
         for (uint32_t i = 0; i < count; ++i) {
-            uint8_t low = (i & 1u) ? (qs[i >> 1] >> 4) : (qs[i >> 1] & 0x0F);
-            uint8_t high = (qh[i >> 3] >> (i & 7u)) & 1u;
-            int32_t q = (int32_t)(low | (high << 4)) - 16;
-            dst[i] = q16_mul(scale, q16_from_int(q));
+            uint8_t byte = qs[i & 15u];
+            uint32_t low = i < 16 ? (byte & 0x0Fu) : (byte >> 4);
+            uint32_t high = (qh >> i) & 1u;
+            dst[i] = q16_scaled(d, (int32_t)(low | (high << 4)) - 16);
         }
         return count;
     }
     if (type == GGML_TYPE_Q5_1) {
-        q16_16_t scale = q16_from_f16_bits(*(const uint16_t*)src);
+        int64_t d = q32_from_f16_bits(*(const uint16_t*)src);
         q16_16_t min = q16_from_f16_bits(*(const uint16_t*)(src + 2));
-        const uint8_t* qh = src + 4;
+        uint32_t qh = *(const uint32_t*)(src + 4);
         const uint8_t* qs = src + 8;
         uint32_t count = max < 32 ? max : 32;
         for (uint32_t i = 0; i < count; ++i) {
-            uint8_t low = (i & 1u) ? (qs[i >> 1] >> 4) : (qs[i >> 1] & 0x0F);
-            uint8_t high = (qh[i >> 3] >> (i & 7u)) & 1u;
-            uint32_t q = (uint32_t)(low | (high << 4));
-            dst[i] = q16_add(q16_mul(scale, q16_from_int((int32_t)q)), min);
+            uint8_t byte = qs[i & 15u];
+            uint32_t low = i < 16 ? (byte & 0x0Fu) : (byte >> 4);
+            uint32_t high = (qh >> i) & 1u;
+            dst[i] = q16_add(q16_scaled(d, (int32_t)(low | (high << 4))), min);
         }
         return count;
     }
+    // Q4_K: 8 sub-blocks of 32 with 6-bit scales/mins; each 32-byte run holds two sub-blocks.
     if (type == GGML_TYPE_Q4_K) {
-        uint16_t d_bits = *(const uint16_t*)src;
-        uint16_t m_bits = *(const uint16_t*)(src + 2);
-        q16_16_t d = q16_from_f16_bits(d_bits);
-        q16_16_t m = q16_from_f16_bits(m_bits);
+        int64_t d = q32_from_f16_bits(*(const uint16_t*)src);
+        int64_t dmin = q32_from_f16_bits(*(const uint16_t*)(src + 2));
         const uint8_t* scales = src + 4;
         const uint8_t* qs = src + 16;
         uint32_t count = max < 256 ? max : 256;
-        uint32_t out_idx = 0;
-        uint8_t sub_scale[8];
-        uint8_t sub_min[8];
-        for (uint32_t i = 0; i < 8; ++i) {
-            sub_scale[i] = (uint8_t)read_bits_6(scales, i);
-        }
-        for (uint32_t i = 0; i < 8; ++i) {
-            sub_min[i] = (uint8_t)read_bits_6(scales, i + 8);
-        }
-        uint32_t q_idx = 0;
-        for (uint32_t sb = 0; sb < 8 && out_idx < count; ++sb) {
-            q16_16_t sb_scale = q16_mul(d, q16_from_int((int32_t)sub_scale[sb]));
-            q16_16_t sb_min = q16_mul(m, q16_from_int((int32_t)sub_min[sb]));
-            for (uint32_t i = 0; i < 16 && out_idx < count; ++i) {
-                uint8_t byte = qs[q_idx++];
-                int32_t lo = (int32_t)(byte & 0x0F);
-                int32_t hi = (int32_t)(byte >> 4);
-                dst[out_idx++] = q16_add(q16_mul(sb_scale, q16_from_int(lo)), sb_min);
-                if (out_idx < count) {
-                    dst[out_idx++] = q16_add(q16_mul(sb_scale, q16_from_int(hi)), sb_min);
-                }
-            }
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t sub = i >> 5;
+            uint32_t sc;
+            uint32_t m;
+            ai_q4k_scale_min(scales, sub, &sc, &m);
+            uint8_t byte = qs[((sub >> 1) << 5) + (i & 31u)];
+            int32_t q = (int32_t)((sub & 1u) ? (byte >> 4) : (byte & 0x0F));
+            dst[i] = (q16_16_t)((d * (int64_t)sc * q - dmin * (int64_t)m) >> 16);
         }
         return count;
     }
-    if (type == GGML_TYPE_Q8_1) {
-        q16_16_t scale = q16_from_f16_bits(*(const uint16_t*)src);
-        const int8_t* qs = (const int8_t*)(src + 4);
-        uint32_t count = max < 32 ? max : 32;
+    // Q6_K: 4-bit low plane + 2-bit high plane, 16 signed 8-bit scales, f16 delta at the end.
+    if (type == GGML_TYPE_Q6_K) {
+        const uint8_t* ql = src;
+        const uint8_t* qh = src + 128;
+        const int8_t* sc = (const int8_t*)(src + 192);
+        int64_t d = q32_from_f16_bits(*(const uint16_t*)(src + 208));
+        uint32_t count = max < 256 ? max : 256;
         for (uint32_t i = 0; i < count; ++i) {
-            dst[i] = q16_mul(scale, q16_from_int(qs[i]));
+            uint32_t half = i >> 7;
+            uint32_t quarter = (i >> 5) & 3u;
+            uint32_t l = i & 31u;
+            uint8_t low = ql[half * 64 + l + ((quarter & 1u) ? 32 : 0)];
+            uint32_t lo = (quarter & 2u) ? (low >> 4) : (low & 0x0Fu);
+            uint32_t hi = (qh[half * 32 + l] >> (quarter * 2)) & 3u;
+            int32_t q = (int32_t)(lo | (hi << 4)) - 32;
+            int32_t scale = sc[half * 8 + (l >> 4) + quarter * 2];
+            dst[i] = q16_scaled(d * scale, q);
         }
         return count;
     }
@@ -596,6 +1019,42 @@ void ai_set_simd_enabled(int enabled) {
     simd_enabled = enabled ? 1 : 0;
 }
 
+// Four q16 products (a[i] * b[i]) >> 16 from unaligned, contiguous inputs.
+static inline void ai_mul4_q16_simd(const q16_16_t* a, const q16_16_t* b, int32_t* out) {
+    asm volatile(
+        "movdqu (%1), %%xmm0\n"    // a0, a1, a2, a3
+        "movdqu (%2), %%xmm1\n"    // b0, b1, b2, b3
+        
+        // First pair (indices 0 and 2)
+        "movdqa %%xmm0, %%xmm2\n"
+        "pmuldq %%xmm1, %%xmm2\n"  // xmm2 = [a2*b2 (64), a0*b0 (64)]
+        "psrlq $16, %%xmm2\n"      // shift each 64-bit result
+        
+        // Second pair (indices 1 and 3)
+        "pshufd $0xF5, %%xmm0, %%xmm0\n" // [a3, a3, a1, a1]
+        "pshufd $0xF5, %%xmm1, %%xmm1\n" // [b3, b3, b1, b1]
+        "pmuldq %%xmm1, %%xmm0\n"  // xmm0 = [a3*b3 (64), a1*b1 (64)]
+        "psrlq $16, %%xmm0\n"
+        
+        // Extract low 32 bits of results into out
+        "movd %%xmm2, %%eax\n"
+        "movl %%eax, (%0)\n"       // out[0] = a0*b0 >> 16
+        "pshufd $0xEE, %%xmm2, %%xmm2\n"
+        "movd %%xmm2, %%eax\n"
+        "movl %%eax, 4(%0)\n"      // out[1] = a2*b2 >> 16
+        "movd %%xmm0, %%eax\n"
+        "movl %%eax, 8(%0)\n"      // out[2] = a1*b1 >> 16
+        "pshufd $0xEE, %%xmm0, %%xmm0\n"
+        "movd %%xmm0, %%eax\n"
+        "movl %%eax, 12(%0)\n"     // out[3] = a3*b3 >> 16
+        :
+        : "r"(out), "r"(a), "r"(b)
+        : "xmm0", "xmm1", "xmm2", "memory", "eax"
+    );
+}
+
+// Column `col` of a row-major k x n B has stride n, so it is gathered
+// four elements at a time. Prefer the packed path below.
 static q16_16_t ai_dot_q16_simd(const q16_16_t* a, const q16_16_t* b, uint32_t n, uint32_t k, uint32_t col) {
     q16_16_t sum = 0;
     uint32_t p = 0;
@@ -606,36 +1065,7 @@ static q16_16_t ai_dot_q16_simd(const q16_16_t* a, const q16_16_t* b, uint32_t n
         bpack[1] = b[(p + 1) * n + col];
         bpack[2] = b[(p + 2) * n + col];
         bpack[3] = b[(p + 3) * n + col];
-        asm volatile(
-            "movdqu (%1), %%xmm0\n"    // a0, a1, a2, a3
-            "movdqu (%2), %%xmm1\n"    // b0, b1, b2, b3
-            
-            // First pair (indices 0 and 2)
-            "movdqa %%xmm0, %%xmm2\n"
-            "pmuldq %%xmm1, %%xmm2\n"  // xmm2 = [a2*b2 (64), a0*b0 (64)]
-            "psrlq $16, %%xmm2\n"      // shift each 64-bit result
-            
-            // Second pair (indices 1 and 3)
-            "pshufd $0xF5, %%xmm0, %%xmm0\n" // [a3, a3, a1, a1]
-            "pshufd $0xF5, %%xmm1, %%xmm1\n" // [b3, b3, b1, b1]
-            "pmuldq %%xmm1, %%xmm0\n"  // xmm0 = [a3*b3 (64), a1*b1 (64)]
-            "psrlq $16, %%xmm0\n"
-            
-            // Extract low 32 bits of results into temp
-            "movd %%xmm2, %%eax\n"
-            "movl %%eax, (%0)\n"       // temp[0] = a0*b0 >> 16
-            "pshufd $0xEE, %%xmm2, %%xmm2\n"
-            "movd %%xmm2, %%eax\n"
-            "movl %%eax, 4(%0)\n"      // temp[1] = a2*b2 >> 16
-            "movd %%xmm0, %%eax\n"
-            "movl %%eax, 8(%0)\n"      // temp[2] = a1*b1 >> 16
-            "pshufd $0xEE, %%xmm0, %%xmm0\n"
-            "movd %%xmm0, %%eax\n"
-            "movl %%eax, 12(%0)\n"     // temp[3] = a3*b3 >> 16
-            :
-            : "r"(temp), "r"(a + p), "r"(bpack)
-            : "xmm0", "xmm1", "xmm2", "memory", "eax"
-        );
+        ai_mul4_q16_simd(a + p, bpack, temp);
         sum = q16_add(sum, (q16_16_t)temp[0]);
         sum = q16_add(sum, (q16_16_t)temp[1]);
         sum = q16_add(sum, (q16_16_t)temp[2]);
@@ -647,64 +1077,119 @@ static q16_16_t ai_dot_q16_simd(const q16_16_t* a, const q16_16_t* b, uint32_t n
     return sum;
 }
 
+// Packs columns [col0, col1) of a row-major k x n B into bt[col - col0][k].
+static void pack_b_cols(const q16_16_t* b, q16_16_t* bt, uint32_t n, uint32_t k,
+                        uint32_t col0, uint32_t col1) {
+    // Walk B in 8x8 tiles so both sides stay within a few cache lines.
+    for (uint32_t p0 = 0; p0 < k; p0 += 8) {
+        uint32_t p1 = p0 + 8 < k ? p0 + 8 : k;
+        for (uint32_t j0 = col0; j0 < col1; j0 += 8) {
+            uint32_t j1 = j0 + 8 < col1 ? j0 + 8 : col1;
+            for (uint32_t p = p0; p < p1; ++p) {
+                for (uint32_t j = j0; j < j1; ++j) {
+                    bt[(j - col0) * k + p] = b[p * n + j];
+                }
+            }
+        }
+    }
+}
+
+// Both operands unit-stride: streams whole cache lines. Each product is
+// truncated like q16_mul, so results match the scalar loop bit for bit.
+static q16_16_t ai_dot_q16_simd_unit(const q16_16_t* a, const q16_16_t* b, uint32_t k) {
+    q16_16_t sum = 0;
+    uint32_t p = 0;
+    int32_t temp[4];
+    for (; p + 4 <= k; p += 4) {
+        ai_mul4_q16_simd(a + p, b + p, temp);
+        sum = q16_add(sum, (q16_16_t)temp[0]);
+        sum = q16_add(sum, (q16_16_t)temp[1]);
+        sum = q16_add(sum, (q16_16_t)temp[2]);
+        sum = q16_add(sum, (q16_16_t)temp[3]);
+    }
+    for (; p < k; ++p) {
+        sum = q16_add(sum, q16_mul(a[p], b[p]));
+    }
+    return sum;
+}
+
+void ai_matmul_pack_b(const q16_16_t* b, q16_16_t* bt, uint32_t n, uint32_t k) {
+    if (!b || !bt) {
+        return;
+    }
+    pack_b_cols(b, bt, n, k, 0, n);
+}
+
 typedef struct {
     const q16_16_t* a;
     const q16_16_t* b;
     q16_16_t* c;
-    uint32_t m_start;
-    uint32_t m_end;
     uint32_t n;
     uint32_t k;
 } matmul_task_args_t;
 
-static void matmul_worker(void* arg) {
+static int ai_matmul_serial(const q16_16_t* a, const q16_16_t* b, q16_16_t* c, uint32_t m, uint32_t n, uint32_t k);
+
+static void matmul_worker(void* arg, uint32_t start, uint32_t end) {
     matmul_task_args_t* args = (matmul_task_args_t*)arg;
-    for (uint32_t i = args->m_start; i < args->m_end; ++i) {
-        const q16_16_t* arow = args->a + i * args->k;
-        for (uint32_t j = 0; j < args->n; ++j) {
-            args->c[i * args->n + j] = ai_dot_q16_simd(arow, args->b, args->n, args->k, j);
-        }
+    ai_matmul_serial(args->a + start * args->k, args->b, args->c + start * args->n,
+                     end - start, args->n, args->k);
+}
+
+int ai_matmul_q16_16_packed(const q16_16_t* a, const q16_16_t* bt, q16_16_t* c, uint32_t m, uint32_t n, uint32_t k) {
+    if (!ai_gemm_q16(a, bt, c, m, n, k)) {
+        return 0;
     }
+    return ai_gemm_isa() == AI_GEMM_SCALAR ? 1 : 2;
 }
 
 int ai_matmul_q16_16(const q16_16_t* a, const q16_16_t* b, q16_16_t* c, uint32_t m, uint32_t n, uint32_t k) {
     if (!a || !b || !c || m == 0 || n == 0 || k == 0) {
         return 0;
     }
+    // A k x 1 B is its own transpose.
+    if (n == 1) {
+        return ai_matmul_q16_16_packed(a, b, c, m, n, k);
+    }
 
-    // If SMP is enabled and matrix is large enough, use scheduler
-    if (ai_scheduler_running && m >= 8 && ai_worker_count > 0) {
-        // Split into chunks based on worker count
-        // For simplicity, launch 4 jobs if m is large enough
-        uint32_t chunks = 4;
-        if (m < 16) chunks = 2;
-        
-        uint32_t rows_per_chunk = m / chunks;
-        ai_job_t jobs[4];
-        matmul_task_args_t args[4];
-        
-        for (uint32_t i = 0; i < chunks; ++i) {
-            args[i].a = a;
-            args[i].b = b;
-            args[i].c = c;
-            args[i].m_start = i * rows_per_chunk;
-            args[i].m_end = (i == chunks - 1) ? m : (i + 1) * rows_per_chunk;
-            args[i].n = n;
-            args[i].k = k;
-            
-            jobs[i].func = matmul_worker;
-            jobs[i].arg = &args[i];
-            
-            ai_scheduler_submit(&jobs[i]);
+    // Pack B one L2-sized column panel at a time and run the GEMM engine on
+    // each panel, writing its slice of C in place.
+    uint32_t panel = AI_GEMM_L2_BYTES / (k * (uint32_t)sizeof(q16_16_t));
+    if (panel == 0) {
+        panel = 1;
+    }
+    if (panel > n) {
+        panel = n;
+    }
+    q16_16_t* bt = (q16_16_t*)kmalloc(panel * k * sizeof(q16_16_t));
+    if (bt) {
+        for (uint32_t j0 = 0; j0 < n; j0 += panel) {
+            uint32_t j1 = j0 + panel < n ? j0 + panel : n;
+            pack_b_cols(b, bt, n, k, j0, j1);
+            ai_gemm_q16_ldc(a, bt, c + j0, n, m, j1 - j0, k);
         }
-        
-        // Wait for all jobs
-        for (uint32_t i = 0; i < chunks; ++i) {
-            ai_scheduler_wait(&jobs[i]);
+        kfree(bt);
+        return ai_gemm_isa() == AI_GEMM_SCALAR ? 1 : 2;
+    }
+
+    // No room to pack: fall back to the strided kernel.
+    // Row blocks go to every online CPU that runs an AI worker.
+    if (ai_scheduler_lanes() > 1 && m >= 8) {
+        matmul_task_args_t args;
+        args.a = a;
+        args.b = b;
+        args.c = c;
+        args.n = n;
+        args.k = k;
+        if (ai_scheduler_run_rows(m, 4, matmul_worker, &args) > 1) {
+            return 2; // SMP executed
         }
-        return 2; // SMP executed
+        return simd_enabled && k >= 4 ? 2 : 1;
     }
+    return ai_matmul_serial(a, b, c, m, n, k);
+}
 
+static int ai_matmul_serial(const q16_16_t* a, const q16_16_t* b, q16_16_t* c, uint32_t m, uint32_t n, uint32_t k) {
     if (simd_enabled && k >= 4) {
         for (uint32_t i = 0; i < m; ++i) {
             const q16_16_t* arow = a + i * k;
@@ -795,10 +1280,74 @@ int ai_matmul_q16_16(const q16_16_t* a, const q16_16_t* b, q16_16_t* c, uint32_t
     return 1;
 }
 
-void ai_model_init(void) {
+static int module_tagged(const multiboot_module_t* mod) {
+    const char* cmdline = (const char*)mod->string;
+    if (!cmdline || mod->string >= AI_MODEL_VIRT_BASE) {
+        return 0;
+    }
+    uint32_t tag_len = sizeof(AI_MODEL_MODULE_TAG) - 1;
+    for (const char* p = cmdline; *p; ++p) {
+        uint32_t i = 0;
+        while (i < tag_len && p[i] == AI_MODEL_MODULE_TAG[i]) {
+            ++i;
+        }
+        if (i == tag_len) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// GRUB loads modules low, inside the identity map, so the magic can be read
+// before anything is mapped.
+static int module_is_gguf(const multiboot_module_t* mod) {
+    if (mod->mod_end < mod->mod_start + 4 || mod->mod_end > 0x20000000u) {
+        return 0;
+    }
+    return memcmp((const void*)mod->mod_start, "GGUF", 4) == 0;
+}
+
+// The module tagged "ai_model" on its command line, else the first GGUF.
+static const multiboot_module_t* find_model_module(const multiboot_info_t* info) {
+    if (!info || !(info->flags & 0x8) || info->mods_count == 0) {
+        return 0;
+    }
+    const multiboot_module_t* mods = (const multiboot_module_t*)info->mods_addr;
+    for (uint32_t i = 0; i < info->mods_count; ++i) {
+        if (module_tagged(&mods[i])) {
+            return &mods[i];
+        }
+    }
+    for (uint32_t i = 0; i < info->mods_count; ++i) {
+        if (module_is_gguf(&mods[i])) {
+            return &mods[i];
+        }
+    }
+    return 0;
+}
+
+uint32_t ai_model_module_phys(void) {
+    return ai_module_phys;
+}
+
+void ai_model_init(const multiboot_info_t* info) {
     serial_write_string("DEBUG: ai_model_init starting...\n");
-    uint32_t phys_start = (uint32_t)&_ai_model_start;
-    uint32_t phys_end = (uint32_t)&_ai_model_end;
+    ai_math_init();
+    // GEMM callers (bench, row-scratch matvecs) need a kernel with or
+    // without a model module.
+    ai_gemm_init();
+    boot_info = info;
+    ai_mapped_base = 0;
+    ai_mapped_size = 0;
+    ai_module_phys = 0;
+    const multiboot_module_t* mod = find_model_module(info);
+    if (!mod || mod->mod_end <= mod->mod_start) {
+        serial_write_string("DEBUG: AI Model module not found\n");
+        diag_log(DIAG_WARN, "no ai_model boot module");
+        return;
+    }
+    uint32_t phys_start = mod->mod_start;
+    uint32_t phys_end = mod->mod_end;
     
     serial_write_string("DEBUG: AI Model range: ");
     serial_write_hex32(phys_start);
@@ -806,17 +1355,27 @@ void ai_model_init(void) {
     serial_write_hex32(phys_end);
     serial_write_string("\n");
 
-    if (phys_end <= phys_start) {
-        serial_write_string("DEBUG: AI Model not found (size 0)\n");
-        ai_mapped_base = 0;
-        ai_mapped_size = 0;
-        return;
-    }
     uint32_t size = phys_end - phys_start;
     uint32_t aligned_phys = phys_start & 0xFFC00000;
     uint32_t offset = phys_start - aligned_phys;
     uint32_t total = offset + size;
     uint32_t page_count = (total + 0x3FFFFF) >> 22;
+    if (page_count > (AI_MODEL_VIRT_LIMIT - AI_MODEL_VIRT_BASE) >> 22) {
+        diag_log_hex32(DIAG_ERROR, "ai model too large for window", size);
+        return;
+    }
+    // Anything already in the window (a linear framebuffer, say) would be
+    // shadowed by the model.
+    uintptr_t* kdir = mmu_get_kernel_space();
+    for (uint32_t i = 0; i < page_count; ++i) {
+        if (mmu_get_flags_dir(kdir, AI_MODEL_VIRT_BASE + (i << 22)) & PAGE_FLAG_PRESENT) {
+            diag_log_hex32(DIAG_ERROR, "ai model window in use at", AI_MODEL_VIRT_BASE + (i << 22));
+            return;
+        }
+    }
+    // kernel_main already reserves every module; this makes the model's own
+    // claim on its frames explicit.
+    pmm_reserve_region(phys_start, size);
     
     serial_write_string("DEBUG: Mapping AI Model pages: ");
     serial_write_hex32(page_count);
@@ -828,6 +1387,7 @@ void ai_model_init(void) {
     }
     serial_write_string("\nDEBUG: AI Model pages mapped\n");
 
+    ai_module_phys = phys_start;
     ai_mapped_base = (uint8_t*)(AI_MODEL_VIRT_BASE + offset);
     ai_mapped_size = size;
 
@@ -840,6 +1400,9 @@ void ai_model_init(void) {
         serial_write_string("DEBUG: GGUF BAD\n");
         diag_log(DIAG_ERROR, "gguf header invalid");
     }
+    if (!ai_tensor_index_build()) {
+        diag_log(DIAG_ERROR, "gguf tensor index failed");
+    }
 
     if (cpu_has_feature(CPU_FEATURE_SSE41)) {
         cpu_enable_feature(CPU_FEATURE_SSE);
@@ -848,6 +1411,15 @@ void ai_model_init(void) {
     } else {
         diag_log(DIAG_INFO, "AI SIMD acceleration disabled (SSE4.1 not found)");
     }
+    ai_quant_init();
+
+    ai_load_vocab();
+
+    if (ai_transformer_init()) {
+        diag_log(DIAG_INFO, "AI transformer ready");
+    } else {
+        diag_log(DIAG_WARN, "AI transformer unavailable, using canned responses");
+    }
 
     serial_write_string("DEBUG: ai_model_init finished\n");
 }
@@ -885,6 +1457,18 @@ static void ai_stream_write_slow(const char* text) {
 
 void ai_infer(const char* prompt, const ai_context_t* context) {
     ai_stream_write_slow("BasicallyLinux AI: ");
+    if (ai_transformer_ready()) {
+        uint64_t ticks = 0;
+        uint32_t generated = ai_transformer_generate(prompt, AI_GENERATE_MAX_TOKENS, &ticks);
+        ai_stream_write("\n[");
+        ai_stream_write_uint64(generated);
+        ai_stream_write(" tokens, ");
+        ai_stream_write_uint64(ticks);
+        ai_stream_write(" ticks, ");
+        ai_stream_write_uint64(ticks ? ((uint64_t)generated * 100u) / ticks : 0);
+        ai_stream_write(" tok/s]\n");
+        return;
+    }
     if (contains_word(prompt, "memory") || contains_word(prompt, "mem")) {
         ai_stream_write_slow("Memory usage ");
         ai_stream_write_slow("total=");
@@ -949,14 +1533,6 @@ uint32_t ai_debug_last_tokens(char* out, uint32_t max) {
     return count;
 }
 
-static q16_16_t q16_div(q16_16_t a, q16_16_t b) {
-    if (b == 0) {
-        return 0;
-    }
-    int64_t num = (int64_t)a << 16;
-    return (q16_16_t)(num / b);
-}
-
 static uint64_t isqrt64(uint64_t x) {
     uint64_t op = x;
     uint64_t res = 0;
@@ -976,41 +1552,6 @@ static uint64_t isqrt64(uint64_t x) {
     return res;
 }
 
-static q16_16_t q16_inv_sqrt(q16_16_t x) {
-    if (x <= 0) {
-        return 0;
-    }
-    uint64_t scaled = ((uint64_t)(uint32_t)x) << 16;
-    uint64_t root = isqrt64(scaled);
-    if (root == 0) {
-        return 0;
-    }
-    uint64_t inv = ((uint64_t)1 << 32) / root;
-    return (q16_16_t)inv;
-}
-
-static q16_16_t q16_exp_approx(q16_16_t x) {
-    q16_16_t max = q16_from_int(8);
-    q16_16_t min = -q16_from_int(8);
-    if (x > max) {
-        x = max;
-    }
-    if (x < min) {
-        x = min;
-    }
-    q16_16_t one = q16_from_int(1);
-    q16_16_t x2 = q16_mul(x, x);
-    q16_16_t x3 = q16_mul(x2, x);
-    q16_16_t term = one;
-    term = q16_add(term, x);
-    term = q16_add(term, (q16_16_t)((int64_t)x2 / 2));
-    term = q16_add(term, (q16_16_t)((int64_t)x3 / 6));
-    if (term < 0) {
-        term = 0;
-    }
-    return term;
-}
-
 int gguf_parse(gguf_header_t* out) {
     return ai_model_read_header(out);
 }
@@ -1027,6 +1568,9 @@ q16_16_t dot_product(const q16_16_t* a, const q16_16_t* b, uint32_t n) {
     if (!a || !b || n == 0) {
         return 0;
     }
+    if (simd_enabled && n >= 4) {
+        return ai_dot_q16_simd_unit(a, b, n);
+    }
     q16_16_t sum = 0;
     for (uint32_t i = 0; i < n; ++i) {
         sum = q16_add(sum, q16_mul(a[i], b[i]));
@@ -1038,81 +1582,185 @@ void rmsnorm(q16_16_t* data, uint32_t n) {
     if (!data || n == 0) {
         return;
     }
+    // Squares are accumulated in 32.32 so residual-stream outliers do not wrap.
     int64_t acc = 0;
     for (uint32_t i = 0; i < n; ++i) {
-        q16_16_t val = data[i];
-        acc += (int64_t)q16_mul(val, val);
+        int64_t val = data[i];
+        acc += val * val;
     }
-    q16_16_t mean = (q16_16_t)(acc / (int64_t)n);
-    q16_16_t inv = q16_inv_sqrt(mean);
+    uint64_t mean = (uint64_t)(acc / (int64_t)n) + AI_RMS_EPS_Q32;
+    uint64_t root = isqrt64(mean);
+    if (root == 0) {
+        return;
+    }
+    q16_16_t inv = (q16_16_t)(((uint64_t)1 << 32) / root);
     for (uint32_t i = 0; i < n; ++i) {
         data[i] = q16_mul(data[i], inv);
     }
 }
 
 void softmax(q16_16_t* data, uint32_t n) {
-    if (!data || n == 0) {
-        return;
+    ai_softmax_q16(data, n);
+}
+
+#define AI_TWO_PI_Q32 26986075409ull
+#define AI_HALF_PI_Q32 6746518852ull
+#define AI_ROPE_MAX_PAIRS 128
+
+static uint32_t rope_inv_freq[AI_ROPE_MAX_PAIRS];
+static uint32_t rope_pairs = 0;
+// What rope_init was last called with; 0 until then.
+static uint32_t rope_head_dim = 0;
+static uint32_t rope_freq_base = 10000;
+// (cos, sin) per [position][pair]; positions past the table are computed
+// into rope_row on demand.
+static q16_16_t* rope_table = 0;
+static uint32_t rope_table_positions = 0;
+static uint32_t rope_table_capacity = 0;
+static q16_16_t rope_row[AI_ROPE_MAX_PAIRS * 2];
+
+static uint32_t ai_log2_q16(uint32_t x) {
+    if (x == 0) {
+        return 0;
     }
-    q16_16_t max = data[0];
-    for (uint32_t i = 1; i < n; ++i) {
-        if (data[i] > max) {
-            max = data[i];
+    uint32_t ipart = 31u - (uint32_t)__builtin_clz(x);
+    uint64_t z = ((uint64_t)x << 30) >> ipart;
+    uint32_t frac = 0;
+    for (uint32_t bit = 1u << 15; bit; bit >>= 1) {
+        z = (z * z) >> 30;
+        if (z >= ((uint64_t)2 << 30)) {
+            z >>= 1;
+            frac |= bit;
         }
     }
-    q16_16_t sum = 0;
-    for (uint32_t i = 0; i < n; ++i) {
-        q16_16_t val = q16_sub(data[i], max);
-        q16_16_t expv = q16_exp_approx(val);
-        data[i] = expv;
-        sum = q16_add(sum, expv);
-    }
-    if (sum == 0) {
-        return;
-    }
-    for (uint32_t i = 0; i < n; ++i) {
-        int64_t num = (int64_t)data[i] << 16;
-        data[i] = (q16_16_t)(num / sum);
-    }
+    return (ipart << 16) | frac;
 }
 
-void rope_apply(q16_16_t* data, uint32_t n) {
-    if (!data || n < 2) {
-        return;
-    }
-    for (uint32_t i = 0; i + 1 < n; i += 2) {
-        q16_16_t a = data[i];
-        q16_16_t b = data[i + 1];
-        data[i] = q16_sub(a, (q16_16_t)(b >> 1));
-        data[i + 1] = q16_add(b, (q16_16_t)(a >> 1));
+// sin/cos of a 0.32 angle in [0, 2pi), returned in q16.16.
+static void ai_sincos_q16(uint64_t angle, q16_16_t* s, q16_16_t* c) {
+    uint32_t quadrant = (uint32_t)(angle / AI_HALF_PI_Q32);
+    int64_t r = (int64_t)((angle - (uint64_t)quadrant * AI_HALF_PI_Q32) >> 2);
+    int64_t one = (int64_t)1 << 30;
+    int64_t x2 = (r * r) >> 30;
+    int64_t sn = one - ((x2 / 72));
+    sn = one - (((x2 * sn) >> 30) / 42);
+    sn = one - (((x2 * sn) >> 30) / 20);
+    sn = one - (((x2 * sn) >> 30) / 6);
+    sn = (r * sn) >> 30;
+    int64_t cs = one - (x2 / 90);
+    cs = one - (((x2 * cs) >> 30) / 56);
+    cs = one - (((x2 * cs) >> 30) / 30);
+    cs = one - (((x2 * cs) >> 30) / 12);
+    cs = one - (((x2 * cs) >> 30) / 2);
+    q16_16_t s16 = (q16_16_t)(sn >> 14);
+    q16_16_t c16 = (q16_16_t)(cs >> 14);
+    switch (quadrant & 3u) {
+        case 0:
+            *s = s16;
+            *c = c16;
+            break;
+        case 1:
+            *s = c16;
+            *c = -s16;
+            break;
+        case 2:
+            *s = -s16;
+            *c = -c16;
+            break;
+        default:
+            *s = -c16;
+            *c = s16;
+            break;
     }
 }
 
-uint32_t tokenizer_encode(const char* text, uint32_t* out, uint32_t max) {
-    if (!text || !out || max == 0) {
+int rope_init(uint32_t head_dim, uint32_t freq_base) {
+    // Every pair of the head is rotated, so the head must split into at
+    // most AI_ROPE_MAX_PAIRS pairs.
+    if (head_dim < 2 || (head_dim & 1u) || head_dim / 2 > AI_ROPE_MAX_PAIRS) {
         return 0;
     }
-    uint32_t count = 0;
-    while (text[count] && count < max) {
-        out[count] = (uint32_t)(uint8_t)text[count];
-        count++;
+    uint32_t pairs = head_dim / 2;
+    if (freq_base == 0) {
+        freq_base = 10000;
+    }
+    uint32_t log2_base = ai_log2_q16(freq_base);
+    for (uint32_t i = 0; i < pairs; ++i) {
+        // inv_freq_i = base^(-2i/d) = 2^(-(2i/d) * log2(base))
+        uint32_t e = (uint32_t)(((uint64_t)log2_base * (2u * i)) / head_dim);
+        uint64_t f = ai_exp2_neg_q32(e);
+        rope_inv_freq[i] = f > 0xFFFFFFFFull ? 0xFFFFFFFFu : (uint32_t)f;
+    }
+    rope_pairs = pairs;
+    rope_head_dim = head_dim;
+    rope_freq_base = freq_base;
+    rope_table_positions = 0;
+    return 1;
+}
+
+static void rope_fill_row(uint32_t pos, q16_16_t* row) {
+    for (uint32_t i = 0; i < rope_pairs; ++i) {
+        uint64_t angle = ((uint64_t)pos * rope_inv_freq[i]) % AI_TWO_PI_Q32;
+        ai_sincos_q16(angle, &row[2 * i + 1], &row[2 * i]);
     }
-    return count;
 }
 
-uint32_t tokenizer_decode(uint32_t token, char* out, uint32_t max) {
-    if (!out || max == 0) {
+int rope_precompute(uint32_t positions) {
+    if (rope_pairs == 0 || positions == 0) {
         return 0;
     }
-    if (token > 255 || max < 2) {
-        out[0] = 0;
-        return 0;
+    uint32_t entries = positions * rope_pairs * 2;
+    // Arena memory is never returned, so an existing table is refilled when
+    // it is big enough.
+    if (entries > rope_table_capacity) {
+        q16_16_t* table = (q16_16_t*)ai_arena_alloc(entries * sizeof(q16_16_t), 16);
+        if (!table) {
+            return 0;
+        }
+        rope_table = table;
+        rope_table_capacity = entries;
+    }
+    for (uint32_t pos = 0; pos < positions; ++pos) {
+        rope_fill_row(pos, rope_table + pos * rope_pairs * 2);
     }
-    out[0] = (char)token;
-    out[1] = 0;
+    rope_table_positions = positions;
     return 1;
 }
 
+void rope_apply(q16_16_t* data, uint32_t n, uint32_t head_dim, uint32_t pos) {
+    if (!data || n < 2 || head_dim < 2) {
+        return;
+    }
+    // Model load rejects a head size rope_init cannot take, so a mismatch
+    // here is a caller bug; re-initialising would drop the model's base and
+    // table for every later token.
+    if (rope_head_dim == 0 && !rope_init(head_dim, rope_freq_base)) {
+        return;
+    }
+    if (head_dim != rope_head_dim) {
+        return;
+    }
+    const q16_16_t* row = rope_row;
+    if (pos < rope_table_positions) {
+        row = rope_table + pos * rope_pairs * 2;
+    } else {
+        rope_fill_row(pos, rope_row);
+    }
+    // Every head rotates by the same row, so each pass streams the row and
+    // one head's pairs side by side.
+    for (uint32_t base = 0; base + head_dim <= n; base += head_dim) {
+        q16_16_t* h = data + base;
+        for (uint32_t i = 0; i < 2 * rope_pairs; i += 2) {
+            q16_16_t cs = row[i];
+            q16_16_t sn = row[i + 1];
+            q16_16_t a = h[i];
+            q16_16_t b = h[i + 1];
+            h[i] = q16_sub(q16_mul(a, cs), q16_mul(b, sn));
+            h[i + 1] = q16_add(q16_mul(a, sn), q16_mul(b, cs));
+        }
+    }
+}
+
 void ai_context_init(ai_context_t* context) {
     if (!context) {
         return;
@@ -1121,17 +1769,13 @@ void ai_context_init(ai_context_t* context) {
 }
 
 void ai_stream_token(uint32_t token) {
-    char buf[2];
-    if (tokenizer_decode(token, buf, sizeof(buf)) == 1) {
-        ai_stream_putc(buf[0]);
+    char buf[64];
+    uint32_t len = tokenizer_decode(token, buf, sizeof(buf));
+    for (uint32_t i = 0; i < len; ++i) {
+        ai_stream_putc(buf[i]);
     }
 }
 
-int kv_cache_init(uint32_t tokens) {
-    kv_cache_tokens = tokens;
-    return tokens ? 1 : 0;
-}
-
 static uint32_t ai_argmax(const q16_16_t* data, uint32_t n) {
     if (!data || n == 0) {
         return 0;
@@ -1147,91 +1791,27 @@ static uint32_t ai_argmax(const q16_16_t* data, uint32_t n) {
     return idx;
 }
 
+// Stateless entry point kept for callers outside the transformer: top-p over
+// the AI_SAMPLER_MAX_K best logits at the global temperature.
 uint32_t sample_top_p(const q16_16_t* probs, uint32_t count, q16_16_t p) {
     if (!probs || count == 0) {
         return 0;
     }
-    if (count == 1) {
-        return 0;
-    }
-    q16_16_t one = q16_from_int(1);
     if (p <= 0) {
         return ai_argmax(probs, count);
     }
-    if (p > one) {
-        p = one;
-    }
-    q16_16_t temp = ai_temp > 0 ? ai_temp : one;
-    q16_16_t* expv = (q16_16_t*)kmalloc(count * sizeof(q16_16_t));
-    if (!expv) {
-        return ai_argmax(probs, count);
-    }
-    uint8_t* used = (uint8_t*)kmalloc(count);
-    if (!used) {
-        kfree(expv);
-        return ai_argmax(probs, count);
-    }
-    q16_16_t max = probs[0];
-    for (uint32_t i = 1; i < count; ++i) {
-        if (probs[i] > max) {
-            max = probs[i];
-        }
-    }
-    q16_16_t sum = 0;
-    for (uint32_t i = 0; i < count; ++i) {
-        q16_16_t centered = q16_sub(probs[i], max);
-        q16_16_t scaled = q16_div(centered, temp);
-        expv[i] = q16_exp_approx(scaled);
-        sum = q16_add(sum, expv[i]);
-        used[i] = 0;
-    }
-    if (sum == 0) {
-        kfree(used);
-        kfree(expv);
-        return ai_argmax(probs, count);
-    }
-    q16_16_t target = q16_mul(p, sum);
-    q16_16_t cumulative = 0;
-    uint32_t selected = ai_argmax(probs, count);
-    for (uint32_t picked = 0; picked < count; ++picked) {
-        q16_16_t best = 0;
-        int found = 0;
-        uint32_t best_idx = 0;
-        for (uint32_t i = 0; i < count; ++i) {
-            if (used[i]) {
-                continue;
-            }
-            if (!found || expv[i] > best) {
-                best = expv[i];
-                best_idx = i;
-                found = 1;
-            }
-        }
-        if (!found) {
-            break;
-        }
-        used[best_idx] = 1;
-        cumulative = q16_add(cumulative, best);
-        selected = best_idx;
-        if (cumulative >= target) {
-            break;
-        }
-    }
-    kfree(used);
-    kfree(expv);
-    return selected;
+    top_p_sampler.params.temperature = ai_temp;
+    top_p_sampler.params.top_k = AI_SAMPLER_MAX_K;
+    top_p_sampler.params.top_p = p;
+    top_p_sampler.params.repeat_penalty = q16_from_int(1);
+    return ai_sampler_pick(&top_p_sampler, probs, count);
 }
 
-int transformer_step(const uint32_t* input, uint32_t input_len, uint32_t* output_token) {
-    if (!input || !output_token || input_len == 0) {
+int ai_load_vocab(void) {
+    if (!ai_mapped_base || !ai_mapped_size) {
         return 0;
     }
-    *output_token = input[input_len - 1];
-    return 1;
-}
-
-int ai_load_vocab(void) {
-    return ai_mapped_base && ai_mapped_size ? 1 : 0;
+    return ai_tokenizer_init();
 }
 
 void ai_panic_handler(const char* msg) {
@@ -1247,10 +1827,7 @@ float fixed_to_float(q16_16_t value) {
 }
 
 q16_16_t activation_silu(q16_16_t x) {
-    q16_16_t neg = q16_sub(0, x);
-    q16_16_t expv = q16_exp_approx(neg);
-    q16_16_t denom = q16_add(q16_from_int(1), expv);
-    return q16_div(x, denom);
+    return ai_silu_q16(x);
 }
 
 void ai_set_temp(q16_16_t temp) {
@@ -1266,8 +1843,9 @@ void get_system_context(ai_context_t* context) {
     context->heap_total = heap_total_bytes();
     context->heap_free = heap_free_bytes();
     context->uptime_ticks = timer_get_ticks();
+    ai_transformer_fill_context(context);
 }
 
 void mmap_ai_weights(void) {
-    ai_model_init();
+    ai_model_init(boot_info);
 }
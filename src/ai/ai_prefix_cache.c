@@ -0,0 +1,244 @@
+#include "ai/ai_prefix_cache.h"
+#include "diag.h"
+#include "mem/kswapd.h"
+#include "mem/pmm.h"
+#include "types.h"
+#include "util.h"
+
+// A snapshot of the K/V rows for positions [0, n_tokens) of a prompt, laid
+// out like ai_kv_cache_t but with n_tokens slots per head. K and V share one
+// PMM run. Entries are found by a hash of the first AI_PREFIX_MIN_TOKENS
+// tokens and then compared token by token, so a prompt that diverges after
+// those still reuses the part it shares.
+typedef struct {
+    uint32_t used;
+    uint32_t hash;
+    uint32_t n_tokens;
+    uint32_t tokens[AI_SESSION_PROMPT_MAX];
+    q16_16_t* k;
+    q16_16_t* v;
+    uint32_t region_bytes;
+    uint32_t last_used;
+} ai_prefix_entry_t;
+
+static ai_prefix_entry_t entries[AI_PREFIX_ENTRIES];
+static ai_prefix_stats_t stats;
+static uint32_t use_clock = 0;
+static int registered = 0;
+// kswapd reclaims from the timer IRQ, so it only try-locks; the lookup
+// and store paths spin, which at worst waits out one reclaim.
+static volatile uint32_t cache_lock = 0;
+
+static int cache_trylock(void) {
+    return __sync_lock_test_and_set(&cache_lock, 1) == 0;
+}
+
+static void cache_lock_acquire(void) {
+    while (!cache_trylock()) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+static void cache_unlock(void) {
+    __sync_lock_release(&cache_lock);
+}
+
+static uint32_t prefix_hash(const uint32_t* tokens) {
+    uint32_t h = 2166136261u;
+    for (uint32_t i = 0; i < AI_PREFIX_MIN_TOKENS; ++i) {
+        h = (h ^ tokens[i]) * 16777619u;
+    }
+    return h;
+}
+
+static void entry_free(ai_prefix_entry_t* e) {
+    pmm_free_region((uint32_t)e->k, e->region_bytes);
+    stats.bytes -= e->region_bytes;
+    stats.entries--;
+    e->used = 0;
+    e->k = 0;
+    e->v = 0;
+}
+
+static ai_prefix_entry_t* entry_lru(void) {
+    ai_prefix_entry_t* lru = 0;
+    for (uint32_t i = 0; i < AI_PREFIX_ENTRIES; ++i) {
+        if (entries[i].used && (!lru || entries[i].last_used < lru->last_used)) {
+            lru = &entries[i];
+        }
+    }
+    return lru;
+}
+
+static uint32_t common_prefix(const uint32_t* a, const uint32_t* b, uint32_t n) {
+    uint32_t i = 0;
+    while (i < n && a[i] == b[i]) {
+        ++i;
+    }
+    return i;
+}
+
+// Copies n positions per head between a cache (stride capacity) and a
+// snapshot (stride n_tokens).
+static void copy_rows(q16_16_t* dst, uint32_t dst_stride, const q16_16_t* src, uint32_t src_stride,
+                      const ai_kv_cache_t* kv, uint32_t n) {
+    uint32_t hd = kv->head_dim;
+    uint32_t heads = kv->n_layer * kv->n_head_kv;
+    for (uint32_t h = 0; h < heads; ++h) {
+        memcpy(dst + h * dst_stride * hd, src + h * src_stride * hd, n * hd * sizeof(q16_16_t));
+    }
+}
+
+uint32_t ai_prefix_cache_reclaim(uint32_t target_pages) {
+    if (!cache_trylock()) {
+        return 0;
+    }
+    uint32_t block = pmm_block_size();
+    uint32_t freed = 0;
+    while (freed < target_pages) {
+        ai_prefix_entry_t* lru = entry_lru();
+        if (!lru) {
+            break;
+        }
+        freed += lru->region_bytes / block;
+        entry_free(lru);
+        stats.evictions++;
+    }
+    cache_unlock();
+    return freed;
+}
+
+void ai_prefix_cache_init(void) {
+    if (registered) {
+        return;
+    }
+    memset(entries, 0, sizeof(entries));
+    memset(&stats, 0, sizeof(stats));
+    registered = kswapd_register_reclaimer(ai_prefix_cache_reclaim);
+}
+
+uint32_t ai_prefix_cache_restore(ai_kv_cache_t* kv, const uint32_t* tokens, uint32_t max) {
+    if (!kv || !kv->k || !tokens || kv->n_past != 0 || max < AI_PREFIX_MIN_TOKENS) {
+        return 0;
+    }
+    if (max > kv->capacity) {
+        max = kv->capacity;
+    }
+    uint32_t hash = prefix_hash(tokens);
+    cache_lock_acquire();
+    ai_prefix_entry_t* best = 0;
+    uint32_t best_len = 0;
+    for (uint32_t i = 0; i < AI_PREFIX_ENTRIES; ++i) {
+        ai_prefix_entry_t* e = &entries[i];
+        if (!e->used || e->hash != hash) {
+            continue;
+        }
+        uint32_t n = e->n_tokens < max ? e->n_tokens : max;
+        uint32_t len = common_prefix(e->tokens, tokens, n);
+        if (len > best_len) {
+            best = e;
+            best_len = len;
+        }
+    }
+    if (best_len < AI_PREFIX_MIN_TOKENS) {
+        stats.misses++;
+        cache_unlock();
+        return 0;
+    }
+    // Keys were stored rotated for positions 0.., which is where they land.
+    copy_rows(kv->k, kv->capacity, best->k, best->n_tokens, kv, best_len);
+    copy_rows(kv->v, kv->capacity, best->v, best->n_tokens, kv, best_len);
+    best->last_used = ++use_clock;
+    stats.hits++;
+    stats.tokens_reused += best_len;
+    cache_unlock();
+    kv->n_past = best_len;
+    return best_len;
+}
+
+int ai_prefix_cache_store(const ai_kv_cache_t* kv, const uint32_t* tokens, uint32_t count) {
+    if (!kv || !kv->k || !tokens || count < AI_PREFIX_MIN_TOKENS ||
+        count > AI_SESSION_PROMPT_MAX || count > kv->capacity || kv->n_past < count) {
+        return 0;
+    }
+    uint32_t hash = prefix_hash(tokens);
+    uint32_t block = pmm_block_size();
+    uint32_t half = kv->n_layer * kv->n_head_kv * kv->head_dim * count * sizeof(q16_16_t);
+    uint32_t blocks = (2u * half + block - 1) / block;
+    if (blocks * block > AI_PREFIX_BUDGET_BYTES) {
+        return 0;
+    }
+    cache_lock_acquire();
+    ai_prefix_entry_t* slot = 0;
+    for (uint32_t i = 0; i < AI_PREFIX_ENTRIES; ++i) {
+        ai_prefix_entry_t* e = &entries[i];
+        if (!e->used) {
+            if (!slot) {
+                slot = e;
+            }
+            continue;
+        }
+        if (e->hash != hash) {
+            continue;
+        }
+        uint32_t len = common_prefix(e->tokens, tokens, e->n_tokens < count ? e->n_tokens : count);
+        if (len == count) {
+            // Already covered by an equal or longer snapshot.
+            e->last_used = ++use_clock;
+            cache_unlock();
+            return 1;
+        }
+        if (len == e->n_tokens) {
+            // The new prompt extends this one; keep only the longer.
+            entry_free(e);
+            slot = e;
+        }
+    }
+    while (stats.bytes + blocks * block > AI_PREFIX_BUDGET_BYTES || !slot) {
+        ai_prefix_entry_t* lru = entry_lru();
+        if (!lru) {
+            break;
+        }
+        entry_free(lru);
+        stats.evictions++;
+        if (!slot) {
+            slot = lru;
+        }
+    }
+    uint32_t phys = slot ? pmm_alloc_contiguous(blocks) : 0;
+    if (!phys) {
+        cache_unlock();
+        diag_log(DIAG_WARN, "ai prefix cache store failed");
+        return 0;
+    }
+    slot->k = (q16_16_t*)phys;
+    slot->v = (q16_16_t*)(phys + half);
+    slot->region_bytes = blocks * block;
+    copy_rows(slot->k, count, kv->k, kv->capacity, kv, count);
+    copy_rows(slot->v, count, kv->v, kv->capacity, kv, count);
+    memcpy(slot->tokens, tokens, count * sizeof(uint32_t));
+    slot->n_tokens = count;
+    slot->hash = hash;
+    slot->last_used = ++use_clock;
+    slot->used = 1;
+    stats.bytes += slot->region_bytes;
+    stats.entries++;
+    cache_unlock();
+    return 1;
+}
+
+void ai_prefix_cache_clear(void) {
+    cache_lock_acquire();
+    for (uint32_t i = 0; i < AI_PREFIX_ENTRIES; ++i) {
+        if (entries[i].used) {
+            entry_free(&entries[i]);
+        }
+    }
+    cache_unlock();
+}
+
+void ai_prefix_cache_stats(ai_prefix_stats_t* out) {
+    if (out) {
+        *out = stats;
+    }
+}
@@ -0,0 +1,452 @@
+#include "ai/ai_quant.h"
+#include "ai/ai_model.h"
+#include "cpu.h"
+#include "diag.h"
+#include "types.h"
+
+// Each block kernel returns its contribution in 32.32 so per-block rounding
+// never accumulates; the row result is narrowed to q16.16 once at the end.
+typedef int64_t (*ai_block_dot_fn)(const uint8_t* block, const q16_16_t* x);
+
+// sum (q16.16) times an f16 scale, in 32.32. The 11-bit mantissa is applied as
+// an integer multiply and the exponent as a shift, so no precision is lost.
+static int64_t f16_scale(uint16_t h, int64_t sum) {
+    uint32_t exp = (h >> 10) & 0x1Fu;
+    int64_t mant = h & 0x3FFu;
+    if (exp == 31) {
+        return 0;
+    }
+    if (exp) {
+        mant |= 0x400;
+    } else {
+        exp = 1;
+    }
+    int64_t v = sum * mant;
+    int32_t shift = (int32_t)exp - 9;
+    v = shift >= 0 ? (v << shift) : (v >> -shift);
+    return (h & 0x8000u) ? -v : v;
+}
+
+void ai_q4k_scale_min(const uint8_t* scales, uint32_t j, uint32_t* sc, uint32_t* m) {
+    if (j < 4) {
+        *sc = scales[j] & 63u;
+        *m = scales[j + 4] & 63u;
+    } else {
+        *sc = (scales[j + 4] & 0x0Fu) | ((scales[j - 4] >> 6) << 4);
+        *m = (scales[j + 4] >> 4) | ((scales[j] >> 6) << 4);
+    }
+}
+
+static int64_t dot_q8_0(const uint8_t* block, const q16_16_t* x) {
+    const int8_t* qs = (const int8_t*)(block + 2);
+    int64_t sum = 0;
+    for (uint32_t i = 0; i < 32; ++i) {
+        sum += (int64_t)qs[i] * x[i];
+    }
+    return f16_scale(*(const uint16_t*)block, sum);
+}
+
+static int64_t dot_q4_0(const uint8_t* block, const q16_16_t* x) {
+    const uint8_t* qs = block + 2;
+    int64_t sum = 0;
+    for (uint32_t i = 0; i < 16; ++i) {
+        sum += (int64_t)((int32_t)(qs[i] & 0x0F) - 8) * x[i];
+        sum += (int64_t)((int32_t)(qs[i] >> 4) - 8) * x[i + 16];
+    }
+    return f16_scale(*(const uint16_t*)block, sum);
+}
+
+static int64_t dot_q5_0(const uint8_t* block, const q16_16_t* x) {
+    uint32_t qh = *(const uint32_t*)(block + 2);
+    const uint8_t* qs = block + 6;
+    int64_t sum = 0;
+    for (uint32_t i = 0; i < 16; ++i) {
+        int32_t lo = (int32_t)((qs[i] & 0x0Fu) | (((qh >> i) & 1u) << 4)) - 16;
+        int32_t hi = (int32_t)((qs[i] >> 4) | (((qh >> (i + 16)) & 1u) << 4)) - 16;
+        sum += (int64_t)lo * x[i];
+        sum += (int64_t)hi * x[i + 16];
+    }
+    return f16_scale(*(const uint16_t*)block, sum);
+}
+
+// Q4_K: 8 sub-blocks of 32 share one 32-byte nibble plane per pair; the
+// 6-bit mins are applied against the plain activation sums.
+static int64_t dot_q4_k(const uint8_t* block, const q16_16_t* x) {
+    const uint8_t* scales = block + 4;
+    const uint8_t* qs = block + 16;
+    int64_t sum_q = 0;
+    int64_t sum_m = 0;
+    for (uint32_t j = 0; j < 8; j += 2) {
+        const uint8_t* q = qs + (j >> 1) * 32;
+        const q16_16_t* xs = x + j * 32;
+        int64_t lo = 0;
+        int64_t hi = 0;
+        int64_t xlo = 0;
+        int64_t xhi = 0;
+        for (uint32_t l = 0; l < 32; ++l) {
+            lo += (int64_t)(q[l] & 0x0F) * xs[l];
+            hi += (int64_t)(q[l] >> 4) * xs[l + 32];
+            xlo += xs[l];
+            xhi += xs[l + 32];
+        }
+        uint32_t sc0, m0, sc1, m1;
+        ai_q4k_scale_min(scales, j, &sc0, &m0);
+        ai_q4k_scale_min(scales, j + 1, &sc1, &m1);
+        sum_q += lo * sc0 + hi * sc1;
+        sum_m += xlo * m0 + xhi * m1;
+    }
+    return f16_scale(*(const uint16_t*)block, sum_q) -
+           f16_scale(*(const uint16_t*)(block + 2), sum_m);
+}
+
+// Q6_K: two 128-element halves, each with a 64-byte low plane, 32-byte high
+// plane and eight signed 8-bit scales over 16-element groups.
+static int64_t dot_q6_k(const uint8_t* block, const q16_16_t* x) {
+    const int8_t* scales = (const int8_t*)(block + 192);
+    int64_t sum = 0;
+    for (uint32_t half = 0; half < 2; ++half) {
+        const uint8_t* ql = block + half * 64;
+        const uint8_t* qh = block + 128 + half * 32;
+        const int8_t* sc = scales + half * 8;
+        const q16_16_t* xs = x + half * 128;
+        for (uint32_t is = 0; is < 2; ++is) {
+            int64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+            for (uint32_t l = is * 16; l < is * 16 + 16; ++l) {
+                uint32_t h = qh[l];
+                int32_t q0 = (int32_t)((ql[l] & 0x0Fu) | ((h & 3u) << 4)) - 32;
+                int32_t q1 = (int32_t)((ql[l + 32] & 0x0Fu) | (((h >> 2) & 3u) << 4)) - 32;
+                int32_t q2 = (int32_t)((ql[l] >> 4) | (((h >> 4) & 3u) << 4)) - 32;
+                int32_t q3 = (int32_t)((ql[l + 32] >> 4) | (((h >> 6) & 3u) << 4)) - 32;
+                s0 += (int64_t)q0 * xs[l];
+                s1 += (int64_t)q1 * xs[l + 32];
+                s2 += (int64_t)q2 * xs[l + 64];
+                s3 += (int64_t)q3 * xs[l + 96];
+            }
+            sum += s0 * sc[is] + s1 * sc[is + 2] + s2 * sc[is + 4] + s3 * sc[is + 6];
+        }
+    }
+    return f16_scale(*(const uint16_t*)(block + 208), sum);
+}
+
+static int dot_kernel(uint32_t type, ai_block_dot_fn* fn, uint32_t* elems, uint32_t* bytes) {
+    switch (type) {
+        case GGML_TYPE_Q8_0:
+            *fn = dot_q8_0;
+            *elems = 32;
+            *bytes = 34;
+            return 1;
+        case GGML_TYPE_Q4_0:
+            *fn = dot_q4_0;
+            *elems = 32;
+            *bytes = 18;
+            return 1;
+        case GGML_TYPE_Q5_0:
+            *fn = dot_q5_0;
+            *elems = 32;
+            *bytes = 22;
+            return 1;
+        case GGML_TYPE_Q4_K:
+            *fn = dot_q4_k;
+            *elems = 256;
+            *bytes = 144;
+            return 1;
+        case GGML_TYPE_Q6_K:
+            *fn = dot_q6_k;
+            *elems = 256;
+            *bytes = 210;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+int ai_quant_dot_supported(uint32_t type) {
+    ai_block_dot_fn fn;
+    uint32_t elems;
+    uint32_t bytes;
+    return dot_kernel(type, &fn, &elems, &bytes);
+}
+
+static q16_16_t dot_row(ai_block_dot_fn fn, uint32_t elems, uint32_t bytes,
+                        const uint8_t* row, const q16_16_t* x, uint32_t n) {
+    int64_t acc = 0;
+    for (uint32_t i = 0; i + elems <= n; i += elems) {
+        acc += fn(row, x + i);
+        row += bytes;
+    }
+    return (q16_16_t)(acc >> 16);
+}
+
+q16_16_t ai_quant_dot_q16(uint32_t type, const uint8_t* row, const q16_16_t* x, uint32_t n) {
+    ai_block_dot_fn fn;
+    uint32_t elems;
+    uint32_t bytes;
+    if (!row || !x || !dot_kernel(type, &fn, &elems, &bytes)) {
+        return 0;
+    }
+    return dot_row(fn, elems, bytes, row, x, n);
+}
+
+void ai_quant_matvec_q16(uint32_t type, const uint8_t* data, uint32_t row_bytes,
+                         const q16_16_t* x, q16_16_t* y, uint32_t rows, uint32_t cols) {
+    ai_block_dot_fn fn;
+    uint32_t elems;
+    uint32_t bytes;
+    if (!data || !x || !y || !dot_kernel(type, &fn, &elems, &bytes)) {
+        return;
+    }
+    for (uint32_t r = 0; r < rows; ++r) {
+        y[r] = dot_row(fn, elems, bytes, data + r * row_bytes, x, cols);
+    }
+}
+
+// Int8 activations. Each kernel sums weight * activation codes in 32-bit
+// integers per 32-element block and applies the activation scale once per
+// block; the weight scales are applied as above. Returns 32.32 like the
+// q16.16 kernels, so rows are narrowed the same way.
+typedef int64_t (*ai_q8_dot_fn)(const uint8_t* block, const ai_q8_block_t* x);
+
+typedef char v16qi __attribute__((vector_size(16)));
+typedef char v16qi_u __attribute__((vector_size(16), aligned(1)));
+typedef unsigned char v16qu __attribute__((vector_size(16)));
+typedef unsigned char v16qu_u __attribute__((vector_size(16), aligned(1)));
+typedef short v8hi __attribute__((vector_size(16)));
+typedef int v4si __attribute__((vector_size(16)));
+
+static uint32_t act_mode = AI_ACT_Q16;
+static int q8_simd = 0;
+
+// Block integer sum scaled by the activation's d, back in q16.16 units.
+static inline int64_t q8_scale(int32_t sum, const ai_q8_block_t* x) {
+    return ((int64_t)sum * x->d) >> 8;
+}
+
+void ai_quant_x_q8(const q16_16_t* x, ai_q8_block_t* out, uint32_t n) {
+    for (uint32_t b = 0; b < n / AI_Q8_BLOCK; ++b) {
+        const q16_16_t* xs = x + b * AI_Q8_BLOCK;
+        ai_q8_block_t* o = out + b;
+        uint32_t amax = 0;
+        for (uint32_t i = 0; i < AI_Q8_BLOCK; ++i) {
+            uint32_t a = xs[i] < 0 ? (uint32_t)-xs[i] : (uint32_t)xs[i];
+            if (a > amax) {
+                amax = a;
+            }
+        }
+        int32_t sum = 0;
+        if (amax == 0) {
+            for (uint32_t i = 0; i < AI_Q8_BLOCK; ++i) {
+                o->qs[i] = 0;
+            }
+            o->d = 0;
+            o->sum = 0;
+            continue;
+        }
+        // |x| * inv <= 127 * 2^32, so one multiply per element rounds it.
+        uint64_t inv = (127ull << 32) / amax;
+        for (uint32_t i = 0; i < AI_Q8_BLOCK; ++i) {
+            uint32_t a = xs[i] < 0 ? (uint32_t)-xs[i] : (uint32_t)xs[i];
+            int32_t q = (int32_t)((a * inv + 0x80000000ull) >> 32);
+            if (q > 127) {
+                q = 127;
+            }
+            q = xs[i] < 0 ? -q : q;
+            o->qs[i] = (int8_t)q;
+            sum += q;
+        }
+        uint64_t d = (((uint64_t)amax << 8) + 63) / 127;
+        o->d = d > 0xFFFFFFFFull ? 0xFFFFFFFFu : (uint32_t)d;
+        o->sum = sum;
+    }
+}
+
+static int64_t dot_q8_0_q8(const uint8_t* block, const ai_q8_block_t* x) {
+    const int8_t* qs = (const int8_t*)(block + 2);
+    int32_t sum = 0;
+    for (uint32_t i = 0; i < 32; ++i) {
+        sum += (int32_t)qs[i] * x->qs[i];
+    }
+    return f16_scale(*(const uint16_t*)block, q8_scale(sum, x));
+}
+
+// The unsigned nibbles are dotted as-is and the -8 offset is folded in
+// through the activation sum.
+static int64_t dot_q4_0_q8(const uint8_t* block, const ai_q8_block_t* x) {
+    const uint8_t* qs = block + 2;
+    int32_t sum = 0;
+    for (uint32_t i = 0; i < 16; ++i) {
+        sum += (int32_t)(qs[i] & 0x0F) * x->qs[i];
+        sum += (int32_t)(qs[i] >> 4) * x->qs[i + 16];
+    }
+    sum -= 8 * x->sum;
+    return f16_scale(*(const uint16_t*)block, q8_scale(sum, x));
+}
+
+// Q4_K sub-blocks are 32 wide, one activation block each; the mins use the
+// stored activation sums.
+static int64_t dot_q4_k_q8(const uint8_t* block, const ai_q8_block_t* x) {
+    const uint8_t* scales = block + 4;
+    const uint8_t* qs = block + 16;
+    int64_t sum_q = 0;
+    int64_t sum_m = 0;
+    for (uint32_t j = 0; j < 8; j += 2) {
+        const uint8_t* q = qs + (j >> 1) * 32;
+        const ai_q8_block_t* x0 = x + j;
+        const ai_q8_block_t* x1 = x + j + 1;
+        int32_t lo = 0;
+        int32_t hi = 0;
+        for (uint32_t l = 0; l < 32; ++l) {
+            lo += (int32_t)(q[l] & 0x0F) * x0->qs[l];
+            hi += (int32_t)(q[l] >> 4) * x1->qs[l];
+        }
+        uint32_t sc0, m0, sc1, m1;
+        ai_q4k_scale_min(scales, j, &sc0, &m0);
+        ai_q4k_scale_min(scales, j + 1, &sc1, &m1);
+        sum_q += q8_scale(lo, x0) * sc0 + q8_scale(hi, x1) * sc1;
+        sum_m += q8_scale(x0->sum, x0) * m0 + q8_scale(x1->sum, x1) * m1;
+    }
+    return f16_scale(*(const uint16_t*)block, sum_q) -
+           f16_scale(*(const uint16_t*)(block + 2), sum_m);
+}
+
+// pmaddubsw multiplies unsigned by signed bytes into saturating int16 pairs;
+// pmaddwd against ones widens those to int32. Max pair here is
+// 2 * 128 * 127, inside int16.
+__attribute__((target("ssse3")))
+static inline v4si madd_u8s8(v16qi u, v16qi s) {
+    const v8hi ones = { 1, 1, 1, 1, 1, 1, 1, 1 };
+    return __builtin_ia32_pmaddwd128(__builtin_ia32_pmaddubsw128(u, s), ones);
+}
+
+static inline int32_t hsum_v4si(v4si v) {
+    return v[0] + v[1] + v[2] + v[3];
+}
+
+// Signed weights: |w| as the unsigned operand, w's sign moved onto x.
+__attribute__((target("ssse3")))
+static int64_t dot_q8_0_q8_ssse3(const uint8_t* block, const ai_q8_block_t* x) {
+    v16qi w0 = *(const v16qi_u*)(block + 2);
+    v16qi w1 = *(const v16qi_u*)(block + 18);
+    v16qi x0 = *(const v16qi_u*)x->qs;
+    v16qi x1 = *(const v16qi_u*)(x->qs + 16);
+    v4si acc = madd_u8s8(__builtin_ia32_pabsb128(w0), __builtin_ia32_psignb128(x0, w0)) +
+               madd_u8s8(__builtin_ia32_pabsb128(w1), __builtin_ia32_psignb128(x1, w1));
+    return f16_scale(*(const uint16_t*)block, q8_scale(hsum_v4si(acc), x));
+}
+
+__attribute__((target("ssse3")))
+static int64_t dot_q4_0_q8_ssse3(const uint8_t* block, const ai_q8_block_t* x) {
+    const v16qu mask = { 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15 };
+    v16qu q = *(const v16qu_u*)(block + 2);
+    v16qi lo = (v16qi)(q & mask);
+    v16qi hi = (v16qi)((q >> 4) & mask);
+    v4si acc = madd_u8s8(lo, *(const v16qi_u*)x->qs) + madd_u8s8(hi, *(const v16qi_u*)(x->qs + 16));
+    int32_t sum = hsum_v4si(acc) - 8 * x->sum;
+    return f16_scale(*(const uint16_t*)block, q8_scale(sum, x));
+}
+
+__attribute__((target("ssse3")))
+static int64_t dot_q4_k_q8_ssse3(const uint8_t* block, const ai_q8_block_t* x) {
+    const v16qu mask = { 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15 };
+    const uint8_t* scales = block + 4;
+    const uint8_t* qs = block + 16;
+    int64_t sum_q = 0;
+    int64_t sum_m = 0;
+    for (uint32_t j = 0; j < 8; j += 2) {
+        const uint8_t* q = qs + (j >> 1) * 32;
+        const ai_q8_block_t* x0 = x + j;
+        const ai_q8_block_t* x1 = x + j + 1;
+        v16qu qa = *(const v16qu_u*)q;
+        v16qu qb = *(const v16qu_u*)(q + 16);
+        v4si lo = madd_u8s8((v16qi)(qa & mask), *(const v16qi_u*)x0->qs) +
+                  madd_u8s8((v16qi)(qb & mask), *(const v16qi_u*)(x0->qs + 16));
+        v4si hi = madd_u8s8((v16qi)((qa >> 4) & mask), *(const v16qi_u*)x1->qs) +
+                  madd_u8s8((v16qi)((qb >> 4) & mask), *(const v16qi_u*)(x1->qs + 16));
+        uint32_t sc0, m0, sc1, m1;
+        ai_q4k_scale_min(scales, j, &sc0, &m0);
+        ai_q4k_scale_min(scales, j + 1, &sc1, &m1);
+        sum_q += q8_scale(hsum_v4si(lo), x0) * sc0 + q8_scale(hsum_v4si(hi), x1) * sc1;
+        sum_m += q8_scale(x0->sum, x0) * m0 + q8_scale(x1->sum, x1) * m1;
+    }
+    return f16_scale(*(const uint16_t*)block, sum_q) -
+           f16_scale(*(const uint16_t*)(block + 2), sum_m);
+}
+
+static int q8_kernel(uint32_t type, ai_q8_dot_fn* fn, uint32_t* elems, uint32_t* bytes) {
+    switch (type) {
+        case GGML_TYPE_Q8_0:
+            *fn = q8_simd ? dot_q8_0_q8_ssse3 : dot_q8_0_q8;
+            *elems = 32;
+            *bytes = 34;
+            return 1;
+        case GGML_TYPE_Q4_0:
+            *fn = q8_simd ? dot_q4_0_q8_ssse3 : dot_q4_0_q8;
+            *elems = 32;
+            *bytes = 18;
+            return 1;
+        case GGML_TYPE_Q4_K:
+            *fn = q8_simd ? dot_q4_k_q8_ssse3 : dot_q4_k_q8;
+            *elems = 256;
+            *bytes = 144;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+void ai_quant_init(void) {
+    q8_simd = cpu_has_feature(CPU_FEATURE_SSSE3);
+    diag_log_hex32(DIAG_INFO, "AI int8 dot ssse3", (uint32_t)q8_simd);
+}
+
+uint32_t ai_quant_act_mode(void) {
+    return act_mode;
+}
+
+uint32_t ai_quant_set_act_mode(uint32_t mode) {
+    act_mode = mode == AI_ACT_Q8 ? AI_ACT_Q8 : AI_ACT_Q16;
+    return act_mode;
+}
+
+int ai_quant_q8_simd(void) {
+    return q8_simd;
+}
+
+int ai_quant_q8_supported(uint32_t type) {
+    ai_q8_dot_fn fn;
+    uint32_t elems;
+    uint32_t bytes;
+    return q8_kernel(type, &fn, &elems, &bytes);
+}
+
+static q16_16_t dot_row_q8(ai_q8_dot_fn fn, uint32_t elems, uint32_t bytes,
+                           const uint8_t* row, const ai_q8_block_t* xq, uint32_t n) {
+    int64_t acc = 0;
+    for (uint32_t i = 0; i + elems <= n; i += elems) {
+        acc += fn(row, xq + i / AI_Q8_BLOCK);
+        row += bytes;
+    }
+    return (q16_16_t)(acc >> 16);
+}
+
+q16_16_t ai_quant_dot_q8(uint32_t type, const uint8_t* row, const ai_q8_block_t* xq, uint32_t n) {
+    ai_q8_dot_fn fn;
+    uint32_t elems;
+    uint32_t bytes;
+    if (!row || !xq || !q8_kernel(type, &fn, &elems, &bytes)) {
+        return 0;
+    }
+    return dot_row_q8(fn, elems, bytes, row, xq, n);
+}
+
+void ai_quant_matvec_q8(uint32_t type, const uint8_t* data, uint32_t row_bytes,
+                        const ai_q8_block_t* xq, q16_16_t* y, uint32_t rows, uint32_t cols) {
+    ai_q8_dot_fn fn;
+    uint32_t elems;
+    uint32_t bytes;
+    if (!data || !xq || !y || !q8_kernel(type, &fn, &elems, &bytes)) {
+        return;
+    }
+    for (uint32_t r = 0; r < rows; ++r) {
+        y[r] = dot_row_q8(fn, elems, bytes, data + r * row_bytes, xq, cols);
+    }
+}
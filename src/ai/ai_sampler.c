@@ -0,0 +1,200 @@
+#include "ai/ai_sampler.h"
+#include "ai/ai_math.h"
+#include "ai/ai_transformer.h"
+#include "types.h"
+
+void ai_sampler_defaults(ai_sampler_params_t* params) {
+    if (!params) {
+        return;
+    }
+    params->temperature = q16_from_int(1);
+    params->top_k = 40;
+    params->top_p = AI_TOP_P;
+    // 1.1
+    params->repeat_penalty = (q16_16_t)72090;
+    params->seed = AI_SAMPLER_DEFAULT_SEED;
+}
+
+void ai_sampler_init(ai_sampler_t* s, const ai_sampler_params_t* params) {
+    if (!s) {
+        return;
+    }
+    if (params) {
+        s->params = *params;
+    } else {
+        ai_sampler_defaults(&s->params);
+    }
+    ai_sampler_reset(s);
+}
+
+void ai_sampler_reset(ai_sampler_t* s) {
+    if (!s) {
+        return;
+    }
+    s->history_len = 0;
+    s->history_head = 0;
+    s->rng = s->params.seed ? s->params.seed : AI_SAMPLER_DEFAULT_SEED;
+}
+
+void ai_sampler_accept(ai_sampler_t* s, uint32_t token) {
+    if (!s) {
+        return;
+    }
+    s->history[s->history_head] = token;
+    s->history_head = (s->history_head + 1) % AI_SAMPLER_HISTORY;
+    if (s->history_len < AI_SAMPLER_HISTORY) {
+        s->history_len++;
+    }
+}
+
+// xorshift32: fast, and the stream is fixed by the seed.
+static uint32_t sampler_next(ai_sampler_t* s) {
+    uint32_t x = s->rng ? s->rng : AI_SAMPLER_DEFAULT_SEED;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    s->rng = x;
+    return x;
+}
+
+static void heap_sift_down(uint32_t* id, q16_16_t* val, uint32_t i, uint32_t n) {
+    for (;;) {
+        uint32_t l = 2 * i + 1;
+        if (l >= n) {
+            return;
+        }
+        uint32_t m = (l + 1 < n && val[l + 1] < val[l]) ? l + 1 : l;
+        if (val[i] <= val[m]) {
+            return;
+        }
+        q16_16_t tv = val[i];
+        uint32_t ti = id[i];
+        val[i] = val[m];
+        id[i] = id[m];
+        val[m] = tv;
+        id[m] = ti;
+        i = m;
+    }
+}
+
+static void heap_sift_up(uint32_t* id, q16_16_t* val, uint32_t i) {
+    while (i > 0) {
+        uint32_t p = (i - 1) / 2;
+        if (val[p] <= val[i]) {
+            return;
+        }
+        q16_16_t tv = val[i];
+        uint32_t ti = id[i];
+        val[i] = val[p];
+        id[i] = id[p];
+        val[p] = tv;
+        id[p] = ti;
+        i = p;
+    }
+}
+
+uint32_t ai_sampler_pick(ai_sampler_t* s, const q16_16_t* logits, uint32_t n_vocab) {
+    if (!s || !logits || n_vocab == 0) {
+        return 0;
+    }
+    uint32_t k = s->params.top_k;
+    if (k == 0 || k > AI_SAMPLER_MAX_K) {
+        k = AI_SAMPLER_MAX_K;
+    }
+    if (s->params.temperature <= 0) {
+        k = 1;
+    }
+    if (k > n_vocab) {
+        k = n_vocab;
+    }
+    uint32_t* id = s->cand_id;
+    q16_16_t* val = s->cand_logit;
+    // Min-heap of the k best so far: the root is the one to beat.
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < n_vocab; ++i) {
+        q16_16_t v = logits[i];
+        if (count < k) {
+            id[count] = i;
+            val[count] = v;
+            heap_sift_up(id, val, count);
+            count++;
+        } else if (v > val[0]) {
+            id[0] = i;
+            val[0] = v;
+            heap_sift_down(id, val, 0, count);
+        }
+    }
+    // Heap sort in place; a min-heap leaves the array in descending order.
+    for (uint32_t end = count - 1; end > 0; --end) {
+        q16_16_t tv = val[0];
+        uint32_t ti = id[0];
+        val[0] = val[end];
+        id[0] = id[end];
+        val[end] = tv;
+        id[end] = ti;
+        heap_sift_down(id, val, 0, end);
+    }
+    if (count == 1) {
+        return id[0];
+    }
+
+    int64_t inv_temp = ((int64_t)1 << 32) / s->params.temperature;
+    q16_16_t* prob = s->cand_prob;
+    uint64_t sum = 0;
+    for (uint32_t j = 0; j < count; ++j) {
+        // Clamped so a tiny temperature cannot wrap; e^-32 is already 0.
+        int64_t z = ((int64_t)q16_sub(val[j], val[0]) * inv_temp) >> 16;
+        prob[j] = ai_exp_q16(z < -((int64_t)32 << 16) ? -(32 << 16) : (q16_16_t)z);
+        sum += (uint32_t)prob[j];
+    }
+    // Top-p keeps the shortest sorted prefix holding p of the mass.
+    q16_16_t p = s->params.top_p;
+    uint64_t target = p > 0 && p < q16_from_int(1) ? (sum * (uint32_t)p) >> 16 : sum;
+    uint64_t kept = 0;
+    uint32_t keep = count;
+    for (uint32_t j = 0; j < count; ++j) {
+        kept += (uint32_t)prob[j];
+        if (kept >= target) {
+            keep = j + 1;
+            break;
+        }
+    }
+    uint64_t r = ((uint64_t)sampler_next(s) * kept) >> 32;
+    for (uint32_t j = 0; j < keep; ++j) {
+        if (r < (uint32_t)prob[j]) {
+            return id[j];
+        }
+        r -= (uint32_t)prob[j];
+    }
+    return id[0];
+}
+
+uint32_t ai_sampler_sample(ai_sampler_t* s, q16_16_t* logits, uint32_t n_vocab) {
+    if (!s || !logits || n_vocab == 0) {
+        return 0;
+    }
+    q16_16_t penalty = s->params.repeat_penalty;
+    if (penalty > q16_from_int(1)) {
+        q16_16_t inv = (q16_16_t)(((int64_t)1 << 32) / penalty);
+        for (uint32_t h = 0; h < s->history_len; ++h) {
+            uint32_t t = s->history[h];
+            if (t >= n_vocab) {
+                continue;
+            }
+            // Penalise each distinct token once.
+            uint32_t seen = 0;
+            for (uint32_t j = 0; j < h; ++j) {
+                if (s->history[j] == t) {
+                    seen = 1;
+                    break;
+                }
+            }
+            if (seen) {
+                continue;
+            }
+            q16_16_t l = logits[t];
+            logits[t] = l > 0 ? q16_mul(l, inv) : q16_mul(l, penalty);
+        }
+    }
+    return ai_sampler_pick(s, logits, n_vocab);
+}
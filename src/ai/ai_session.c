@@ -0,0 +1,426 @@
+#include "ai/ai_session.h"
+#include "ai/ai_model.h"
+#include "ai/ai_prefix_cache.h"
+#include "ai/ai_transformer.h"
+#include "diag.h"
+#include "drivers/serial.h"
+#include "kernel/sched.h"
+#include "types.h"
+#include "util.h"
+
+// Sessions live in a fixed pool; slot 0 is the console. The pool lock only
+// guards slot allocation. step_lock makes one CPU at a time the engine for
+// a step, whether that is the engine thread or a caller driving its own
+// generation.
+static ai_session_t sessions[AI_SESSION_MAX];
+static spinlock_t pool_lock = 0;
+static volatile uint32_t step_lock = 0;
+static int engine_started = 0;
+
+static int step_trylock(void) {
+    return __sync_lock_test_and_set(&step_lock, 1) == 0;
+}
+
+static void step_unlock(void) {
+    __sync_lock_release(&step_lock);
+}
+
+// Waits out a running step; for changes to a session the engine may be using.
+static void step_lock_wait(void) {
+    while (!step_trylock()) {
+        scheduler_yield();
+    }
+}
+
+static void session_set_state(ai_session_t* s, uint32_t state) {
+    s->state = state;
+    s->ring->state = state;
+}
+
+static void ring_reset(ai_session_t* s) {
+    s->ring->head = 0;
+    s->ring->tail = 0;
+    s->ring->capacity = AI_SESSION_OUT;
+    s->ring->state = s->state;
+}
+
+static int session_open(ai_session_t* s, uint32_t tokens) {
+    const ai_model_config_t* config = ai_transformer_config();
+    if (!config) {
+        return 0;
+    }
+    if (tokens == 0 || tokens > config->n_ctx) {
+        tokens = config->n_ctx;
+    }
+    if (tokens > AI_CTX_MAX) {
+        tokens = AI_CTX_MAX;
+    }
+    if (!ai_kv_cache_create(&s->kv, config->n_layer, config->n_head_kv, config->head_dim,
+                            tokens, AI_KV_SLIDING)) {
+        return 0;
+    }
+    ai_sampler_init(&s->sampler, 0);
+    s->prompt_len = 0;
+    s->prompt_pos = 0;
+    s->remaining = 0;
+    s->flush = 0;
+    s->owner = 0;
+    s->orphaned = 0;
+    s->ring = &s->out;
+    ring_reset(s);
+    return 1;
+}
+
+int ai_session_init(void) {
+    ai_session_t* console = &sessions[0];
+    if (console->state != AI_SESSION_FREE) {
+        return 1;
+    }
+    if (!session_open(console, 0)) {
+        return 0;
+    }
+    console->id = 0;
+    session_set_state(console, AI_SESSION_IDLE);
+    ai_prefix_cache_init();
+    serial_write_string("DEBUG: AI kv cache tokens ");
+    serial_write_hex32(console->kv.capacity);
+    serial_write_string("\n");
+    return 1;
+}
+
+// Resizes the console's window.
+int kv_cache_init(uint32_t tokens) {
+    ai_session_t* console = &sessions[0];
+    if (tokens == 0 || !ai_transformer_config()) {
+        return 0;
+    }
+    step_lock_wait();
+    int ok = 0;
+    if (console->state == AI_SESSION_IDLE) {
+        ai_kv_cache_destroy(&console->kv);
+        ok = session_open(console, tokens);
+        if (!ok) {
+            console->state = AI_SESSION_FREE;
+        }
+    }
+    step_unlock();
+    return ok;
+}
+
+ai_session_t* ai_session_console(void) {
+    return &sessions[0];
+}
+
+static void ai_session_engine(void) {
+    for (;;) {
+        if (!ai_session_step()) {
+            // Nothing runnable: check again next tick.
+            scheduler_sleep(1);
+            scheduler_yield();
+        }
+    }
+}
+
+void ai_session_start_engine(void) {
+    if (engine_started || !ai_transformer_ready()) {
+        return;
+    }
+    if (process_create(ai_session_engine, 0)) {
+        engine_started = 1;
+        diag_log(DIAG_INFO, "AI session engine started");
+    }
+}
+
+ai_session_t* ai_session_create(uint32_t ctx_tokens) {
+    if (!ai_transformer_ready()) {
+        return 0;
+    }
+    ai_session_t* s = 0;
+    uint32_t flags = spin_lock_irqsave(&pool_lock);
+    for (uint32_t i = 1; i < AI_SESSION_MAX; ++i) {
+        if (sessions[i].state == AI_SESSION_FREE) {
+            s = &sessions[i];
+            // Claimed but not yet visible to the engine.
+            s->state = AI_SESSION_IDLE;
+            s->id = i;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&pool_lock, flags);
+    if (!s) {
+        return 0;
+    }
+    if (!session_open(s, ctx_tokens)) {
+        s->state = AI_SESSION_FREE;
+        return 0;
+    }
+    return s;
+}
+
+// Frees a session's cache and slot. The caller holds the step lock.
+static void session_release(ai_session_t* s) {
+    session_set_state(s, AI_SESSION_IDLE);
+    ai_kv_cache_destroy(&s->kv);
+    s->ring = &s->out;
+    s->owner = 0;
+    s->orphaned = 0;
+    __sync_synchronize();
+    s->state = AI_SESSION_FREE;
+}
+
+void ai_session_destroy(ai_session_t* s) {
+    if (!s || s == &sessions[0] || s->state == AI_SESSION_FREE) {
+        return;
+    }
+    step_lock_wait();
+    session_release(s);
+    step_unlock();
+}
+
+ai_session_t* ai_session_get(uint32_t id) {
+    if (id >= AI_SESSION_MAX || sessions[id].state == AI_SESSION_FREE) {
+        return 0;
+    }
+    return &sessions[id];
+}
+
+void ai_session_destroy_owned(uint32_t owner) {
+    if (owner == 0) {
+        return;
+    }
+    // Only marked here: the caller may be in the tick, where waiting for
+    // the step lock is not possible. The next step frees them.
+    for (uint32_t i = 1; i < AI_SESSION_MAX; ++i) {
+        if (sessions[i].state != AI_SESSION_FREE && sessions[i].owner == owner) {
+            sessions[i].orphaned = 1;
+        }
+    }
+}
+
+int ai_session_attach_ring(ai_session_t* s, ai_token_ring_t* ring) {
+    if (!s || s->state != AI_SESSION_IDLE) {
+        return 0;
+    }
+    if (ring) {
+        // Shared pages are reused across owners; clear what the last one saw.
+        memset(ring, 0, sizeof(*ring));
+    }
+    s->ring = ring ? ring : &s->out;
+    ring_reset(s);
+    return 1;
+}
+
+int ai_session_reset(ai_session_t* s) {
+    if (!s || s->state != AI_SESSION_IDLE) {
+        return 0;
+    }
+    ai_kv_cache_reset(&s->kv);
+    ai_sampler_reset(&s->sampler);
+    s->flush = 0;
+    ring_reset(s);
+    return 1;
+}
+
+int ai_session_busy(const ai_session_t* s) {
+    return s && (s->state == AI_SESSION_PREFILL || s->state == AI_SESSION_DECODE);
+}
+
+int ai_session_submit(ai_session_t* s, const char* prompt, uint32_t max_tokens) {
+    const ai_model_config_t* config = ai_transformer_config();
+    if (!s || !prompt || !config || s->state != AI_SESSION_IDLE || max_tokens == 0) {
+        return 0;
+    }
+    // Prompts extend the cached conversation; only a fresh one gets BOS.
+    uint32_t count = 0;
+    if (s->kv.n_past == 0 && config->bos_token < config->n_vocab) {
+        s->prompt[count++] = config->bos_token;
+    }
+    count += tokenizer_encode(prompt, s->prompt + count, AI_SESSION_PROMPT_MAX - count);
+    if (count == 0) {
+        return 0;
+    }
+    if (s->kv.mode == AI_KV_LINEAR) {
+        uint32_t room = s->kv.capacity - s->kv.n_past;
+        if (count >= room) {
+            return 0;
+        }
+        if (count + max_tokens > room) {
+            max_tokens = room - count;
+        }
+    }
+    s->prompt_len = count;
+    s->prompt_pos = 0;
+    s->prompt_cacheable = s->kv.n_past == 0;
+    if (s->prompt_cacheable) {
+        // Resume from a cached prefix, keeping one token to produce logits.
+        s->prompt_pos = ai_prefix_cache_restore(&s->kv, s->prompt, count - 1);
+        for (uint32_t i = 0; i < s->prompt_pos; ++i) {
+            ai_sampler_accept(&s->sampler, s->prompt[i]);
+        }
+    }
+    s->remaining = max_tokens;
+    s->flush = 0;
+    __sync_synchronize();
+    session_set_state(s, AI_SESSION_PREFILL);
+    return 1;
+}
+
+uint32_t ai_session_read(ai_session_t* s, uint32_t* tokens, uint32_t max) {
+    if (!s || !tokens) {
+        return 0;
+    }
+    ai_token_ring_t* ring = s->ring;
+    uint32_t n = 0;
+    while (n < max && ring->tail != ring->head) {
+        tokens[n++] = ring->tokens[ring->tail % AI_SESSION_OUT];
+        __sync_synchronize();
+        ring->tail++;
+    }
+    return n;
+}
+
+static int session_has_room(const ai_session_t* s) {
+    return s->ring->head - s->ring->tail < AI_SESSION_OUT;
+}
+
+// Feeds the sampled token back unless the session is finished.
+static void session_emit(ai_session_t* s, uint32_t token, uint32_t eos) {
+    if (token == eos) {
+        session_set_state(s, AI_SESSION_IDLE);
+        return;
+    }
+    ai_token_ring_t* ring = s->ring;
+    ring->tokens[ring->head % AI_SESSION_OUT] = token;
+    __sync_synchronize();
+    ring->head++;
+    s->next_token = token;
+    s->remaining--;
+    // Even the last token goes through the model, in a flush row.
+    s->flush = s->remaining == 0;
+    session_set_state(s, AI_SESSION_DECODE);
+}
+
+uint32_t ai_session_step(void) {
+    const ai_model_config_t* config = ai_transformer_config();
+    if (!config || !step_trylock()) {
+        return 0;
+    }
+    for (uint32_t i = 1; i < AI_SESSION_MAX; ++i) {
+        if (sessions[i].state != AI_SESSION_FREE && sessions[i].orphaned) {
+            session_release(&sessions[i]);
+        }
+    }
+    ai_batch_row_t rows[AI_PREFILL_BATCH];
+    uint32_t max_rows = ai_transformer_batch_rows();
+    uint32_t max_out = ai_transformer_batch_outputs();
+    uint32_t n = 0;
+    uint32_t outputs = 0;
+    // Decode first, one row per session, so a long prompt never stalls
+    // sessions that are already generating.
+    for (uint32_t i = 0; i < AI_SESSION_MAX && n < max_rows && outputs < max_out; ++i) {
+        ai_session_t* s = &sessions[i];
+        // A flush row emits nothing, so it needs no ring space.
+        if (s->state != AI_SESSION_DECODE || (!s->flush && !session_has_room(s))) {
+            continue;
+        }
+        rows[n].session = s;
+        rows[n].token = s->next_token;
+        rows[n].want_logits = !s->flush;
+        n++;
+        outputs += !s->flush;
+    }
+    // Prompt chunks fill the rest of the batch.
+    for (uint32_t i = 0; i < AI_SESSION_MAX && n < max_rows; ++i) {
+        ai_session_t* s = &sessions[i];
+        if (s->state != AI_SESSION_PREFILL || !session_has_room(s)) {
+            continue;
+        }
+        uint32_t take = s->prompt_len - s->prompt_pos;
+        if (take > max_rows - n) {
+            take = max_rows - n;
+        }
+        int finishes = s->prompt_pos + take == s->prompt_len;
+        if (finishes && outputs == max_out) {
+            // No logits slot left: stop one short and finish next step.
+            finishes = 0;
+            take--;
+        }
+        for (uint32_t t = 0; t < take; ++t) {
+            rows[n].session = s;
+            rows[n].token = s->prompt[s->prompt_pos + t];
+            rows[n].want_logits = finishes && t + 1 == take;
+            n++;
+        }
+        if (finishes) {
+            outputs++;
+        }
+    }
+    if (n == 0) {
+        step_unlock();
+        return 0;
+    }
+
+    if (!ai_transformer_batch(rows, n)) {
+        diag_log(DIAG_ERROR, "ai session step failed");
+        for (uint32_t t = 0; t < n; ++t) {
+            session_set_state(rows[t].session, AI_SESSION_IDLE);
+        }
+        step_unlock();
+        return 0;
+    }
+    for (uint32_t t = 0; t < n; ++t) {
+        ai_session_t* s = rows[t].session;
+        ai_sampler_accept(&s->sampler, rows[t].token);
+        if (s->state == AI_SESSION_PREFILL) {
+            s->prompt_pos++;
+        }
+        if (s->state == AI_SESSION_DECODE && s->flush) {
+            s->flush = 0;
+            session_set_state(s, AI_SESSION_IDLE);
+            continue;
+        }
+        if (rows[t].logits) {
+            if (s->prompt_cacheable) {
+                ai_prefix_cache_store(&s->kv, s->prompt, s->prompt_len);
+                s->prompt_cacheable = 0;
+            }
+            uint32_t next = ai_sampler_sample(&s->sampler, rows[t].logits, config->n_vocab);
+            session_emit(s, next, config->eos_token);
+        }
+    }
+    step_unlock();
+    return n;
+}
+
+void ai_session_lock(void) {
+    step_lock_wait();
+}
+
+void ai_session_unlock(void) {
+    step_unlock();
+}
+
+uint32_t ai_session_generate(ai_session_t* s, const char* prompt, uint32_t max_tokens) {
+    if (!ai_session_submit(s, prompt, max_tokens)) {
+        return 0;
+    }
+    uint32_t generated = 0;
+    uint32_t tokens[16];
+    for (;;) {
+        int busy = ai_session_busy(s);
+        uint32_t got = ai_session_read(s, tokens, 16);
+        for (uint32_t i = 0; i < got; ++i) {
+            ai_stream_token(tokens[i]);
+        }
+        generated += got;
+        if (!busy && got == 0) {
+            break;
+        }
+        // Drive the step ourselves; if the engine thread holds it, our
+        // rows are in its batch and we only need to wait.
+        if (busy && !ai_session_step()) {
+            scheduler_yield();
+        }
+    }
+    return generated;
+}
@@ -0,0 +1,530 @@
+#include "ai/ai_tokenizer.h"
+#include "ai/ai_arena.h"
+#include "ai/ai_model.h"
+#include "ai/gguf.h"
+#include "diag.h"
+#include "drivers/serial.h"
+#include "types.h"
+#include "util.h"
+
+// Token strings point straight into the mapped GGUF blob; nothing is copied.
+typedef struct {
+    const uint8_t* text;
+    uint32_t len;
+} vocab_entry_t;
+
+// Merge-rank hash: (left, right) -> merged token. rank is stored +1 so a
+// zeroed arena slot reads as empty.
+typedef struct {
+    uint32_t left;
+    uint32_t right;
+    uint32_t rank;
+    uint32_t result;
+} merge_entry_t;
+
+enum {
+    CHAR_SPACE = 0,
+    CHAR_LETTER = 1,
+    CHAR_DIGIT = 2,
+    CHAR_OTHER = 3
+};
+
+static uint32_t tokenizer_mode = AI_TOKENIZER_BYTES;
+static vocab_entry_t* vocab = 0;
+static int32_t* vocab_scores = 0;
+static uint32_t vocab_size = 0;
+static uint32_t* vocab_index = 0;
+static uint32_t vocab_mask = 0;
+static merge_entry_t* merges = 0;
+static uint32_t merge_mask = 0;
+static uint32_t byte_token[256];
+
+// GPT-2 byte-level BPE spells every byte as a printable code point below 324.
+#define BPE_CODEPOINTS 324u
+static uint8_t byte_utf8[256][2];
+static uint8_t byte_utf8_len[256];
+static int16_t codepoint_byte[BPE_CODEPOINTS];
+
+static uint32_t fnv1a(const uint8_t* data, uint32_t len) {
+    uint32_t h = 2166136261u;
+    for (uint32_t i = 0; i < len; ++i) {
+        h ^= data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint32_t pair_hash(uint32_t left, uint32_t right) {
+    uint32_t h = left * 0x9E3779B1u;
+    h ^= right + 0x7F4A7C15u + (h << 6) + (h >> 2);
+    return h;
+}
+
+static uint32_t table_slots(uint32_t count) {
+    uint32_t slots = 16;
+    while (slots < count * 2) {
+        slots <<= 1;
+    }
+    return slots;
+}
+
+// Sortable integer image of an f32 score (larger float -> larger int).
+static int32_t score_key(uint32_t bits) {
+    int32_t s = (int32_t)bits;
+    return s < 0 ? (s ^ 0x7FFFFFFF) : s;
+}
+
+static uint32_t char_class(uint8_t c) {
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        return CHAR_SPACE;
+    }
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80) {
+        return CHAR_LETTER;
+    }
+    if (c >= '0' && c <= '9') {
+        return CHAR_DIGIT;
+    }
+    return CHAR_OTHER;
+}
+
+uint32_t ai_tokenizer_lookup(const uint8_t* text, uint32_t len) {
+    if (!vocab_index || !text) {
+        return AI_TOKEN_NONE;
+    }
+    uint32_t slot = fnv1a(text, len) & vocab_mask;
+    while (vocab_index[slot]) {
+        const vocab_entry_t* e = &vocab[vocab_index[slot] - 1];
+        if (e->len == len && memcmp(e->text, text, len) == 0) {
+            return vocab_index[slot] - 1;
+        }
+        slot = (slot + 1) & vocab_mask;
+    }
+    return AI_TOKEN_NONE;
+}
+
+static const merge_entry_t* merge_lookup(uint32_t left, uint32_t right) {
+    uint32_t slot = pair_hash(left, right) & merge_mask;
+    while (merges[slot].rank) {
+        if (merges[slot].left == left && merges[slot].right == right) {
+            return &merges[slot];
+        }
+        slot = (slot + 1) & merge_mask;
+    }
+    return 0;
+}
+
+static void byte_map_init(void) {
+    for (uint32_t cp = 0; cp < BPE_CODEPOINTS; ++cp) {
+        codepoint_byte[cp] = -1;
+    }
+    uint32_t next = 256;
+    for (uint32_t b = 0; b < 256; ++b) {
+        uint32_t cp = b;
+        if (!((b >= 33 && b <= 126) || (b >= 161 && b <= 172) || b >= 174)) {
+            cp = next++;
+        }
+        codepoint_byte[cp] = (int16_t)b;
+        if (cp < 0x80) {
+            byte_utf8[b][0] = (uint8_t)cp;
+            byte_utf8_len[b] = 1;
+        } else {
+            byte_utf8[b][0] = (uint8_t)(0xC0u | (cp >> 6));
+            byte_utf8[b][1] = (uint8_t)(0x80u | (cp & 0x3Fu));
+            byte_utf8_len[b] = 2;
+        }
+    }
+}
+
+static int load_vocab(void) {
+    gguf_reader_t r;
+    uint32_t elem_type;
+    uint64_t count;
+    if (!ai_model_kv_array("tokenizer.ggml.tokens", &elem_type, &count, &r) ||
+        elem_type != GGUF_TYPE_STRING || count == 0 || count > 0x1000000u) {
+        return 0;
+    }
+    uint32_t n = (uint32_t)count;
+    uint32_t slots = table_slots(n);
+    vocab = (vocab_entry_t*)ai_arena_alloc(n * sizeof(vocab_entry_t), 16);
+    vocab_index = (uint32_t*)ai_arena_alloc(slots * sizeof(uint32_t), 16);
+    if (!vocab || !vocab_index) {
+        return 0;
+    }
+    vocab_mask = slots - 1;
+    for (uint32_t i = 0; i < n; ++i) {
+        const uint8_t* text;
+        uint64_t len;
+        if (!gguf_read_string(&r, &text, &len)) {
+            return 0;
+        }
+        vocab[i].text = text;
+        vocab[i].len = (uint32_t)len;
+        uint32_t slot = fnv1a(text, (uint32_t)len) & vocab_mask;
+        while (vocab_index[slot]) {
+            slot = (slot + 1) & vocab_mask;
+        }
+        vocab_index[slot] = i + 1;
+    }
+    vocab_size = n;
+
+    if (ai_model_kv_array("tokenizer.ggml.scores", &elem_type, &count, &r) &&
+        elem_type == GGUF_TYPE_FLOAT32 && count == n) {
+        vocab_scores = (int32_t*)ai_arena_alloc(n * sizeof(int32_t), 16);
+        for (uint32_t i = 0; vocab_scores && i < n; ++i) {
+            uint32_t bits;
+            if (!gguf_read_u32(&r, &bits)) {
+                vocab_scores = 0;
+                break;
+            }
+            vocab_scores[i] = score_key(bits);
+        }
+    }
+    return 1;
+}
+
+static int load_merges(void) {
+    gguf_reader_t r;
+    uint32_t elem_type;
+    uint64_t count;
+    if (!ai_model_kv_array("tokenizer.ggml.merges", &elem_type, &count, &r) ||
+        elem_type != GGUF_TYPE_STRING || count == 0 || count > 0x1000000u) {
+        return 0;
+    }
+    uint32_t n = (uint32_t)count;
+    uint32_t slots = table_slots(n);
+    merges = (merge_entry_t*)ai_arena_alloc(slots * sizeof(merge_entry_t), 16);
+    if (!merges) {
+        return 0;
+    }
+    merge_mask = slots - 1;
+    uint8_t joined[256];
+    for (uint32_t i = 0; i < n; ++i) {
+        const uint8_t* text;
+        uint64_t len;
+        if (!gguf_read_string(&r, &text, &len)) {
+            return 0;
+        }
+        uint32_t split = 1;
+        while (split < len && text[split] != ' ') {
+            split++;
+        }
+        if (split + 1 >= len || len - 1 > sizeof(joined)) {
+            continue;
+        }
+        uint32_t left = ai_tokenizer_lookup(text, split);
+        uint32_t right = ai_tokenizer_lookup(text + split + 1, (uint32_t)len - split - 1);
+        if (left == AI_TOKEN_NONE || right == AI_TOKEN_NONE) {
+            continue;
+        }
+        memcpy(joined, text, split);
+        memcpy(joined + split, text + split + 1, (uint32_t)len - split - 1);
+        uint32_t result = ai_tokenizer_lookup(joined, (uint32_t)len - 1);
+        if (result == AI_TOKEN_NONE) {
+            continue;
+        }
+        uint32_t slot = pair_hash(left, right) & merge_mask;
+        while (merges[slot].rank) {
+            if (merges[slot].left == left && merges[slot].right == right) {
+                break;
+            }
+            slot = (slot + 1) & merge_mask;
+        }
+        if (!merges[slot].rank) {
+            merges[slot].left = left;
+            merges[slot].right = right;
+            merges[slot].rank = i + 1;
+            merges[slot].result = result;
+        }
+    }
+    return 1;
+}
+
+static void byte_tokens_init(void) {
+    static const char hex[] = "0123456789ABCDEF";
+    for (uint32_t b = 0; b < 256; ++b) {
+        if (tokenizer_mode == AI_TOKENIZER_BPE) {
+            byte_token[b] = ai_tokenizer_lookup(byte_utf8[b], byte_utf8_len[b]);
+        } else {
+            uint8_t name[6] = { '<', '0', 'x', (uint8_t)hex[b >> 4], (uint8_t)hex[b & 15u], '>' };
+            byte_token[b] = ai_tokenizer_lookup(name, sizeof(name));
+        }
+    }
+}
+
+int ai_tokenizer_init(void) {
+    tokenizer_mode = AI_TOKENIZER_BYTES;
+    if (!load_vocab()) {
+        diag_log(DIAG_WARN, "ai tokenizer: no vocab, byte tokens");
+        return 0;
+    }
+    const uint8_t* model;
+    uint64_t model_len;
+    int is_spm = ai_model_kv_string("tokenizer.ggml.model", &model, &model_len) &&
+                 model_len == 5 && memcmp(model, "llama", 5) == 0;
+    if (!is_spm && load_merges()) {
+        tokenizer_mode = AI_TOKENIZER_BPE;
+    } else if (vocab_scores) {
+        tokenizer_mode = AI_TOKENIZER_SPM;
+    } else {
+        diag_log(DIAG_WARN, "ai tokenizer: no merges or scores, byte tokens");
+        return 0;
+    }
+    byte_map_init();
+    byte_tokens_init();
+    serial_write_string("DEBUG: AI tokenizer vocab ");
+    serial_write_hex32(vocab_size);
+    serial_write_string(tokenizer_mode == AI_TOKENIZER_BPE ? " bpe\n" : " spm\n");
+    return 1;
+}
+
+uint32_t ai_tokenizer_mode(void) {
+    return tokenizer_mode;
+}
+
+uint32_t ai_tokenizer_vocab_size(void) {
+    return tokenizer_mode == AI_TOKENIZER_BYTES ? 256u : vocab_size;
+}
+
+// GPT-2 style pre-tokenizer: contractions, optional leading space + a run of
+// letters, digits or punctuation, and whitespace runs that leave their last
+// space to the next word.
+static uint32_t bpe_word_end(const uint8_t* t, uint32_t len, uint32_t pos) {
+    uint32_t start = pos;
+    if (t[pos] == '\'' && pos + 1 < len) {
+        uint8_t a = t[pos + 1];
+        uint8_t b = pos + 2 < len ? t[pos + 2] : 0;
+        if (a == 's' || a == 't' || a == 'm' || a == 'd') {
+            return pos + 2;
+        }
+        if ((a == 'r' && b == 'e') || (a == 'v' && b == 'e') || (a == 'l' && b == 'l')) {
+            return pos + 3;
+        }
+    }
+    uint32_t cls = char_class(t[pos]);
+    if (t[pos] == ' ' && pos + 1 < len && char_class(t[pos + 1]) != CHAR_SPACE) {
+        pos++;
+        cls = char_class(t[pos]);
+    }
+    while (pos < len && char_class(t[pos]) == cls && pos - start < AI_TOKENIZER_MAX_WORD) {
+        pos++;
+    }
+    if (cls == CHAR_SPACE && pos < len && pos - start > 1 && t[pos - 1] == ' ') {
+        pos--;
+    }
+    return pos;
+}
+
+static uint32_t bpe_word(const uint8_t* word, uint32_t len, uint32_t* out, uint32_t max) {
+    uint32_t ids[AI_TOKENIZER_MAX_WORD];
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < len && n < AI_TOKENIZER_MAX_WORD; ++i) {
+        if (byte_token[word[i]] != AI_TOKEN_NONE) {
+            ids[n++] = byte_token[word[i]];
+        }
+    }
+    while (n > 1) {
+        uint32_t best_rank = 0;
+        uint32_t best = 0;
+        uint32_t result = 0;
+        for (uint32_t i = 0; i + 1 < n; ++i) {
+            const merge_entry_t* m = merge_lookup(ids[i], ids[i + 1]);
+            if (m && (best_rank == 0 || m->rank < best_rank)) {
+                best_rank = m->rank;
+                best = i;
+                result = m->result;
+            }
+        }
+        if (best_rank == 0) {
+            break;
+        }
+        ids[best] = result;
+        for (uint32_t i = best + 1; i + 1 < n; ++i) {
+            ids[i] = ids[i + 1];
+        }
+        n--;
+    }
+    uint32_t count = n < max ? n : max;
+    memcpy(out, ids, count * sizeof(uint32_t));
+    return count;
+}
+
+// SentencePiece: merge the adjacent pair whose concatenation has the best
+// score, then fall back to <0xXX> byte tokens for anything left unknown.
+static uint32_t spm_segment(const uint8_t* seg, uint32_t len, uint32_t* out, uint32_t max) {
+    uint16_t start[AI_TOKENIZER_MAX_WORD * 2];
+    uint16_t size[AI_TOKENIZER_MAX_WORD * 2];
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < len && n < AI_TOKENIZER_MAX_WORD * 2; ) {
+        uint32_t c = seg[i];
+        uint32_t w = c < 0x80 ? 1 : (c >> 5) == 6 ? 2 : (c >> 4) == 14 ? 3 : (c >> 3) == 30 ? 4 : 1;
+        if (i + w > len) {
+            w = len - i;
+        }
+        start[n] = (uint16_t)i;
+        size[n] = (uint16_t)w;
+        n++;
+        i += w;
+    }
+    while (n > 1) {
+        int32_t best_score = 0;
+        uint32_t best = AI_TOKEN_NONE;
+        for (uint32_t i = 0; i + 1 < n; ++i) {
+            uint32_t id = ai_tokenizer_lookup(seg + start[i], size[i] + size[i + 1]);
+            if (id != AI_TOKEN_NONE && (best == AI_TOKEN_NONE || vocab_scores[id] > best_score)) {
+                best_score = vocab_scores[id];
+                best = i;
+            }
+        }
+        if (best == AI_TOKEN_NONE) {
+            break;
+        }
+        size[best] = (uint16_t)(size[best] + size[best + 1]);
+        for (uint32_t i = best + 1; i + 1 < n; ++i) {
+            start[i] = start[i + 1];
+            size[i] = size[i + 1];
+        }
+        n--;
+    }
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < n && count < max; ++i) {
+        uint32_t id = ai_tokenizer_lookup(seg + start[i], size[i]);
+        if (id != AI_TOKEN_NONE) {
+            out[count++] = id;
+            continue;
+        }
+        for (uint32_t b = 0; b < size[i] && count < max; ++b) {
+            if (byte_token[seg[start[i] + b]] != AI_TOKEN_NONE) {
+                out[count++] = byte_token[seg[start[i] + b]];
+            }
+        }
+    }
+    return count;
+}
+
+uint32_t tokenizer_encode(const char* text, uint32_t* out, uint32_t max) {
+    if (!text || !out || max == 0) {
+        return 0;
+    }
+    const uint8_t* t = (const uint8_t*)text;
+    uint32_t len = strlen(text);
+    uint32_t count = 0;
+    if (tokenizer_mode == AI_TOKENIZER_BPE) {
+        uint32_t pos = 0;
+        while (pos < len && count < max) {
+            uint32_t end = bpe_word_end(t, len, pos);
+            count += bpe_word(t + pos, end - pos, out + count, max - count);
+            pos = end;
+        }
+        return count;
+    }
+    if (tokenizer_mode == AI_TOKENIZER_SPM) {
+        // Spaces become U+2581 and a leading one is implied, as in llama.cpp.
+        // A word longer than seg is cut into chunks; only the first one
+        // carries the marker.
+        uint8_t seg[AI_TOKENIZER_MAX_WORD + 3];
+        uint32_t pos = 0;
+        int word_start = 1;
+        while (pos < len && count < max) {
+            uint32_t n = 0;
+            if (t[pos] == ' ') {
+                pos++;
+                word_start = 1;
+            }
+            if (word_start) {
+                seg[n++] = 0xE2;
+                seg[n++] = 0x96;
+                seg[n++] = 0x81;
+            }
+            uint32_t body = n;
+            while (pos < len && t[pos] != ' ' && n < sizeof(seg)) {
+                seg[n++] = t[pos++];
+            }
+            // Don't cut a UTF-8 sequence between chunks.
+            while (pos < len && (t[pos] & 0xC0) == 0x80 && n > body + 1) {
+                pos--;
+                n--;
+            }
+            word_start = 0;
+            count += spm_segment(seg, n, out + count, max - count);
+        }
+        return count;
+    }
+    while (t[count] && count < max) {
+        out[count] = (uint32_t)t[count];
+        count++;
+    }
+    return count;
+}
+
+static uint32_t hex_value(uint8_t c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return 0;
+}
+
+uint32_t tokenizer_decode(uint32_t token, char* out, uint32_t max) {
+    if (!out || max == 0) {
+        return 0;
+    }
+    if (tokenizer_mode == AI_TOKENIZER_BYTES) {
+        if (token > 255 || max < 2) {
+            out[0] = 0;
+            return 0;
+        }
+        out[0] = (char)token;
+        out[1] = 0;
+        return 1;
+    }
+    uint32_t n = 0;
+    if (token >= vocab_size) {
+        out[0] = 0;
+        return 0;
+    }
+    const uint8_t* text = vocab[token].text;
+    uint32_t len = vocab[token].len;
+    if (tokenizer_mode == AI_TOKENIZER_SPM) {
+        if (len == 6 && text[0] == '<' && text[1] == '0' && text[2] == 'x' && text[5] == '>') {
+            if (max > 1) {
+                out[n++] = (char)((hex_value(text[3]) << 4) | hex_value(text[4]));
+            }
+            out[n] = 0;
+            return n;
+        }
+        for (uint32_t i = 0; i < len && n + 1 < max; ++i) {
+            if (i + 2 < len && text[i] == 0xE2 && text[i + 1] == 0x96 && text[i + 2] == 0x81) {
+                out[n++] = ' ';
+                i += 2;
+            } else {
+                out[n++] = (char)text[i];
+            }
+        }
+        out[n] = 0;
+        return n;
+    }
+    for (uint32_t i = 0; i < len && n + 1 < max; ) {
+        uint32_t c = text[i];
+        uint32_t cp = c;
+        uint32_t w = 1;
+        if ((c & 0xE0u) == 0xC0u && i + 1 < len) {
+            cp = ((c & 0x1Fu) << 6) | (text[i + 1] & 0x3Fu);
+            w = 2;
+        }
+        if (cp < BPE_CODEPOINTS && codepoint_byte[cp] >= 0) {
+            out[n++] = (char)codepoint_byte[cp];
+        } else {
+            for (uint32_t k = 0; k < w && n + 1 < max; ++k) {
+                out[n++] = (char)text[i + k];
+            }
+        }
+        i += w;
+    }
+    out[n] = 0;
+    return n;
+}
@@ -0,0 +1,746 @@
+#include "ai/ai_transformer.h"
+#include "ai/ai_arena.h"
+#include "ai/ai_gemm.h"
+#include "ai/ai_math.h"
+#include "ai/ai_kv_cache.h"
+#include "ai/ai_model.h"
+#include "ai/ai_quant.h"
+#include "ai/ai_sampler.h"
+#include "ai/ai_session.h"
+#include "arch/x86/timer.h"
+#include "diag.h"
+#include "drivers/serial.h"
+#include "fixedpoint.h"
+#include "mem/pmm.h"
+#include "types.h"
+#include "util.h"
+
+// Rows dequantized per ai_matmul_q16_16 call in the matrix-vector path.
+#define AI_MATVEC_ROWS 16u
+// Weight rows dequantized per panel of a batched projection.
+#define AI_PREFILL_PANEL 64u
+// Layer-ahead prefetch: bytes an idle worker touches per layer, one read
+// per cache line. Sized for a shared L3 slice; the rest streams as usual.
+#define AI_PREFETCH_BYTES (2u * 1024u * 1024u)
+#define AI_PREFETCH_LINE 64u
+
+static ai_model_config_t config;
+static ai_layer_weights_t* layers = 0;
+static ai_weight_t tok_embd;
+static ai_weight_t output;
+static q16_16_t* output_norm = 0;
+static int transformer_ready = 0;
+static q16_16_t att_scale = 0;
+
+// Activation scratch, arena-allocated once the model shape is known.
+static q16_16_t* x = 0;
+static q16_16_t* xb = 0;
+static q16_16_t* xb2 = 0;
+static q16_16_t* q = 0;
+static q16_16_t* kb = 0;
+static q16_16_t* vb = 0;
+static q16_16_t* att = 0;
+static q16_16_t* hb = 0;
+static q16_16_t* hb2 = 0;
+static q16_16_t* logits = 0;
+static q16_16_t* row_scratch = 0;
+// The matvec input quantized to int8 when AI_ACT_Q8 is selected.
+static ai_q8_block_t* act_q8 = 0;
+
+// Prefill scratch: one row per prompt token. Null when the arena could not
+// spare it, in which case prompts run token by token.
+static q16_16_t* pf_x = 0;
+static q16_16_t* pf_xb = 0;
+static q16_16_t* pf_q = 0;
+static q16_16_t* pf_k = 0;
+static q16_16_t* pf_v = 0;
+static q16_16_t* pf_hb = 0;
+static q16_16_t* pf_hb2 = 0;
+static q16_16_t* pf_panel = 0;
+// Next-token logits for up to AI_SESSION_MAX rows of a batch.
+static q16_16_t* pf_logits = 0;
+
+static int prefetch_enabled = 1;
+static ai_job_t prefetch_job = { 0, 0, 0, 1 };
+static volatile uint32_t prefetch_sink = 0;
+
+static uint32_t isqrt32(uint32_t v) {
+    uint32_t res = 0;
+    uint32_t one = 1u << 30;
+    while (one > v) {
+        one >>= 2;
+    }
+    while (one != 0) {
+        if (v >= res + one) {
+            v -= res + one;
+            res = (res >> 1) + one;
+        } else {
+            res >>= 1;
+        }
+        one >>= 2;
+    }
+    return res;
+}
+
+static int arch_kv_u32(const char* arch, uint32_t arch_len, const char* suffix, uint32_t* out) {
+    char key[96];
+    uint32_t suffix_len = strlen(suffix);
+    if (arch_len + 1 + suffix_len + 1 > sizeof(key)) {
+        return 0;
+    }
+    memcpy(key, arch, arch_len);
+    key[arch_len] = '.';
+    memcpy(key + arch_len + 1, suffix, suffix_len);
+    key[arch_len + 1 + suffix_len] = 0;
+    return ai_model_kv_u32(key, out);
+}
+
+static int weight_bind(const char* name, ai_weight_t* w) {
+    const ai_tensor_desc_t* desc = ai_tensor_lookup(name);
+    if (!desc) {
+        return 0;
+    }
+    w->data = (const uint8_t*)(uint32_t)desc->data_offset;
+    w->type = desc->type;
+    w->cols = (uint32_t)desc->dims[0];
+    w->rows = (uint32_t)(desc->dims[1] * desc->dims[2] * desc->dims[3]);
+    if (desc->type == GGML_TYPE_F32) {
+        w->block_elems = 1;
+        w->block_bytes = 4;
+    } else if (desc->type == GGML_TYPE_F16) {
+        w->block_elems = 1;
+        w->block_bytes = 2;
+    } else {
+        ai_quant_info_t info;
+        if (!ai_quant_info(desc->type, &info)) {
+            diag_log(DIAG_ERROR, "ai weight type unsupported");
+            return 0;
+        }
+        w->block_elems = info.block_elems;
+        w->block_bytes = info.block_bytes;
+    }
+    if (w->cols == 0 || (w->cols % w->block_elems) != 0) {
+        diag_log(DIAG_ERROR, "ai weight row not block aligned");
+        return 0;
+    }
+    w->row_bytes = (w->cols / w->block_elems) * w->block_bytes;
+    return 1;
+}
+
+static int weight_bind_layer(uint32_t layer, const char* suffix, ai_weight_t* w) {
+    char name[64];
+    uint32_t pos = 0;
+    const char* prefix = "blk.";
+    while (*prefix) {
+        name[pos++] = *prefix++;
+    }
+    char digits[10];
+    uint32_t n = 0;
+    do {
+        digits[n++] = (char)('0' + (layer % 10));
+        layer /= 10;
+    } while (layer && n < sizeof(digits));
+    while (n) {
+        name[pos++] = digits[--n];
+    }
+    name[pos++] = '.';
+    uint32_t len = strlen(suffix);
+    if (pos + len + 1 > sizeof(name)) {
+        return 0;
+    }
+    memcpy(name + pos, suffix, len + 1);
+    return weight_bind(name, w);
+}
+
+// Norm vectors are tiny and read every token, so they are expanded to q16.16 once.
+static q16_16_t* norm_load(const ai_weight_t* w, uint32_t n) {
+    if (w->cols != n || w->rows != 1) {
+        return 0;
+    }
+    q16_16_t* out = (q16_16_t*)ai_arena_alloc(n * sizeof(q16_16_t), 16);
+    if (out) {
+        ai_weight_row_q16(w, 0, out);
+    }
+    return out;
+}
+
+void ai_weight_row_q16(const ai_weight_t* w, uint32_t row, q16_16_t* out) {
+    const uint8_t* src = w->data + row * w->row_bytes;
+    uint32_t done = 0;
+    while (done < w->cols) {
+        uint32_t got = ai_quant_read_q16(w->type, src, out + done, w->cols - done);
+        if (got == 0) {
+            memset(out + done, 0, (w->cols - done) * sizeof(q16_16_t));
+            return;
+        }
+        done += got;
+        src += w->block_bytes;
+    }
+}
+
+typedef struct {
+    const ai_weight_t* w;
+    const q16_16_t* x;
+    const ai_q8_block_t* xq;
+    q16_16_t* y;
+} matvec_task_t;
+
+static void matvec_rows(void* arg, uint32_t start, uint32_t end) {
+    matvec_task_t* task = (matvec_task_t*)arg;
+    const ai_weight_t* w = task->w;
+    if (task->xq) {
+        ai_quant_matvec_q8(w->type, w->data + start * w->row_bytes, w->row_bytes,
+                           task->xq, task->y + start, end - start, w->cols);
+        return;
+    }
+    ai_quant_matvec_q16(w->type, w->data + start * w->row_bytes, w->row_bytes,
+                        task->x, task->y + start, end - start, w->cols);
+}
+
+void ai_weight_matvec(const ai_weight_t* w, const q16_16_t* xv, q16_16_t* y) {
+    if (ai_quant_dot_supported(w->type)) {
+        matvec_task_t task;
+        task.w = w;
+        task.x = xv;
+        task.xq = 0;
+        task.y = y;
+        // The input is quantized once here; every worker reads the blocks.
+        if (ai_quant_act_mode() == AI_ACT_Q8 && act_q8 && ai_quant_q8_supported(w->type) &&
+            w->cols % AI_Q8_BLOCK == 0) {
+            ai_quant_x_q8(xv, act_q8, w->cols);
+            task.xq = act_q8;
+        }
+        ai_scheduler_run_rows(w->rows, AI_MATVEC_ROWS, matvec_rows, &task);
+        return;
+    }
+    // Float and legacy block types still go through a dequantized row block.
+    for (uint32_t r = 0; r < w->rows; r += AI_MATVEC_ROWS) {
+        uint32_t count = w->rows - r;
+        if (count > AI_MATVEC_ROWS) {
+            count = AI_MATVEC_ROWS;
+        }
+        for (uint32_t i = 0; i < count; ++i) {
+            ai_weight_row_q16(w, r + i, row_scratch + i * w->cols);
+        }
+        ai_matmul_q16_16(row_scratch, xv, y + r, count, 1, w->cols);
+    }
+}
+
+typedef struct {
+    const ai_weight_t* w;
+    uint32_t r0;
+} panel_task_t;
+
+static void panel_rows(void* arg, uint32_t start, uint32_t end) {
+    panel_task_t* task = (panel_task_t*)arg;
+    for (uint32_t r = start; r < end; ++r) {
+        ai_weight_row_q16(task->w, task->r0 + r, pf_panel + r * task->w->cols);
+    }
+}
+
+// ys[t][r] = W[r] . xs[t] for n tokens. Each panel of weight rows is
+// dequantized once and reused by every token in the batch; the panel is
+// already in the packed-B layout the GEMM engine wants.
+static void weight_matmul(const ai_weight_t* w, const q16_16_t* xs, q16_16_t* ys, uint32_t n) {
+    for (uint32_t r0 = 0; r0 < w->rows; r0 += AI_PREFILL_PANEL) {
+        uint32_t count = w->rows - r0;
+        if (count > AI_PREFILL_PANEL) {
+            count = AI_PREFILL_PANEL;
+        }
+        panel_task_t task;
+        task.w = w;
+        task.r0 = r0;
+        ai_scheduler_run_rows(count, 4, panel_rows, &task);
+        ai_gemm_q16_ldc(xs, pf_panel, ys + r0, w->rows, n, count, w->cols);
+    }
+}
+
+static uint32_t prefetch_weight(const ai_weight_t* w, uint32_t budget) {
+    uint32_t bytes = w->rows * w->row_bytes;
+    if (bytes > budget) {
+        bytes = budget;
+    }
+    const volatile uint8_t* p = (const volatile uint8_t*)w->data;
+    uint32_t sum = 0;
+    for (uint32_t off = 0; off < bytes; off += AI_PREFETCH_LINE) {
+        sum += p[off];
+    }
+    prefetch_sink += sum;
+    return budget - bytes;
+}
+
+// Runs on an idle worker: pulls a layer's tensors into the shared cache in
+// the order the forward pass reads them, until the budget runs out.
+static void prefetch_layer(void* arg) {
+    const ai_layer_weights_t* lw = (const ai_layer_weights_t*)arg;
+    uint32_t budget = AI_PREFETCH_BYTES;
+    budget = prefetch_weight(&lw->wq, budget);
+    budget = prefetch_weight(&lw->wk, budget);
+    budget = prefetch_weight(&lw->wv, budget);
+    budget = prefetch_weight(&lw->wo, budget);
+    budget = prefetch_weight(&lw->w_gate, budget);
+    budget = prefetch_weight(&lw->w_up, budget);
+    prefetch_weight(&lw->w_down, budget);
+}
+
+// Called as layer `layer` starts: warms the one after it (layer 0 for the
+// next token after the last). Skipped while the previous prefetch runs.
+static void prefetch_next(uint32_t layer) {
+    if (!prefetch_enabled || !prefetch_job.completed) {
+        return;
+    }
+    uint32_t next = layer + 1 < config.n_layer ? layer + 1 : 0;
+    prefetch_job.func = prefetch_layer;
+    prefetch_job.arg = &layers[next];
+    ai_scheduler_submit_background(&prefetch_job);
+}
+
+static void vec_mul(q16_16_t* dst, const q16_16_t* w, uint32_t n) {
+    for (uint32_t i = 0; i < n; ++i) {
+        dst[i] = q16_mul(dst[i], w[i]);
+    }
+}
+
+static void vec_add(q16_16_t* dst, const q16_16_t* src, uint32_t n) {
+    for (uint32_t i = 0; i < n; ++i) {
+        dst[i] = q16_add(dst[i], src[i]);
+    }
+}
+
+int ai_transformer_init(void) {
+    transformer_ready = 0;
+    const uint8_t* arch;
+    uint64_t arch_len;
+    if (!ai_model_kv_string("general.architecture", &arch, &arch_len) || arch_len > 32) {
+        diag_log(DIAG_WARN, "ai model architecture missing");
+        return 0;
+    }
+    const char* a = (const char*)arch;
+    uint32_t alen = (uint32_t)arch_len;
+    memset(&config, 0, sizeof(config));
+    if (!arch_kv_u32(a, alen, "embedding_length", &config.n_embd) ||
+        !arch_kv_u32(a, alen, "block_count", &config.n_layer) ||
+        !arch_kv_u32(a, alen, "attention.head_count", &config.n_head) ||
+        !arch_kv_u32(a, alen, "feed_forward_length", &config.n_ff)) {
+        diag_log(DIAG_ERROR, "ai model hyperparameters missing");
+        return 0;
+    }
+    if (!arch_kv_u32(a, alen, "attention.head_count_kv", &config.n_head_kv)) {
+        config.n_head_kv = config.n_head;
+    }
+    if (!arch_kv_u32(a, alen, "context_length", &config.n_ctx)) {
+        config.n_ctx = AI_CTX_MAX;
+    }
+    uint32_t base_bits = 0;
+    char key[64];
+    memcpy(key, a, alen);
+    memcpy(key + alen, ".rope.freq_base", 16);
+    config.rope_freq_base = 10000;
+    if (ai_model_kv_f32_bits(key, &base_bits)) {
+        // Positive float to integer: the bases in use are whole numbers.
+        int32_t exp = (int32_t)((base_bits >> 23) & 0xFF) - 127;
+        uint32_t mant = (base_bits & 0x7FFFFF) | 0x800000;
+        if (exp >= 0 && exp < 31) {
+            config.rope_freq_base = exp >= 23 ? (mant << (exp - 23)) : (mant >> (23 - exp));
+        }
+    }
+    if (!ai_model_kv_u32("tokenizer.ggml.bos_token_id", &config.bos_token)) {
+        config.bos_token = 0xFFFFFFFFu;
+    }
+    if (!ai_model_kv_u32("tokenizer.ggml.eos_token_id", &config.eos_token)) {
+        config.eos_token = 0xFFFFFFFFu;
+    }
+    if (config.n_head == 0 || config.n_head_kv == 0 || (config.n_embd % config.n_head) != 0 ||
+        (config.n_head % config.n_head_kv) != 0) {
+        diag_log(DIAG_ERROR, "ai model head layout invalid");
+        return 0;
+    }
+    config.head_dim = config.n_embd / config.n_head;
+    if (!rope_init(config.head_dim, config.rope_freq_base)) {
+        diag_log_hex32(DIAG_ERROR, "ai rope head size unsupported", config.head_dim);
+        return 0;
+    }
+
+    ai_weight_t norm;
+    if (!weight_bind("token_embd.weight", &tok_embd) || tok_embd.cols != config.n_embd) {
+        diag_log(DIAG_ERROR, "ai token embedding missing");
+        return 0;
+    }
+    config.n_vocab = tok_embd.rows;
+    if (!weight_bind("output.weight", &output)) {
+        output = tok_embd;
+    }
+    if (!weight_bind("output_norm.weight", &norm) || !(output_norm = norm_load(&norm, config.n_embd))) {
+        diag_log(DIAG_ERROR, "ai output norm missing");
+        return 0;
+    }
+
+    layers = (ai_layer_weights_t*)ai_arena_alloc(config.n_layer * sizeof(ai_layer_weights_t), 16);
+    if (!layers) {
+        return 0;
+    }
+    uint32_t kv_dim = config.n_head_kv * config.head_dim;
+    for (uint32_t l = 0; l < config.n_layer; ++l) {
+        ai_layer_weights_t* lw = &layers[l];
+        ai_weight_t attn_norm;
+        ai_weight_t ffn_norm;
+        if (!weight_bind_layer(l, "attn_norm.weight", &attn_norm) ||
+            !weight_bind_layer(l, "ffn_norm.weight", &ffn_norm) ||
+            !weight_bind_layer(l, "attn_q.weight", &lw->wq) ||
+            !weight_bind_layer(l, "attn_k.weight", &lw->wk) ||
+            !weight_bind_layer(l, "attn_v.weight", &lw->wv) ||
+            !weight_bind_layer(l, "attn_output.weight", &lw->wo) ||
+            !weight_bind_layer(l, "ffn_gate.weight", &lw->w_gate) ||
+            !weight_bind_layer(l, "ffn_up.weight", &lw->w_up) ||
+            !weight_bind_layer(l, "ffn_down.weight", &lw->w_down)) {
+            diag_log_hex32(DIAG_ERROR, "ai layer tensors missing", l);
+            return 0;
+        }
+        if (lw->wq.rows != config.n_embd || lw->wk.rows != kv_dim || lw->wv.rows != kv_dim ||
+            lw->wo.cols != config.n_embd || lw->w_gate.rows != config.n_ff ||
+            lw->w_up.rows != config.n_ff || lw->w_down.cols != config.n_ff) {
+            diag_log_hex32(DIAG_ERROR, "ai layer shape mismatch", l);
+            return 0;
+        }
+        lw->attn_norm = norm_load(&attn_norm, config.n_embd);
+        lw->ffn_norm = norm_load(&ffn_norm, config.n_embd);
+        if (!lw->attn_norm || !lw->ffn_norm) {
+            return 0;
+        }
+    }
+
+    uint32_t dim = config.n_embd;
+    uint32_t max_cols = config.n_ff > dim ? config.n_ff : dim;
+    x = (q16_16_t*)ai_arena_alloc(dim * sizeof(q16_16_t), 16);
+    xb = (q16_16_t*)ai_arena_alloc(dim * sizeof(q16_16_t), 16);
+    xb2 = (q16_16_t*)ai_arena_alloc(dim * sizeof(q16_16_t), 16);
+    q = (q16_16_t*)ai_arena_alloc(dim * sizeof(q16_16_t), 16);
+    kb = (q16_16_t*)ai_arena_alloc(kv_dim * sizeof(q16_16_t), 16);
+    vb = (q16_16_t*)ai_arena_alloc(kv_dim * sizeof(q16_16_t), 16);
+    att = (q16_16_t*)ai_arena_alloc(AI_CTX_MAX * sizeof(q16_16_t), 16);
+    hb = (q16_16_t*)ai_arena_alloc(config.n_ff * sizeof(q16_16_t), 16);
+    hb2 = (q16_16_t*)ai_arena_alloc(config.n_ff * sizeof(q16_16_t), 16);
+    logits = (q16_16_t*)ai_arena_alloc(config.n_vocab * sizeof(q16_16_t), 16);
+    row_scratch = (q16_16_t*)ai_arena_alloc(AI_MATVEC_ROWS * max_cols * sizeof(q16_16_t), 16);
+    // Optional: without it the int8 mode stays on the q16.16 kernels.
+    act_q8 = (ai_q8_block_t*)ai_arena_alloc((max_cols / AI_Q8_BLOCK) * sizeof(ai_q8_block_t), 16);
+    if (!x || !xb || !xb2 || !q || !kb || !vb || !att || !hb || !hb2 || !logits || !row_scratch) {
+        diag_log(DIAG_ERROR, "ai scratch alloc failed");
+        return 0;
+    }
+    uint32_t batch = AI_PREFILL_BATCH;
+    pf_x = (q16_16_t*)ai_arena_alloc(batch * dim * sizeof(q16_16_t), 16);
+    pf_xb = (q16_16_t*)ai_arena_alloc(batch * dim * sizeof(q16_16_t), 16);
+    pf_q = (q16_16_t*)ai_arena_alloc(batch * dim * sizeof(q16_16_t), 16);
+    pf_k = (q16_16_t*)ai_arena_alloc(batch * kv_dim * sizeof(q16_16_t), 16);
+    pf_v = (q16_16_t*)ai_arena_alloc(batch * kv_dim * sizeof(q16_16_t), 16);
+    pf_hb = (q16_16_t*)ai_arena_alloc(batch * config.n_ff * sizeof(q16_16_t), 16);
+    pf_hb2 = (q16_16_t*)ai_arena_alloc(batch * config.n_ff * sizeof(q16_16_t), 16);
+    pf_panel = (q16_16_t*)ai_arena_alloc(AI_PREFILL_PANEL * max_cols * sizeof(q16_16_t), 16);
+    pf_logits = (q16_16_t*)ai_arena_alloc(AI_SESSION_MAX * config.n_vocab * sizeof(q16_16_t), 16);
+    if (!pf_x || !pf_xb || !pf_q || !pf_k || !pf_v || !pf_hb || !pf_hb2 || !pf_panel || !pf_logits) {
+        pf_x = 0;
+        diag_log(DIAG_WARN, "ai prefill scratch unavailable");
+    }
+
+    // 1/sqrt(head_dim) in q16.16: 2^24 / sqrt(head_dim * 2^16).
+    att_scale = (q16_16_t)((1u << 24) / isqrt32(config.head_dim << 16));
+    if (!rope_precompute(config.n_ctx < AI_CTX_MAX ? config.n_ctx : AI_CTX_MAX)) {
+        diag_log(DIAG_WARN, "ai rope table unavailable");
+    }
+
+    serial_write_string("DEBUG: AI transformer layers ");
+    serial_write_hex32(config.n_layer);
+    serial_write_string(" dim ");
+    serial_write_hex32(config.n_embd);
+    serial_write_string(" vocab ");
+    serial_write_hex32(config.n_vocab);
+    serial_write_string("\n");
+    transformer_ready = 1;
+    if (!ai_session_init()) {
+        transformer_ready = 0;
+        return 0;
+    }
+    return 1;
+}
+
+int ai_transformer_ready(void) {
+    return transformer_ready;
+}
+
+const ai_model_config_t* ai_transformer_config(void) {
+    return transformer_ready ? &config : 0;
+}
+
+void ai_transformer_reset(void) {
+    ai_session_reset(ai_session_console());
+}
+
+ai_sampler_t* ai_transformer_sampler(void) {
+    return &ai_session_console()->sampler;
+}
+
+void ai_transformer_set_prefetch(int enabled) {
+    prefetch_enabled = enabled ? 1 : 0;
+}
+
+int ai_transformer_prefetch(void) {
+    return prefetch_enabled;
+}
+
+uint32_t ai_transformer_position(void) {
+    return ai_session_console()->kv.n_past;
+}
+
+uint32_t ai_transformer_batch_rows(void) {
+    return pf_x ? AI_PREFILL_BATCH : 1u;
+}
+
+uint32_t ai_transformer_batch_outputs(void) {
+    return pf_x ? AI_SESSION_MAX : 1u;
+}
+
+static void attention(const ai_kv_cache_t* kv, uint32_t layer, uint32_t pos,
+                      const q16_16_t* qv, q16_16_t* out) {
+    uint32_t hd = config.head_dim;
+    uint32_t group = config.n_head / config.n_head_kv;
+    uint32_t valid = ai_kv_cache_valid(kv, pos);
+    for (uint32_t h = 0; h < config.n_head; ++h) {
+        const q16_16_t* qh = qv + h * hd;
+        const q16_16_t* keys = ai_kv_cache_k_head(kv, layer, h / group);
+        const q16_16_t* vals = ai_kv_cache_v_head(kv, layer, h / group);
+        for (uint32_t s = 0; s < valid; ++s) {
+            att[s] = q16_mul(dot_product(qh, keys + s * hd, hd), att_scale);
+        }
+        softmax(att, valid);
+        q16_16_t* oh = out + h * hd;
+        memset(oh, 0, hd * sizeof(q16_16_t));
+        for (uint32_t s = 0; s < valid; ++s) {
+            const q16_16_t* vt = vals + s * hd;
+            q16_16_t a = att[s];
+            for (uint32_t i = 0; i < hd; ++i) {
+                oh[i] = q16_add(oh[i], q16_mul(a, vt[i]));
+            }
+        }
+    }
+}
+
+// Single-token decode with the fused matvec kernels.
+static int forward_one(ai_kv_cache_t* kv, uint32_t token, q16_16_t* out_logits) {
+    if (token >= config.n_vocab || !ai_kv_cache_can_append(kv)) {
+        return 0;
+    }
+    uint32_t dim = config.n_embd;
+    uint32_t hd = config.head_dim;
+    uint32_t kv_dim = config.n_head_kv * hd;
+    uint32_t pos = kv->n_past;
+
+    ai_weight_row_q16(&tok_embd, token, x);
+    for (uint32_t l = 0; l < config.n_layer; ++l) {
+        const ai_layer_weights_t* lw = &layers[l];
+        prefetch_next(l);
+        memcpy(xb, x, dim * sizeof(q16_16_t));
+        rmsnorm(xb, dim);
+        vec_mul(xb, lw->attn_norm, dim);
+        ai_weight_matvec(&lw->wq, xb, q);
+        ai_weight_matvec(&lw->wk, xb, kb);
+        ai_weight_matvec(&lw->wv, xb, vb);
+        rope_apply(q, dim, hd, pos);
+        rope_apply(kb, kv_dim, hd, pos);
+        ai_kv_cache_store(kv, l, pos, kb, vb);
+
+        attention(kv, l, pos, q, xb2);
+        ai_weight_matvec(&lw->wo, xb2, xb);
+        vec_add(x, xb, dim);
+
+        memcpy(xb, x, dim * sizeof(q16_16_t));
+        rmsnorm(xb, dim);
+        vec_mul(xb, lw->ffn_norm, dim);
+        ai_weight_matvec(&lw->w_gate, xb, hb);
+        ai_weight_matvec(&lw->w_up, xb, hb2);
+        ai_silu_mul_q16(hb, hb2, config.n_ff);
+        ai_weight_matvec(&lw->w_down, hb, xb);
+        vec_add(x, xb, dim);
+    }
+    rmsnorm(x, dim);
+    vec_mul(x, output_norm, dim);
+    ai_weight_matvec(&output, x, out_logits);
+    kv->n_past++;
+    return 1;
+}
+
+// Both direct entry points share the scratch buffers and the console cache
+// with the session engine, so they hold its step lock and leave a console
+// that is generating alone.
+int ai_transformer_forward(uint32_t token, q16_16_t* out_logits) {
+    if (!transformer_ready) {
+        return 0;
+    }
+    ai_session_lock();
+    ai_session_t* s = ai_session_console();
+    int ok = !ai_session_busy(s) && forward_one(&s->kv, token, out_logits ? out_logits : logits);
+    ai_session_unlock();
+    return ok;
+}
+
+// Every projection is one GEMM over the batch. RoPE, the KV store and
+// attention run per row against that row's own session cache. A row attends
+// right after its own K/V is stored, so it only sees earlier positions of
+// its session (the causal mask), and a sliding ring never drops a slot a
+// later row still needs.
+int ai_transformer_batch(ai_batch_row_t* rows, uint32_t n) {
+    if (!transformer_ready || !rows || n == 0 || n > ai_transformer_batch_rows()) {
+        return 0;
+    }
+    if (n == 1) {
+        rows[0].logits = logits;
+        return forward_one(&rows[0].session->kv, rows[0].token, logits);
+    }
+    uint32_t dim = config.n_embd;
+    uint32_t hd = config.head_dim;
+    uint32_t kv_dim = config.n_head_kv * hd;
+    uint32_t ff = config.n_ff;
+    uint32_t pos[AI_PREFILL_BATCH];
+    uint32_t outputs = 0;
+    for (uint32_t t = 0; t < n; ++t) {
+        ai_kv_cache_t* kv = &rows[t].session->kv;
+        uint32_t ahead = 0;
+        for (uint32_t u = 0; u < t; ++u) {
+            if (rows[u].session == rows[t].session) {
+                ahead++;
+            }
+        }
+        pos[t] = kv->n_past + ahead;
+        if (rows[t].token >= config.n_vocab ||
+            (kv->mode == AI_KV_LINEAR && pos[t] >= kv->capacity)) {
+            return 0;
+        }
+        if (rows[t].want_logits && ++outputs > AI_SESSION_MAX) {
+            return 0;
+        }
+        ai_weight_row_q16(&tok_embd, rows[t].token, pf_x + t * dim);
+    }
+    for (uint32_t l = 0; l < config.n_layer; ++l) {
+        const ai_layer_weights_t* lw = &layers[l];
+        prefetch_next(l);
+        memcpy(pf_xb, pf_x, n * dim * sizeof(q16_16_t));
+        for (uint32_t t = 0; t < n; ++t) {
+            rmsnorm(pf_xb + t * dim, dim);
+            vec_mul(pf_xb + t * dim, lw->attn_norm, dim);
+        }
+        weight_matmul(&lw->wq, pf_xb, pf_q, n);
+        weight_matmul(&lw->wk, pf_xb, pf_k, n);
+        weight_matmul(&lw->wv, pf_xb, pf_v, n);
+        for (uint32_t t = 0; t < n; ++t) {
+            ai_kv_cache_t* kv = &rows[t].session->kv;
+            q16_16_t* qt = pf_q + t * dim;
+            q16_16_t* kt = pf_k + t * kv_dim;
+            rope_apply(qt, dim, hd, pos[t]);
+            rope_apply(kt, kv_dim, hd, pos[t]);
+            ai_kv_cache_store(kv, l, pos[t], kt, pf_v + t * kv_dim);
+            attention(kv, l, pos[t], qt, pf_xb + t * dim);
+        }
+        weight_matmul(&lw->wo, pf_xb, pf_q, n);
+        vec_add(pf_x, pf_q, n * dim);
+
+        memcpy(pf_xb, pf_x, n * dim * sizeof(q16_16_t));
+        for (uint32_t t = 0; t < n; ++t) {
+            rmsnorm(pf_xb + t * dim, dim);
+            vec_mul(pf_xb + t * dim, lw->ffn_norm, dim);
+        }
+        weight_matmul(&lw->w_gate, pf_xb, pf_hb, n);
+        weight_matmul(&lw->w_up, pf_xb, pf_hb2, n);
+        ai_silu_mul_q16(pf_hb, pf_hb2, n * ff);
+        weight_matmul(&lw->w_down, pf_hb, pf_xb, n);
+        vec_add(pf_x, pf_xb, n * dim);
+    }
+    for (uint32_t t = 0; t < n; ++t) {
+        rows[t].session->kv.n_past++;
+    }
+
+    // Only rows that pick a token go through the LM head: one fused matvec
+    // for a single row, one GEMM when several sessions decode together.
+    uint32_t j = 0;
+    for (uint32_t t = 0; t < n; ++t) {
+        rows[t].logits = 0;
+        if (rows[t].want_logits) {
+            q16_16_t* row = pf_xb + j * dim;
+            memcpy(row, pf_x + t * dim, dim * sizeof(q16_16_t));
+            rmsnorm(row, dim);
+            vec_mul(row, output_norm, dim);
+            rows[t].logits = pf_logits + j * config.n_vocab;
+            j++;
+        }
+    }
+    if (j == 1) {
+        ai_weight_matvec(&output, pf_xb, pf_logits);
+    } else if (j > 1) {
+        weight_matmul(&output, pf_xb, pf_logits, j);
+    }
+    return 1;
+}
+
+// Single-caller entry point on the console session, under the step lock.
+int transformer_step(const uint32_t* input, uint32_t input_len, uint32_t* output_token) {
+    if (!input || !output_token || input_len == 0 || !transformer_ready) {
+        return 0;
+    }
+    ai_session_lock();
+    ai_session_t* s = ai_session_console();
+    if (ai_session_busy(s)) {
+        ai_session_unlock();
+        return 0;
+    }
+    ai_batch_row_t rows[AI_PREFILL_BATCH];
+    uint32_t max_rows = ai_transformer_batch_rows();
+    q16_16_t* last = 0;
+    for (uint32_t i = 0; i < input_len;) {
+        uint32_t n = input_len - i;
+        if (n > max_rows) {
+            n = max_rows;
+        }
+        for (uint32_t t = 0; t < n; ++t) {
+            rows[t].session = s;
+            rows[t].token = input[i + t];
+            rows[t].want_logits = i + t + 1 == input_len;
+            ai_sampler_accept(&s->sampler, input[i + t]);
+        }
+        if (!ai_transformer_batch(rows, n)) {
+            ai_session_unlock();
+            return 0;
+        }
+        last = rows[n - 1].logits;
+        i += n;
+    }
+    *output_token = ai_sampler_sample(&s->sampler, last, config.n_vocab);
+    ai_session_unlock();
+    return 1;
+}
+
+uint32_t ai_transformer_generate(const char* prompt, uint32_t max_tokens, uint64_t* ticks_out) {
+    if (ticks_out) {
+        *ticks_out = 0;
+    }
+    if (!transformer_ready || !prompt) {
+        return 0;
+    }
+    uint64_t start = timer_get_ticks();
+    uint32_t generated = ai_session_generate(ai_session_console(), prompt, max_tokens);
+    if (ticks_out) {
+        *ticks_out = timer_get_ticks() - start;
+    }
+    return generated;
+}
+
+void ai_transformer_fill_context(ai_context_t* context) {
+    if (!context) {
+        return;
+    }
+    const ai_kv_cache_t* kv = &ai_session_console()->kv;
+    context->n_threads = ai_scheduler_lanes();
+    context->context_size = kv->capacity;
+    context->n_past = kv->n_past;
+    context->kv_cache_k = kv->k;
+    context->kv_cache_v = kv->v;
+    context->scratch_buffer = row_scratch;
+}
@@ -0,0 +1,192 @@
+#include "arch/x86/clockevent.h"
+#include "arch/x86/cpu.h"
+#include "arch/x86/interrupts.h"
+#include "arch/x86/ports.h"
+#include "arch/x86/timer.h"
+#include "cpu.h"
+#include "drivers/serial.h"
+
+#define PIT_HZ 1193182u
+// 50ms on PIT channel 2, close to the 16-bit counter's limit.
+#define CLOCK_CAL_PIT_COUNTS 59659u
+// Each poll is a port read of about a microsecond.
+#define CLOCK_CAL_SPIN_LIMIT 10000000u
+#define CLOCK_MAX_CPUS 32u
+#define MSR_TSC_DEADLINE 0x6E0u
+#define LVT_MASKED 0x10000u
+#define LVT_TSC_DEADLINE 0x40000u
+
+static uint64_t tsc_khz = 0;
+static uint32_t lapic_khz = 0;
+static uint64_t tsc_base = 0;
+static uint32_t cpu_mode[CLOCK_MAX_CPUS];
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return *(volatile uint32_t*)(LAPIC_BASE + reg);
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(LAPIC_BASE + reg) = value;
+}
+
+static uint64_t cycles_to_ns(uint64_t cycles) {
+    // Split so cycles * 10^6 cannot overflow.
+    return (cycles / tsc_khz) * 1000000ull + ((cycles % tsc_khz) * 1000000ull) / tsc_khz;
+}
+
+static uint64_t ns_to_cycles(uint64_t ns) {
+    return (ns / 1000000ull) * tsc_khz + ((ns % 1000000ull) * tsc_khz) / 1000000ull;
+}
+
+void clock_init(void) {
+    int has_tsc = cpu_has_feature(CPU_FEATURE_TSC);
+    int has_lapic = cpu_has_feature(CPU_FEATURE_APIC);
+
+    // The LAPIC timer counts down from all ones, masked, while channel 2
+    // runs out in mode 0.
+    if (has_lapic) {
+        lapic_write(LAPIC_TMRDIV, 0x3);
+        lapic_write(LAPIC_LVT_TMR, LVT_MASKED | INT_LOCAL_TIMER);
+    }
+    outb(0x61, (uint8_t)((inb(0x61) & ~0x02u) | 0x01u));
+    outb(0x43, 0xB0);
+    outb(0x42, (uint8_t)(CLOCK_CAL_PIT_COUNTS & 0xFF));
+    outb(0x42, (uint8_t)(CLOCK_CAL_PIT_COUNTS >> 8));
+
+    if (has_lapic) {
+        lapic_write(LAPIC_TMRINIT, 0xFFFFFFFFu);
+    }
+    uint64_t t0 = has_tsc ? rdtsc() : 0;
+    uint32_t spins = 0;
+    while ((inb(0x61) & 0x20) == 0 && spins < CLOCK_CAL_SPIN_LIMIT) {
+        spins++;
+    }
+    uint64_t t1 = has_tsc ? rdtsc() : 0;
+    uint32_t lapic_left = has_lapic ? lapic_read(LAPIC_TMRCURR) : 0xFFFFFFFFu;
+    if (has_lapic) {
+        lapic_write(LAPIC_TMRINIT, 0);
+    }
+
+    if (spins >= CLOCK_CAL_SPIN_LIMIT) {
+        serial_write_string("DEBUG: clock calibration timed out, staying on PIT ticks\n");
+        return;
+    }
+    uint64_t per_count_div = (uint64_t)CLOCK_CAL_PIT_COUNTS * 1000ull;
+    if (has_tsc) {
+        tsc_khz = ((t1 - t0) * PIT_HZ) / per_count_div;
+        tsc_base = t0;
+    }
+    if (has_lapic) {
+        lapic_khz = (uint32_t)(((uint64_t)(0xFFFFFFFFu - lapic_left) * PIT_HZ) / per_count_div);
+    }
+
+    serial_write_string("DEBUG: clock tsc_khz=");
+    serial_write_hex32((uint32_t)tsc_khz);
+    serial_write_string(" lapic_khz=");
+    serial_write_hex32(lapic_khz);
+    serial_write_string("\n");
+}
+
+uint64_t clock_tsc_khz(void) {
+    return tsc_khz;
+}
+
+uint32_t clock_lapic_khz(void) {
+    return lapic_khz;
+}
+
+uint64_t clock_now_ns(void) {
+    if (!tsc_khz) {
+        return timer_get_ticks() * CLOCK_NS_PER_TICK;
+    }
+    return cycles_to_ns(rdtsc() - tsc_base);
+}
+
+void clock_delay_ns(uint64_t ns) {
+    if (!tsc_khz) {
+        timer_sleep((uint32_t)((ns + 999999ull) / 1000000ull));
+        return;
+    }
+    uint64_t end = rdtsc() + ns_to_cycles(ns);
+    while (rdtsc() < end) {
+        asm volatile("pause");
+    }
+}
+
+int clockevent_init_cpu(void) {
+    if (!lapic_khz) {
+        return 0;
+    }
+
+    // Software-enable the LAPIC; spurious interrupts land on INT_SPURIOUS.
+    // cpu_get_id reads the real APIC ID only from here on.
+    lapic_write(LAPIC_SVR, (lapic_read(LAPIC_SVR) & ~0xFFu) | 0x100u | INT_SPURIOUS);
+    uint32_t cpu = cpu_get_id();
+    if (cpu >= CLOCK_MAX_CPUS) {
+        return 0;
+    }
+
+    lapic_write(LAPIC_TMRDIV, 0x3);
+    lapic_write(LAPIC_TMRINIT, 0);
+    if (tsc_khz && cpu_has_feature(CPU_FEATURE_TSC_DEADLINE)) {
+        lapic_write(LAPIC_LVT_TMR, LVT_TSC_DEADLINE | INT_LOCAL_TIMER);
+        // The LVT write has to land before the first deadline write.
+        asm volatile("mfence" : : : "memory");
+        wrmsr(MSR_TSC_DEADLINE, 0);
+        cpu_mode[cpu] = CLOCKEVENT_TSC_DEADLINE;
+    } else {
+        lapic_write(LAPIC_LVT_TMR, INT_LOCAL_TIMER);
+        cpu_mode[cpu] = CLOCKEVENT_ONESHOT;
+    }
+    return 1;
+}
+
+uint32_t clockevent_mode(void) {
+    uint32_t cpu = cpu_get_id();
+    return cpu < CLOCK_MAX_CPUS ? cpu_mode[cpu] : CLOCKEVENT_NONE;
+}
+
+void clockevent_program(uint64_t deadline_ns) {
+    uint32_t mode = clockevent_mode();
+    if (mode == CLOCKEVENT_TSC_DEADLINE) {
+        // Zero would disarm; a deadline at the base is simply already due.
+        uint64_t target = tsc_base + ns_to_cycles(deadline_ns);
+        wrmsr(MSR_TSC_DEADLINE, target ? target : 1);
+        return;
+    }
+    if (mode != CLOCKEVENT_ONESHOT) {
+        return;
+    }
+    uint64_t now = clock_now_ns();
+    uint64_t delta = deadline_ns > now ? deadline_ns - now : 0;
+    if (delta > 0xFFFFFFFFull) {
+        delta = 0xFFFFFFFFull;
+    }
+    uint64_t count = (delta * lapic_khz) / 1000000ull;
+    if (count == 0) {
+        count = 1;
+    }
+    if (count > 0xFFFFFFFFull) {
+        count = 0xFFFFFFFFull;
+    }
+    lapic_write(LAPIC_TMRINIT, (uint32_t)count);
+}
+
+void clockevent_stop(void) {
+    uint32_t mode = clockevent_mode();
+    if (mode == CLOCKEVENT_TSC_DEADLINE) {
+        wrmsr(MSR_TSC_DEADLINE, 0);
+    } else if (mode == CLOCKEVENT_ONESHOT) {
+        lapic_write(LAPIC_TMRINIT, 0);
+    }
+}
@@ -7,6 +7,7 @@
 #include "cpu/syscall.h"
 #include "arch/x86/mmu.h"
 #include "arch/x86/timer.h"
+#include "arch/x86/clockevent.h"
 #include "paging.h"
 
 void arch_init(void) {
@@ -17,6 +18,8 @@ void arch_init(void) {
     vmm_init();
     mmu_tlb_flush_all();
     pit_init(100);
+    clock_init();
+    clockevent_init_cpu();
 }
 
 void interrupts_enable(void) {
@@ -56,15 +59,95 @@ int cpu_has_feature(uint32_t feature) {
         case CPU_FEATURE_SSE:
             asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
             return (edx >> 25) & 1u;
+        case CPU_FEATURE_SSE2:
+            asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+            return (edx >> 26) & 1u;
+        case CPU_FEATURE_SSSE3:
+            asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+            return (ecx >> 9) & 1u;
+        case CPU_FEATURE_TSC:
+            asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+            return (edx >> 4) & 1u;
+        case CPU_FEATURE_APIC:
+            asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+            return (edx >> 9) & 1u;
+        case CPU_FEATURE_TSC_DEADLINE:
+            asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+            return (ecx >> 24) & 1u;
         case CPU_FEATURE_SSE41:
             asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
             return (ecx >> 19) & 1u;
+        case CPU_FEATURE_AVX2:
+            asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0));
+            if (eax < 7) {
+                return 0;
+            }
+            // AVX state needs XSAVE (bit 26) and AVX (bit 28) as well.
+            asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+            if (((ecx >> 26) & 1u) == 0 || ((ecx >> 28) & 1u) == 0) {
+                return 0;
+            }
+            asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(7), "c"(0));
+            return (ebx >> 5) & 1u;
         default:
             return 0;
     }
 }
 
+static uint32_t ceil_log2(uint32_t value) {
+    uint32_t bits = 0;
+    while ((1u << bits) < value) {
+        bits++;
+    }
+    return bits;
+}
+
+void cpu_get_topology(uint32_t* smt_bits, uint32_t* pkg_bits) {
+    uint32_t eax, ebx, ecx, edx;
+    uint32_t logical = 1;
+    uint32_t cores = 1;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0));
+    uint32_t max_leaf = eax;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    if ((edx >> 28) & 1u) {
+        logical = (ebx >> 16) & 0xFFu;
+    }
+    if (logical == 0) {
+        logical = 1;
+    }
+    cores = logical;
+    if (max_leaf >= 4) {
+        asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(4), "c"(0));
+        // A null cache type means the leaf is not implemented (AMD); treat
+        // every logical CPU as its own core then.
+        if (eax & 0x1Fu) {
+            cores = ((eax >> 26) & 0x3Fu) + 1u;
+        }
+    }
+    if (cores > logical) {
+        cores = logical;
+    }
+    if (smt_bits) {
+        *smt_bits = ceil_log2(logical / cores);
+    }
+    if (pkg_bits) {
+        *pkg_bits = ceil_log2(logical);
+    }
+}
+
 void cpu_enable_feature(uint32_t feature) {
+    if (feature == CPU_FEATURE_AVX2) {
+        cpu_enable_feature(CPU_FEATURE_SSE);
+        uint32_t cr4;
+        asm volatile("mov %%cr4, %0" : "=r"(cr4));
+        cr4 |= 0x40000u; // OSXSAVE
+        asm volatile("mov %0, %%cr4" : : "r"(cr4));
+        uint32_t lo, hi;
+        asm volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        lo |= 0x7u; // x87, SSE and AVX state
+        asm volatile("xsetbv" : : "a"(lo), "d"(hi), "c"(0));
+        return;
+    }
     if (feature == CPU_FEATURE_SSE || feature == CPU_FEATURE_FPU) {
         uint32_t cr0;
         asm volatile("mov %%cr0, %0" : "=r"(cr0));
@@ -0,0 +1,157 @@
+#include "arch/x86/fpu.h"
+#include "cpu.h"
+#include "kernel/sched.h"
+#include "util.h"
+#include "drivers/serial.h"
+
+#define FPU_MAX_CPUS 32u
+#define CR0_TS 0x8u
+#define CR4_OSXSAVE 0x40000u
+#define XCR0_AVX 0x4u
+#define FPU_INIT_FCW 0x037Fu
+#define FPU_INIT_MXCSR 0x1F80u
+
+static int lazy_enabled = 0;
+static int use_xsave = 0;
+static uint32_t xsave_mask = 0;
+// Nesting for kernel entries taken before this CPU ran its first task.
+static uint32_t idle_nest[FPU_MAX_CPUS];
+// What a task's first SIMD instruction sees: default control words and an
+// XSAVE header with no components set, so XRSTOR loads the init state.
+static uint8_t init_area[PROCESS_FPU_AREA] __attribute__((aligned(64)));
+
+static inline FPU_NO_SIMD uint8_t* area_of(process_t* proc) {
+    return (uint8_t*)(((uintptr_t)proc->fpu_area + 63u) & ~(uintptr_t)63u);
+}
+
+static inline FPU_NO_SIMD uint32_t read_cr0(void) {
+    uint32_t cr0;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    return cr0;
+}
+
+static inline FPU_NO_SIMD void write_cr0(uint32_t cr0) {
+    asm volatile("mov %0, %%cr0" : : "r"(cr0) : "memory");
+}
+
+static inline FPU_NO_SIMD void fpu_save(uint8_t* area) {
+    if (use_xsave) {
+        asm volatile("xsave (%0)" : : "r"(area), "a"(xsave_mask), "d"(0) : "memory");
+    } else {
+        asm volatile("fxsave (%0)" : : "r"(area) : "memory");
+    }
+}
+
+static inline FPU_NO_SIMD void fpu_restore(const uint8_t* area) {
+    if (use_xsave) {
+        asm volatile("xrstor (%0)" : : "r"(area), "a"(xsave_mask), "d"(0) : "memory");
+    } else {
+        asm volatile("fxrstor (%0)" : : "r"(area) : "memory");
+    }
+}
+
+static inline FPU_NO_SIMD uint32_t* nest_of(process_t* proc, uint32_t cpu) {
+    return proc ? &proc->fpu_nest : &idle_nest[cpu];
+}
+
+void fpu_init(void) {
+    // FXSAVE comes with SSE; without it the kernel's SIMD code cannot run
+    // anyway.
+    if (!cpu_has_feature(CPU_FEATURE_SSE)) {
+        return;
+    }
+
+    uint32_t cr4;
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    if (cr4 & CR4_OSXSAVE) {
+        uint32_t lo, hi;
+        asm volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        uint32_t eax, ebx, ecx, edx;
+        asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0xD), "c"(0));
+        if ((lo & XCR0_AVX) && ebx <= PROCESS_FPU_AREA) {
+            use_xsave = 1;
+            xsave_mask = lo;
+        } else if (lo & XCR0_AVX) {
+            serial_write_string("DEBUG: XSAVE area too large, AVX upper halves not preserved\n");
+        }
+    }
+
+    memset(init_area, 0, sizeof(init_area));
+    *(uint16_t*)init_area = FPU_INIT_FCW;
+    *(uint32_t*)(init_area + 24) = FPU_INIT_MXCSR;
+    lazy_enabled = 1;
+
+    serial_write_string(use_xsave ? "DEBUG: Lazy FPU switching (XSAVE)\n"
+                                  : "DEBUG: Lazy FPU switching (FXSAVE)\n");
+}
+
+int fpu_lazy_enabled(void) {
+    return lazy_enabled;
+}
+
+void fpu_enter(uint32_t vector) {
+    if (!lazy_enabled) {
+        return;
+    }
+    uint32_t cpu = cpu_get_id();
+    if (cpu >= FPU_MAX_CPUS) {
+        return;
+    }
+    process_t* proc = scheduler_current();
+    if ((*nest_of(proc, cpu))++ > 0 || vector == 7) {
+        return;
+    }
+
+    // TS clear means the task has used SIMD since it last entered the
+    // kernel, so the registers are its own and newer than its saved copy.
+    if (read_cr0() & CR0_TS) {
+        asm volatile("clts");
+    } else if (proc) {
+        fpu_save(area_of(proc));
+        proc->fpu_valid = 1;
+    }
+}
+
+void fpu_leave(uint32_t vector) {
+    if (!lazy_enabled) {
+        return;
+    }
+    uint32_t cpu = cpu_get_id();
+    if (cpu >= FPU_MAX_CPUS) {
+        return;
+    }
+    // The task resuming may not be the one that entered; its count was
+    // raised when it was switched out, or set to 1 at creation.
+    uint32_t* nest = nest_of(scheduler_current(), cpu);
+    if (*nest > 0) {
+        (*nest)--;
+    }
+    // After #NM the task keeps the unit it just loaded.
+    if (*nest > 0 || vector == 7) {
+        return;
+    }
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+void fpu_handle_nm(void) {
+    asm volatile("clts");
+    if (!lazy_enabled) {
+        return;
+    }
+    process_t* proc = scheduler_current();
+    fpu_restore(proc && proc->fpu_valid ? area_of(proc) : init_area);
+}
+
+void fpu_copy(process_t* dst, const process_t* src) {
+    if (!dst || !src) {
+        return;
+    }
+    memcpy(area_of(dst), area_of((process_t*)src), PROCESS_FPU_AREA);
+    dst->fpu_valid = src->fpu_valid;
+}
+
+void fpu_reset(process_t* proc) {
+    if (proc) {
+        proc->fpu_valid = 0;
+    }
+}
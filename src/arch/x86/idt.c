@@ -55,6 +55,9 @@ extern void irq13(void);
 extern void irq14(void);
 extern void irq15(void);
 extern void isr128(void);
+extern void isr239(void);
+extern void isr240(void);
+extern void isr255(void);
 
 void pic_remap(void) {
     outb(0x20, 0x11);
@@ -151,6 +154,9 @@ void idt_init(void) {
     idt_set_gate(46, (uint32_t)irq14, 0x08, 0x0E, 0, 1);
     idt_set_gate(47, (uint32_t)irq15, 0x08, 0x0E, 0, 1);
     idt_set_gate(128, (uint32_t)isr128, 0x08, 0x0E, 3, 1);
+    idt_set_gate(239, (uint32_t)isr239, 0x08, 0x0E, 0, 1);
+    idt_set_gate(240, (uint32_t)isr240, 0x08, 0x0E, 0, 1);
+    idt_set_gate(255, (uint32_t)isr255, 0x08, 0x0E, 0, 1);
 
     idt_load_current();
 }
@@ -1,6 +1,7 @@
 #include "arch/x86/interrupts.h"
 #include "arch/x86/idt.h"
 #include "arch/x86/cpu.h"
+#include "arch/x86/fpu.h"
 #include "arch/x86/ports.h"
 #include "drivers/serial.h"
 #include "debug.h"
@@ -22,19 +23,10 @@ static const char* exception_messages[32] = {
     "Reserved", "Reserved", "Reserved", "Reserved", "Reserved", "Reserved"
 };
 
-static registers_t* irq0_handler(registers_t* regs) {
-    uint32_t cpu = cpu_get_id();
-    
-    if (cpu == 0) {
-        static uint32_t ticks = 0;
-        ticks++;
-        if (ticks % 100 == 0) {
-            serial_write_string("T");
-        }
-        timer_handler();
-        kswapd_tick();
-    }
-
+// Runs the scheduler on this CPU and returns the frame to resume. Also the
+// INT_LOCAL_TIMER handler: a one-shot expiry, a reschedule IPI or a yield
+// does everything the PIT tick does except advance the jiffies.
+static registers_t* schedule_handler(registers_t* regs) {
     process_t* previous = 0;
     process_t* next = switch_task(regs, &previous);
     if (!next || next == previous) {
@@ -52,12 +44,29 @@ static registers_t* irq0_handler(registers_t* regs) {
     return (registers_t*)next->esp;
 }
 
+static registers_t* irq0_handler(registers_t* regs) {
+    uint32_t cpu = cpu_get_id();
+    
+    if (cpu == 0) {
+        static uint32_t ticks = 0;
+        ticks++;
+        if (ticks % 100 == 0) {
+            serial_write_string("T");
+        }
+        timer_handler();
+        kswapd_tick();
+    }
+
+    return schedule_handler(regs);
+}
+
 void intc_init(void) {
     idt_init();
     for (uint32_t i = 0; i < 256; ++i) {
         interrupt_handlers[i] = 0;
     }
     interrupts_register_handler(32, irq0_handler);
+    interrupts_register_handler(INT_LOCAL_TIMER, schedule_handler);
 }
 
 void interrupts_register_handler(uint32_t vector, interrupt_handler_t handler) {
@@ -124,13 +133,18 @@ static void dump_registers(registers_t* regs) {
     serial_write_label_hex("ERR: ", regs->err_code);
 }
 
-registers_t* x86_interrupt_handler(registers_t* regs) {
+static registers_t* dispatch_interrupt(registers_t* regs) {
     uint32_t vector = regs->int_no;
     
     interrupt_depth++;
 
     if (vector < 32) {
         // Exception handling
+        if (vector == 7) { // Device Not Available: lazy FPU restore
+            fpu_handle_nm();
+            interrupt_depth--;
+            return regs;
+        }
         if (vector == 14) { // Page Fault
             uintptr_t fault_addr = mmu_get_fault_addr();
             if (vm_handle_page_fault(scheduler_current(), fault_addr, regs->err_code)) {
@@ -145,6 +159,11 @@ registers_t* x86_interrupt_handler(registers_t* regs) {
         for(;;);
     }
     
+    if (vector == INT_SPURIOUS) {
+        interrupt_depth--;
+        return regs;
+    }
+
     if (vector >= 32) {
         interrupts_send_eoi(vector);
     }
@@ -158,3 +177,14 @@ registers_t* x86_interrupt_handler(registers_t* regs) {
     interrupt_depth--;
     return regs;
 }
+
+// Handlers and the scheduler are built with SSE, so the interrupted task's
+// SIMD state is saved before any of them run; this wrapper itself must not
+// touch xmm registers.
+FPU_NO_SIMD registers_t* x86_interrupt_handler(registers_t* regs) {
+    uint32_t vector = regs->int_no;
+    fpu_enter(vector);
+    registers_t* next = dispatch_interrupt(regs);
+    fpu_leave(vector);
+    return next;
+}
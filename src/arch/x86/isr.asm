@@ -1,6 +1,7 @@
 [bits 32]
 
 extern x86_interrupt_handler
+extern scheduler_finish_switch
 
 %macro ISR_NOERR 1
 global isr%1
@@ -62,6 +63,9 @@ ISR_NOERR 29
 ISR_ERR 30
 ISR_NOERR 31
 ISR_NOERR 128
+ISR_NOERR 239
+ISR_NOERR 240
+ISR_NOERR 255
 
 IRQ 0, 32
 IRQ 1, 33
@@ -99,6 +103,7 @@ interrupt_common_stub:
     push esp
     call x86_interrupt_handler
     mov esp, eax    ; IMPORTANT: use the returned (potentially switched) stack pointer
+    call scheduler_finish_switch    ; the old stack is no longer in use
 
     pop eax
     mov gs, ax
@@ -3,6 +3,7 @@
 #include "arch/x86/gdt.h"
 #include "arch/x86/idt.h"
 #include "arch/x86/timer.h"
+#include "arch/x86/clockevent.h"
 #include "paging.h"
 #include "kernel/sched.h"
 #include "drivers/serial.h"
@@ -50,8 +51,19 @@ void smp_ap_entry(void) {
     // Load IDT
     idt_load_current();
     
-    // Initialize LAPIC timer for this CPU
-    lapic_timer_init(100); // 100Hz
+    // Kernel code is built with -msse2; match the BSP's CR0/CR4 setup
+    if (cpu_has_feature(CPU_FEATURE_SSE)) {
+        cpu_enable_feature(CPU_FEATURE_SSE);
+    }
+    if (cpu_has_feature(CPU_FEATURE_AVX2)) {
+        cpu_enable_feature(CPU_FEATURE_AVX2);
+    }
+
+    // One-shot clock events for the tickless scheduler; without a
+    // calibrated LAPIC rate fall back to the old periodic tick.
+    if (!clockevent_init_cpu()) {
+        lapic_timer_init(100); // 100Hz
+    }
     
     serial_write_string("DEBUG: AP ");
     serial_write_hex32(cpu_id);
@@ -124,11 +136,11 @@ void smp_rally_init(void) {
                     
                     // INIT IPI
                     lapic_send_ipi(apic_id, 0x00000500);
-                    timer_sleep(10); // Wait 10ms
+                    clock_delay_ns(10000000); // Wait 10ms
                     
                     // SIPI IPI (Vector 0x01 -> Address 0x1000)
                     lapic_send_ipi(apic_id, 0x00000600 | (TRAMPOLINE_ADDR >> 12));
-                    timer_sleep(1); // Wait 1ms
+                    clock_delay_ns(200000); // Wait 200us
 
                     // Wait for AP to mark itself online
                     uint32_t timeout = 10000000;
@@ -53,6 +53,68 @@ uint64_t bench_matmul(uint32_t size) {
     return bench_ticks_last;
 }
 
+// Times `reps` runs of the matmul on row-major B (packed inside every call)
+// and on B packed once, outside the timed region, as a loader would.
+int bench_matmul_layouts(uint32_t size, uint32_t reps, uint64_t* strided_ticks, uint64_t* packed_ticks) {
+    if (size < 2) {
+        size = 2;
+    }
+    if (size > 64) {
+        size = 64;
+    }
+    if (reps == 0) {
+        reps = 1;
+    }
+    uint32_t count = size * size;
+    q16_16_t* a = (q16_16_t*)kmalloc(count * sizeof(q16_16_t));
+    q16_16_t* b = (q16_16_t*)kmalloc(count * sizeof(q16_16_t));
+    q16_16_t* bt = (q16_16_t*)kmalloc(count * sizeof(q16_16_t));
+    q16_16_t* c = (q16_16_t*)kmalloc(count * sizeof(q16_16_t));
+    if (!a || !b || !bt || !c) {
+        diag_log(DIAG_ERROR, "bench alloc failed");
+        if (a) {
+            kfree(a);
+        }
+        if (b) {
+            kfree(b);
+        }
+        if (bt) {
+            kfree(bt);
+        }
+        if (c) {
+            kfree(c);
+        }
+        return 0;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        a[i] = q16_from_int((int32_t)((i & 3u) - 1));
+        b[i] = q16_from_int((int32_t)((i & 3u) - 1));
+    }
+    ai_matmul_pack_b(b, bt, size, size);
+
+    uint64_t start = timer_get_ticks();
+    for (uint32_t r = 0; r < reps; ++r) {
+        ai_matmul_q16_16(a, b, c, size, size, size);
+    }
+    uint64_t mid = timer_get_ticks();
+    for (uint32_t r = 0; r < reps; ++r) {
+        ai_matmul_q16_16_packed(a, bt, c, size, size, size);
+    }
+    uint64_t end = timer_get_ticks();
+    kfree(a);
+    kfree(b);
+    kfree(bt);
+    kfree(c);
+    if (strided_ticks) {
+        *strided_ticks = mid - start;
+    }
+    if (packed_ticks) {
+        *packed_ticks = end - mid;
+    }
+    bench_ticks_last = end - mid;
+    return 1;
+}
+
 uint64_t bench_last_ticks(void) {
     return bench_ticks_last;
 }
@@ -1,3 +1,4 @@
+#include "ai/ai_session.h"
 #include "power/acpi_power.h"
 #include "video/framebuffer.h"
 #include "mem/heap.h"
@@ -15,8 +16,16 @@
 #include "util.h"
 #include "vfs.h"
 #include "mem/heap.h"
+#include "paging.h"
 
 #define SYS_COPY_LIMIT 4096u
+#define SYS_AI_PROMPT_MAX 512u
+#define SYS_AI_RING_BYTES 4096u
+
+// Token ring page for each session slot, created on first use and kept:
+// shared segments cannot be released. Stored as segment id + 1.
+static uint32_t ai_ring_shm[AI_SESSION_MAX];
+static uint32_t ai_ring_addr[AI_SESSION_MAX];
 
 static int fd_alloc(process_t* proc, fs_node_t* node) {
     for (uint32_t i = 0; i < PROCESS_MAX_FDS; ++i) {
@@ -431,6 +440,117 @@ static registers_t* sys_policy_add(registers_t* regs) {
     return regs;
 }
 
+static ai_session_t* ai_session_of(process_t* proc, uint32_t id) {
+    ai_session_t* s = ai_session_get(id);
+    if (!proc || !s || s->owner != proc->pid) {
+        return 0;
+    }
+    return s;
+}
+
+static int ai_ring_map(process_t* proc, ai_session_t* s, uint32_t addr) {
+    if (ai_ring_shm[s->id] == 0) {
+        int shm = vm_create_shared(1);
+        if (shm < 0) {
+            return 0;
+        }
+        ai_ring_shm[s->id] = (uint32_t)shm + 1;
+    }
+    uint32_t shm = ai_ring_shm[s->id] - 1;
+    // Not inherited by fork: the slot's page goes to the next owner once
+    // this session is closed.
+    if (!vm_map_shared_ex(proc, shm, addr, VM_NOFORK)) {
+        return 0;
+    }
+    ai_ring_addr[s->id] = addr;
+    // The engine writes through the identity map; no copy per token.
+    return ai_session_attach_ring(s, (ai_token_ring_t*)vm_shared_phys(shm, 0));
+}
+
+// ebx = context tokens (0 = maximum), ecx = page-aligned user address to
+// map the session's ai_token_ring_t at, or 0 to read with SYS_AI_READ.
+// Returns the session id.
+static registers_t* sys_ai_open(registers_t* regs) {
+    process_t* current = scheduler_current();
+    uint32_t addr = regs->ecx;
+    if (!current || (addr & (SYS_AI_RING_BYTES - 1)) ||
+        (addr && (addr < VM_USER_BASE || addr > VM_USER_LIMIT - SYS_AI_RING_BYTES))) {
+        regs->eax = OS_ERR;
+        return regs;
+    }
+    ai_session_t* s = ai_session_create(regs->ebx);
+    if (!s) {
+        regs->eax = OS_ERR;
+        return regs;
+    }
+    s->owner = current->pid;
+    ai_ring_addr[s->id] = 0;
+    if (addr && !ai_ring_map(current, s, addr)) {
+        ai_session_destroy(s);
+        regs->eax = OS_ERR;
+        return regs;
+    }
+    regs->eax = s->id;
+    return regs;
+}
+
+// ebx = session, ecx = prompt, edx = prompt length, esi = max tokens.
+// Returns at once; the engine thread generates in the background.
+static registers_t* sys_ai_submit(registers_t* regs) {
+    ai_session_t* s = ai_session_of(scheduler_current(), regs->ebx);
+    const char* prompt = (const char*)regs->ecx;
+    uint32_t len = regs->edx;
+    if (!s || !prompt || len == 0 || len > SYS_AI_PROMPT_MAX) {
+        regs->eax = OS_ERR;
+        return regs;
+    }
+    char* copy = (char*)kmalloc(len + 1);
+    if (!copy) {
+        regs->eax = OS_ERR;
+        return regs;
+    }
+    memcpy(copy, prompt, len);
+    copy[len] = 0;
+    int ok = ai_session_submit(s, copy, regs->esi);
+    kfree(copy);
+    regs->eax = ok ? OS_OK : OS_ERR;
+    return regs;
+}
+
+// ebx = session, ecx = uint32_t token buffer, edx = capacity. Copies what
+// is ready without blocking; for sessions opened without a ring.
+static registers_t* sys_ai_read(registers_t* regs) {
+    ai_session_t* s = ai_session_of(scheduler_current(), regs->ebx);
+    uint32_t* tokens = (uint32_t*)regs->ecx;
+    uint32_t max = regs->edx;
+    if (!s || !tokens) {
+        regs->eax = OS_ERR;
+        return regs;
+    }
+    if (max > SYS_COPY_LIMIT / sizeof(uint32_t)) {
+        max = SYS_COPY_LIMIT / sizeof(uint32_t);
+    }
+    regs->eax = ai_session_read(s, tokens, max);
+    return regs;
+}
+
+static registers_t* sys_ai_close(registers_t* regs) {
+    process_t* current = scheduler_current();
+    ai_session_t* s = ai_session_of(current, regs->ebx);
+    if (!s) {
+        regs->eax = OS_ERR;
+        return regs;
+    }
+    uint32_t id = s->id;
+    ai_session_destroy(s);
+    if (ai_ring_addr[id]) {
+        vm_unmap_region(current, ai_ring_addr[id], SYS_AI_RING_BYTES);
+        ai_ring_addr[id] = 0;
+    }
+    regs->eax = OS_OK;
+    return regs;
+}
+
 typedef registers_t* (*syscall_fn_t)(registers_t* regs);
 
 static syscall_fn_t syscall_table[SYS_MAX] = {
@@ -467,7 +587,11 @@ static syscall_fn_t syscall_table[SYS_MAX] = {
     sys_trace_get,
     sys_audit_get,
     sys_policy_add,
-    sys_exec_elf
+    sys_exec_elf,
+    sys_ai_open,
+    sys_ai_submit,
+    sys_ai_read,
+    sys_ai_close
 };
 
 static registers_t* syscall_handler(registers_t* regs) {
@@ -1,4 +1,5 @@
 #include "ai/ai_model.h"
+#include "ai/ai_session.h"
 #include "diag.h"
 #include "kernel.h"
 #include "video/framebuffer.h"
@@ -47,6 +48,7 @@
 #include "shell/shell.h"
 #include "arch/x86/timer.h"
 #include "arch/x86/hw_detect.h"
+#include "arch/x86/fpu.h"
 #include "util.h"
 #include "fs/fs.h"
 #include "fs/fs_types.h"
@@ -251,10 +253,14 @@ void kernel_main(unsigned int multiboot_magic, unsigned int multiboot_info_addr)
     if (cpu_has_feature(CPU_FEATURE_SSE)) {
         cpu_enable_feature(CPU_FEATURE_SSE);
         ai_set_simd_enabled(cpu_has_feature(CPU_FEATURE_SSE41));
+        if (cpu_has_feature(CPU_FEATURE_AVX2)) {
+            cpu_enable_feature(CPU_FEATURE_AVX2);
+        }
     } else {
         ai_set_simd_enabled(0);
     }
-    ai_model_init();
+    fpu_init();
+    ai_model_init(info);
 
     numa_init(get_ram_size());
     ipc_init();
@@ -270,8 +276,17 @@ void kernel_main(unsigned int multiboot_magic, unsigned int multiboot_info_addr)
     vfs_init();
 
     // 11. Ramdisk / Init
-    if (info && info->mods_count > 0) {
-        multiboot_module_t* module = (multiboot_module_t*)info->mods_addr;
+    // The first module that is not the model is the ramdisk.
+    multiboot_module_t* module = 0;
+    if (info && (info->flags & 0x8)) {
+        multiboot_module_t* mods = (multiboot_module_t*)info->mods_addr;
+        for (uint32_t i = 0; i < info->mods_count && !module; ++i) {
+            if (mods[i].mod_start != ai_model_module_phys()) {
+                module = &mods[i];
+            }
+        }
+    }
+    if (module) {
         uint32_t size = module->mod_end - module->mod_start;
         vfs_set_root(ramdisk_init(module->mod_start, size));
         serial_write_string("DEBUG: Ramdisk mounted\n");
@@ -290,6 +305,8 @@ void kernel_main(unsigned int multiboot_magic, unsigned int multiboot_info_addr)
     serial_write_string("DEBUG: Task A Created\n");
     process_create(task_b, 0);
     serial_write_string("DEBUG: Task B Created\n");
+    ai_scheduler_init(0);
+    ai_session_start_engine();
     fb_console_write("Tasks Created\n");
     
     fb_console_write("Shell Initializing...\n");
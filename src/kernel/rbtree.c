@@ -0,0 +1,273 @@
+#include "kernel/rbtree.h"
+
+static void rotate_left(rb_tree_t* tree, rb_node_t* x) {
+    rb_node_t* y = x->right;
+    x->right = y->left;
+    if (y->left) {
+        y->left->parent = x;
+    }
+    y->parent = x->parent;
+    if (!x->parent) {
+        tree->root = y;
+    } else if (x == x->parent->left) {
+        x->parent->left = y;
+    } else {
+        x->parent->right = y;
+    }
+    y->left = x;
+    x->parent = y;
+}
+
+static void rotate_right(rb_tree_t* tree, rb_node_t* x) {
+    rb_node_t* y = x->left;
+    x->left = y->right;
+    if (y->right) {
+        y->right->parent = x;
+    }
+    y->parent = x->parent;
+    if (!x->parent) {
+        tree->root = y;
+    } else if (x == x->parent->right) {
+        x->parent->right = y;
+    } else {
+        x->parent->left = y;
+    }
+    y->right = x;
+    x->parent = y;
+}
+
+static int is_red(const rb_node_t* node) {
+    return node && node->red;
+}
+
+void rb_init(rb_tree_t* tree) {
+    tree->root = 0;
+    tree->leftmost = 0;
+    tree->count = 0;
+}
+
+rb_node_t* rb_next(const rb_node_t* node) {
+    if (node->right) {
+        node = node->right;
+        while (node->left) {
+            node = node->left;
+        }
+        return (rb_node_t*)node;
+    }
+    const rb_node_t* parent = node->parent;
+    while (parent && node == parent->right) {
+        node = parent;
+        parent = parent->parent;
+    }
+    return (rb_node_t*)parent;
+}
+
+rb_node_t* rb_prev(const rb_node_t* node) {
+    if (node->left) {
+        node = node->left;
+        while (node->right) {
+            node = node->right;
+        }
+        return (rb_node_t*)node;
+    }
+    const rb_node_t* parent = node->parent;
+    while (parent && node == parent->left) {
+        node = parent;
+        parent = parent->parent;
+    }
+    return (rb_node_t*)parent;
+}
+
+rb_node_t* rb_last(const rb_tree_t* tree) {
+    rb_node_t* node = tree->root;
+    while (node && node->right) {
+        node = node->right;
+    }
+    return node;
+}
+
+void rb_insert(rb_tree_t* tree, rb_node_t* node, rb_less_fn less) {
+    rb_node_t* parent = 0;
+    rb_node_t** link = &tree->root;
+    int leftmost = 1;
+    while (*link) {
+        parent = *link;
+        if (less(node, parent)) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+            leftmost = 0;
+        }
+    }
+    node->parent = parent;
+    node->left = 0;
+    node->right = 0;
+    node->red = 1;
+    *link = node;
+    if (leftmost) {
+        tree->leftmost = node;
+    }
+    tree->count++;
+
+    while (is_red(node->parent)) {
+        rb_node_t* p = node->parent;
+        rb_node_t* g = p->parent;
+        if (p == g->left) {
+            rb_node_t* uncle = g->right;
+            if (is_red(uncle)) {
+                p->red = 0;
+                uncle->red = 0;
+                g->red = 1;
+                node = g;
+                continue;
+            }
+            if (node == p->right) {
+                rotate_left(tree, p);
+                node = p;
+                p = node->parent;
+            }
+            p->red = 0;
+            g->red = 1;
+            rotate_right(tree, g);
+        } else {
+            rb_node_t* uncle = g->left;
+            if (is_red(uncle)) {
+                p->red = 0;
+                uncle->red = 0;
+                g->red = 1;
+                node = g;
+                continue;
+            }
+            if (node == p->left) {
+                rotate_right(tree, p);
+                node = p;
+                p = node->parent;
+            }
+            p->red = 0;
+            g->red = 1;
+            rotate_left(tree, g);
+        }
+    }
+    tree->root->red = 0;
+}
+
+// Puts v where u was, under u's parent.
+static void transplant(rb_tree_t* tree, rb_node_t* u, rb_node_t* v) {
+    if (!u->parent) {
+        tree->root = v;
+    } else if (u == u->parent->left) {
+        u->parent->left = v;
+    } else {
+        u->parent->right = v;
+    }
+    if (v) {
+        v->parent = u->parent;
+    }
+}
+
+void rb_erase(rb_tree_t* tree, rb_node_t* node) {
+    if (tree->leftmost == node) {
+        tree->leftmost = rb_next(node);
+    }
+    tree->count--;
+
+    // x takes the removed position; x_parent tracks it when x is null.
+    rb_node_t* x;
+    rb_node_t* x_parent;
+    uint32_t removed_red = node->red;
+    if (!node->left) {
+        x = node->right;
+        x_parent = node->parent;
+        transplant(tree, node, node->right);
+    } else if (!node->right) {
+        x = node->left;
+        x_parent = node->parent;
+        transplant(tree, node, node->left);
+    } else {
+        rb_node_t* y = node->right;
+        while (y->left) {
+            y = y->left;
+        }
+        removed_red = y->red;
+        x = y->right;
+        if (y->parent == node) {
+            x_parent = y;
+        } else {
+            x_parent = y->parent;
+            transplant(tree, y, y->right);
+            y->right = node->right;
+            y->right->parent = y;
+        }
+        transplant(tree, node, y);
+        y->left = node->left;
+        y->left->parent = y;
+        y->red = node->red;
+    }
+    node->parent = 0;
+    node->left = 0;
+    node->right = 0;
+    if (removed_red) {
+        return;
+    }
+
+    while (x != tree->root && !is_red(x)) {
+        if (x == x_parent->left) {
+            rb_node_t* w = x_parent->right;
+            if (is_red(w)) {
+                w->red = 0;
+                x_parent->red = 1;
+                rotate_left(tree, x_parent);
+                w = x_parent->right;
+            }
+            if (!is_red(w->left) && !is_red(w->right)) {
+                w->red = 1;
+                x = x_parent;
+                x_parent = x->parent;
+            } else {
+                if (!is_red(w->right)) {
+                    w->left->red = 0;
+                    w->red = 1;
+                    rotate_right(tree, w);
+                    w = x_parent->right;
+                }
+                w->red = x_parent->red;
+                x_parent->red = 0;
+                if (w->right) {
+                    w->right->red = 0;
+                }
+                rotate_left(tree, x_parent);
+                x = tree->root;
+            }
+        } else {
+            rb_node_t* w = x_parent->left;
+            if (is_red(w)) {
+                w->red = 0;
+                x_parent->red = 1;
+                rotate_right(tree, x_parent);
+                w = x_parent->left;
+            }
+            if (!is_red(w->left) && !is_red(w->right)) {
+                w->red = 1;
+                x = x_parent;
+                x_parent = x->parent;
+            } else {
+                if (!is_red(w->left)) {
+                    w->right->red = 0;
+                    w->red = 1;
+                    rotate_left(tree, w);
+                    w = x_parent->left;
+                }
+                w->red = x_parent->red;
+                x_parent->red = 0;
+                if (w->left) {
+                    w->left->red = 0;
+                }
+                rotate_right(tree, x_parent);
+                x = tree->root;
+            }
+        }
+    }
+    if (x) {
+        x->red = 0;
+    }
+}
@@ -1,9 +1,13 @@
 #include "paging.h"
+#include "kernel/rbtree.h"
 #include "kernel/sched.h"
 #include "security/secure_caps.h"
 #include "kernel/signal.h"
 #include "smp.h"
 #include "arch/x86/timer.h"
+#include "arch/x86/clockevent.h"
+#include "arch/x86/interrupts.h"
+#include "arch/x86/fpu.h"
 #include "types.h"
 #include "mem/vm_space.h"
 #include "mem/heap.h"
@@ -11,21 +15,82 @@
 #include "drivers/serial.h"
 #include "user/elf_loader.h"
 #include "cpu.h"
+#include "mem/numa.h"
+#include "ai/ai_session.h"
 
 #define STACK_SIZE 4096
 #define MAX_PRIORITY_BOOST 8
 #define MAX_CPUS 32
+// RT priorities at or above the top level share it.
+#define SCHED_RT_LEVELS 32
+// Longest a CPU with its tick stopped goes without an event, so it still
+// charges runtime and balances now and then.
+#define SCHED_MAX_IDLE_NS 1000000000ull
+// Balancing domains, nearest first. Each spans the one below it.
+#define SCHED_DOMAIN_SMT 0
+#define SCHED_DOMAIN_PKG 1
+#define SCHED_DOMAIN_NUMA 2
+#define SCHED_DOMAIN_ALL 3
+#define SCHED_DOMAIN_LEVELS 4
+// Weight of a CFS task at the default share and priority.
+#define SCHED_LOAD_SCALE 1024u
+#define SCHED_BALANCE_MAX_MOVES 4
+// Balance passes that found only cache-hot tasks before those move anyway.
+#define SCHED_BALANCE_FAIL_LIMIT 3
 
+// Per-CPU runqueue, one structure per class so picking never scans: CFS is
+// a tree ordered by vruntime, RT a FIFO per priority level with a bitmap of
+// the non-empty ones, DEADLINE a tree ordered by absolute deadline (EDF).
+// sleepers holds the tasks this CPU switched out asleep, by wake_ns; the
+// tick only looks at its front. last_tick is the jiffy the running task was
+// last charged up to; tick_stopped is set while the CPU runs without a
+// periodic tick, so whoever queues work there has to kick it. load is the
+// summed weight of the queued tasks and curr_weight that of the one running;
+// next_balance is the jiffy each domain level is balanced again.
 typedef struct {
-    process_t* head;
-    process_t* tail;
+    rb_tree_t cfs;
+    rb_tree_t dl;
+    rb_tree_t sleepers;
+    process_t* rt_head[SCHED_RT_LEVELS];
+    process_t* rt_tail[SCHED_RT_LEVELS];
+    uint32_t rt_bitmap;
     uint32_t count;
+    uint64_t last_tick;
+    uint32_t tick_stopped;
+    uint32_t load;
+    uint32_t curr_weight;
+    uint64_t next_balance[SCHED_DOMAIN_LEVELS];
     spinlock_t lock;
 } runqueue_t;
 
 static runqueue_t runqueues[MAX_CPUS];
 
-// Global runqueue lock
+// One CPU's view of a balancing level: the CPUs it balances against, how
+// many jiffies apart, how far ahead (in percent) the busiest has to be, and
+// how long a switched-out task counts as cache-hot. failed counts passes
+// that moved nothing.
+typedef struct {
+    uint32_t span;
+    uint32_t interval;
+    uint32_t imbalance_pct;
+    uint32_t migration_cost;
+    uint32_t failed;
+} sched_domain_t;
+
+static const sched_domain_t domain_params[SCHED_DOMAIN_LEVELS] = {
+    {0, 1, 110, 0, 0},
+    {0, 2, 117, 1, 0},
+    {0, 4, 125, 2, 0},
+    {0, 8, 125, 4, 0},
+};
+
+static sched_domain_t domains[MAX_CPUS][SCHED_DOMAIN_LEVELS];
+static uint32_t domains_online = 0;
+static uint32_t domains_nodes = 0;
+static spinlock_t domain_lock = 0;
+
+// Guards the process list and process lifecycle (create, kill, wait queues).
+// The tick path never takes it; it only uses its own CPU's runqueue lock.
 static spinlock_t sched_lock = 0;
 
 // List of all processes (for accounting/cleanup)
@@ -34,16 +99,32 @@ static uint32_t process_count = 0;
 
 // Current process (Per-CPU)
 static process_t* current_process[MAX_CPUS];
+// Task each CPU switched away from in the interrupt it is leaving; it stays
+// on_cpu until scheduler_finish_switch.
+static process_t* switch_prev[MAX_CPUS];
 
 static uint32_t default_priority = 10;
 static uint32_t default_time_slice = 4;
 
 static process_t* scheduler_pick_best_ready(void);
+static void scheduler_rearm(uint32_t cpu, process_t* running, uint64_t now_ns);
 
 process_t* scheduler_current(void) {
     return current_process[cpu_get_id()];
 }
 
+// Runs on the next task's stack before its registers are popped, after the
+// SIMD state has been handed over, so it must not touch xmm registers.
+FPU_NO_SIMD void scheduler_finish_switch(void) {
+    uint32_t cpu = cpu_get_id();
+    if (cpu >= MAX_CPUS) return;
+    process_t* prev = switch_prev[cpu];
+    if (prev) {
+        switch_prev[cpu] = 0;
+        __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
+    }
+}
+
 process_t* scheduler_process_list(void) {
     return process_list;
 }
@@ -95,76 +176,247 @@ static uint32_t alloc_pid(void) {
     return pid;
 }
 
+static int key_less(const rb_node_t* a, const rb_node_t* b) {
+    return rb_entry(a, process_t, run_node)->run_key < rb_entry(b, process_t, run_node)->run_key;
+}
+
+static uint32_t rt_level(const process_t* proc) {
+    return proc->priority < SCHED_RT_LEVELS ? proc->priority : SCHED_RT_LEVELS - 1;
+}
+
+static uint64_t dl_abs_deadline(const process_t* proc) {
+    return proc->rt_release + (proc->rt_deadline ? proc->rt_deadline : proc->rt_period);
+}
+
+// Budget spent and the period not yet renewed.
+static int dl_throttled(const process_t* proc, uint64_t now) {
+    return proc->rt_period > 0 && proc->rt_budget > 0 && proc->rt_runtime >= proc->rt_budget &&
+           now < proc->rt_release + proc->rt_period;
+}
+
+// A task's share of its CPU for balancing. CFS scales with the cgroup share
+// and priority, relative to SCHED_LOAD_SCALE at the defaults; RT and
+// DEADLINE tasks run ahead of all of CFS, so they count double.
+static uint32_t task_weight(const process_t* proc) {
+    if (proc->sched_class != SCHED_CLASS_CFS) {
+        return 2 * SCHED_LOAD_SCALE;
+    }
+    uint64_t share = proc->cgroup_share ? proc->cgroup_share : SCHED_LOAD_SCALE;
+    if (share > (1u << 16)) share = 1u << 16;
+    uint64_t weight = share * (proc->priority + 1) / (default_priority + 1);
+    if (weight == 0) weight = 1;
+    if (weight > (1u << 20)) weight = 1u << 20;
+    return (uint32_t)weight;
+}
+
+// rq->lock must be held.
+static void rq_add(runqueue_t* rq, process_t* proc) {
+    if (proc->on_rq) {
+        return;
+    }
+    proc->run_class = proc->sched_class;
+    if (proc->run_class == SCHED_CLASS_DEADLINE) {
+        proc->run_key = dl_abs_deadline(proc);
+        rb_insert(&rq->dl, &proc->run_node, key_less);
+    } else if (proc->run_class == SCHED_CLASS_RT) {
+        uint32_t level = rt_level(proc);
+        proc->run_key = level;
+        proc->run_next = 0;
+        proc->run_prev = rq->rt_tail[level];
+        if (rq->rt_tail[level]) {
+            rq->rt_tail[level]->run_next = proc;
+        } else {
+            rq->rt_head[level] = proc;
+        }
+        rq->rt_tail[level] = proc;
+        rq->rt_bitmap |= 1u << level;
+    } else {
+        proc->run_key = proc->vruntime;
+        rb_insert(&rq->cfs, &proc->run_node, key_less);
+    }
+    proc->on_rq = 1;
+    proc->ready_since = timer_get_ticks();
+    proc->run_weight = task_weight(proc);
+    rq->load += proc->run_weight;
+    rq->count++;
+}
+
+// rq->lock must be held.
+static void rq_remove(runqueue_t* rq, process_t* proc) {
+    if (!proc->on_rq) {
+        return;
+    }
+    if (proc->run_class == SCHED_CLASS_DEADLINE) {
+        rb_erase(&rq->dl, &proc->run_node);
+    } else if (proc->run_class == SCHED_CLASS_RT) {
+        uint32_t level = (uint32_t)proc->run_key;
+        if (proc->run_prev) {
+            proc->run_prev->run_next = proc->run_next;
+        } else {
+            rq->rt_head[level] = proc->run_next;
+        }
+        if (proc->run_next) {
+            proc->run_next->run_prev = proc->run_prev;
+        } else {
+            rq->rt_tail[level] = proc->run_prev;
+        }
+        if (!rq->rt_head[level]) {
+            rq->rt_bitmap &= ~(1u << level);
+        }
+        proc->run_next = 0;
+        proc->run_prev = 0;
+    } else {
+        rb_erase(&rq->cfs, &proc->run_node);
+    }
+    proc->on_rq = 0;
+    rq->load -= proc->run_weight;
+    rq->count--;
+}
+
+// Sends a reschedule IPI so a CPU with its tick stopped looks at its
+// runqueue now instead of at its next timer event.
+static void scheduler_kick(uint32_t cpu) {
+    if (cpu != cpu_get_id()) {
+        smp_send_ipi(cpu, 0x4000 | INT_LOCAL_TIMER);
+    }
+}
+
+static uint32_t cpu_load(uint32_t cpu);
+
 static void enqueue_task(process_t* proc) {
-    uint32_t best_cpu = 0;
-    uint32_t min_count = 0xFFFFFFFF;
     uint32_t online = smp_get_online_mask();
-    
-    // Find best CPU among online ones in mask
-    for (uint32_t i = 0; i < MAX_CPUS; i++) {
-        if ((online & (1 << i)) && (proc->cpu_mask & (1 << i)) && runqueues[i].count < min_count) {
-            min_count = runqueues[i].count;
+    uint32_t prev = proc->current_cpu < MAX_CPUS ? proc->current_cpu : 0;
+    uint32_t weight = task_weight(proc);
+    uint32_t best_cpu = 0;
+    uint64_t best_load = 0xFFFFFFFFFFFFFFFFull;
+    // Re-queued or woken while its CPU is still switching it out: only that
+    // CPU may take it, and not before it has left the task's stack.
+    int pinned = __atomic_load_n(&proc->on_cpu, __ATOMIC_ACQUIRE) != 0;
+
+    // Least loaded CPU the task may run on, counting the task's own weight
+    // against every CPU but the one it last ran on, so it only leaves its
+    // warm cache for a clear gain. Loads are read unlocked; the balancer
+    // corrects a stale guess.
+    for (uint32_t i = 0; i < MAX_CPUS && !pinned; i++) {
+        if (!(online & (1u << i)) || !(proc->cpu_mask & (1u << i))) continue;
+        uint64_t load = (uint64_t)cpu_load(i) + (i == prev ? 0 : weight);
+        if (load < best_load || (load == best_load && i == prev)) {
+            best_load = load;
             best_cpu = i;
         }
     }
-    
-    // Fallback if mask is invalid
-    if (!(proc->cpu_mask & (1 << best_cpu))) {
+
+    if (pinned) {
+        best_cpu = prev;
+    } else if (!(proc->cpu_mask & (1 << best_cpu))) {
+        // Fallback if mask is invalid
         best_cpu = 0;
     }
-    
+
     runqueue_t* rq = &runqueues[best_cpu];
     
     uint32_t flags = spin_lock_irqsave(&rq->lock);
-    
-    proc->run_next = 0;
-    proc->current_cpu = best_cpu;
-    
-    if (!rq->head) {
-        rq->head = proc;
-        rq->tail = proc;
-    } else {
-        rq->tail->run_next = proc;
-        rq->tail = proc;
+    int kick = 0;
+    if (!proc->on_rq && !proc->exited) {
+        proc->current_cpu = best_cpu;
+        rq_add(rq, proc);
+        kick = rq->tick_stopped;
     }
-    rq->count++;
-    
     spin_unlock_irqrestore(&rq->lock, flags);
+    if (kick) {
+        scheduler_kick(best_cpu);
+    }
 }
 
-static void dequeue_task(process_t* proc) {
-    uint32_t cpu = proc->current_cpu;
-    if (cpu >= MAX_CPUS) cpu = 0;
-    
+// Puts the task this CPU is switching out back on its own runqueue. No
+// placement and no kick: the CPU is still on the task's stack and re-arms
+// its own clock event before it returns, and moving the task elsewhere is
+// left to the balancer once it is off the CPU.
+static void requeue_outgoing(uint32_t cpu, process_t* proc) {
     runqueue_t* rq = &runqueues[cpu];
-    
     uint32_t flags = spin_lock_irqsave(&rq->lock);
-    
-    if (!rq->head) {
-        spin_unlock_irqrestore(&rq->lock, flags);
-        return;
+    if (!proc->on_rq && !proc->exited) {
+        proc->current_cpu = cpu;
+        rq_add(rq, proc);
     }
-    
-    if (rq->head == proc) {
-        rq->head = proc->run_next;
-        if (!rq->head) rq->tail = 0;
-        rq->count--;
-    } else {
-        process_t* prev = rq->head;
-        while (prev->run_next && prev->run_next != proc) {
-            prev = prev->run_next;
-        }
-        if (prev->run_next == proc) {
-            prev->run_next = proc->run_next;
-            if (rq->tail == proc) rq->tail = prev;
-            rq->count--;
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+static uint32_t task_cpu(const process_t* proc) {
+    uint32_t cpu = __atomic_load_n(&proc->current_cpu, __ATOMIC_ACQUIRE);
+    return cpu < MAX_CPUS ? cpu : 0;
+}
+
+// Locks the runqueue proc belongs to. The balancer and enqueue_task change
+// current_cpu only under the runqueue locks, so it is re-checked once the
+// lock is held and the lookup retried if the task moved in between.
+static runqueue_t* task_rq_lock(process_t* proc, uint32_t* flags) {
+    for (;;) {
+        uint32_t cpu = task_cpu(proc);
+        runqueue_t* rq = &runqueues[cpu];
+        *flags = spin_lock_irqsave(&rq->lock);
+        if (task_cpu(proc) == cpu) {
+            return rq;
         }
+        spin_unlock_irqrestore(&rq->lock, *flags);
     }
-    proc->run_next = 0;
-    
+}
+
+static void dequeue_task(process_t* proc) {
+    uint32_t flags;
+    runqueue_t* rq = task_rq_lock(proc, &flags);
+    rq_remove(rq, proc);
     spin_unlock_irqrestore(&rq->lock, flags);
 }
 
+// Re-sorts a queued task after its class or key changed; it stays on the
+// same CPU.
+static void requeue_task(process_t* proc) {
+    uint32_t flags;
+    runqueue_t* rq = task_rq_lock(proc, &flags);
+    if (proc->on_rq) {
+        rq_remove(rq, proc);
+        rq_add(rq, proc);
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+static int wake_less(const rb_node_t* a, const rb_node_t* b) {
+    return rb_entry(a, process_t, sleep_node)->wake_ns < rb_entry(b, process_t, sleep_node)->wake_ns;
+}
+
+// Parks a task this CPU just switched out asleep.
+static void sleeper_add(uint32_t cpu, process_t* proc) {
+    runqueue_t* rq = &runqueues[cpu];
+    uint32_t flags = spin_lock_irqsave(&rq->lock);
+    proc->current_cpu = cpu;
+    rb_insert(&rq->sleepers, &proc->sleep_node, wake_less);
+    proc->on_sleep = 1;
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+// Takes a sleeper off its timer tree. Returns 0 if it was not on one: still
+// running on its way out, or already expired and being woken.
+static int sleeper_cancel(process_t* proc) {
+    uint32_t flags;
+    runqueue_t* rq = task_rq_lock(proc, &flags);
+    int was_queued = proc->on_sleep;
+    if (was_queued) {
+        rb_erase(&rq->sleepers, &proc->sleep_node);
+        proc->on_sleep = 0;
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+    return was_queued;
+}
+
+static void make_ready(process_t* proc) {
+    proc->state = PROCESS_READY;
+    proc->wake_ns = 0;
+    proc->boost = 0;
+    proc->ready_ticks = 0;
+    proc->time_remaining = proc->time_slice;
+}
+
 static process_t* find_process_by_pid(uint32_t pid) {
     if (!process_list) return 0;
     process_t* it = process_list;
@@ -183,15 +435,17 @@ int scheduler_kill(uint32_t pid) {
         return 0;
     }
     
-    if (proc->state == PROCESS_READY) {
-        dequeue_task(proc);
-    }
+    // exited first, so a racing wakeup or requeue leaves it off the queues.
+    proc->exited = 1;
+    proc->exit_code = -1; // Killed
+    ai_session_destroy_owned(proc->pid);
+    __sync_synchronize();
+    dequeue_task(proc);
+    sleeper_cancel(proc);
     
     proc->state = PROCESS_BLOCKED;
-    proc->wake_tick = 0;
+    proc->wake_ns = 0;
     proc->time_remaining = 0;
-    proc->exited = 1;
-    proc->exit_code = -1; // Killed
     
     spin_unlock_irqrestore(&sched_lock, flags);
     return 1;
@@ -203,10 +457,10 @@ void scheduler_init(void) {
     sched_lock = 0;
     
     for (int i = 0; i < MAX_CPUS; i++) {
-        runqueues[i].head = 0;
-        runqueues[i].tail = 0;
-        runqueues[i].count = 0;
-        runqueues[i].lock = 0;
+        memset(&runqueues[i], 0, sizeof(runqueue_t));
+        rb_init(&runqueues[i].cfs);
+        rb_init(&runqueues[i].dl);
+        rb_init(&runqueues[i].sleepers);
         current_process[i] = 0;
     }
 }
@@ -230,6 +484,7 @@ static process_t* process_create_ex(void (*entry)(void), uint32_t* page_director
         return 0;
     }
     proc->kernel_stack = stack_ptr;
+    proc->fpu_nest = 1;
     
     proc->pid = pid;
     proc->state = PROCESS_BLOCKED; // Default to blocked until decided
@@ -311,6 +566,9 @@ void scheduler_set_priority(uint32_t pid, uint32_t priority) {
     process_t* proc = find_process_by_pid(pid);
     if (proc) {
         proc->priority = priority;
+        if (proc->sched_class == SCHED_CLASS_RT) {
+            requeue_task(proc);
+        }
     }
     spin_unlock_irqrestore(&sched_lock, flags);
 }
@@ -333,6 +591,7 @@ void scheduler_set_class(uint32_t pid, uint32_t sched_class) {
     process_t* proc = find_process_by_pid(pid);
     if (proc) {
         proc->sched_class = sched_class;
+        requeue_task(proc);
     }
     spin_unlock_irqrestore(&sched_lock, flags);
 }
@@ -342,6 +601,12 @@ void scheduler_set_affinity(uint32_t pid, uint32_t cpu_mask) {
     process_t* proc = find_process_by_pid(pid);
     if (proc) {
         proc->cpu_mask = cpu_mask;
+        // A queued task must not stay on a runqueue outside its new mask.
+        if (proc->state == PROCESS_READY && proc->current_cpu < MAX_CPUS &&
+            !(cpu_mask & (1u << proc->current_cpu))) {
+            dequeue_task(proc);
+            enqueue_task(proc);
+        }
     }
     spin_unlock_irqrestore(&sched_lock, flags);
 }
@@ -367,6 +632,7 @@ void scheduler_set_rt(uint32_t pid, uint32_t priority, uint64_t budget, uint64_t
         proc->rt_deadline = period;
         proc->rt_runtime = 0;
         proc->rt_release = timer_get_ticks();
+        requeue_task(proc);
     }
     spin_unlock_irqrestore(&sched_lock, flags);
 }
@@ -381,46 +647,60 @@ void scheduler_set_deadline(uint32_t pid, uint64_t budget, uint64_t period, uint
         proc->rt_deadline = deadline ? deadline : period;
         proc->rt_runtime = 0;
         proc->rt_release = timer_get_ticks();
+        requeue_task(proc);
     }
     spin_unlock_irqrestore(&sched_lock, flags);
 }
 
-void scheduler_sleep(uint64_t ticks) {
+void scheduler_sleep_ns(uint64_t ns) {
     // Cannot sleep without current process
     process_t* current = scheduler_current();
-    if (!current) return;
+    if (!current || ns == 0) return;
 
-    spin_lock(&sched_lock);
-    if (ticks > 0) {
-        current->wake_tick = timer_get_ticks() + ticks;
-        current->state = PROCESS_SLEEPING;
-        current->time_remaining = 0;
-        current->boost = 0;
-        current->ready_ticks = 0;
-    }
-    spin_unlock(&sched_lock);
+    // Only this CPU touches its running task's fields; the state goes last
+    // because switch_task keys off it.
+    current->wake_ns = clock_now_ns() + ns;
+    current->time_remaining = 0;
+    current->boost = 0;
+    current->ready_ticks = 0;
+    __sync_synchronize();
+    current->state = PROCESS_SLEEPING;
     
     // The next interrupt/yield will switch us out
 }
 
+void scheduler_sleep(uint64_t ticks) {
+    if (ticks > 0xFFFFFFFFFFFFFFFFull / CLOCK_NS_PER_TICK) {
+        ticks = 0xFFFFFFFFFFFFFFFFull / CLOCK_NS_PER_TICK;
+    }
+    scheduler_sleep_ns(ticks * CLOCK_NS_PER_TICK);
+}
+
 int scheduler_wake(uint32_t pid) {
     spin_lock(&sched_lock);
     process_t* proc = find_process_by_pid(pid);
-    if (!proc) {
+    if (!proc || proc->exited) {
         spin_unlock(&sched_lock);
         return 0;
     }
     
-    if (proc->state != PROCESS_SLEEPING && proc->state != PROCESS_BLOCKED) {
+    if (proc->state == PROCESS_SLEEPING) {
+        if (!sleeper_cancel(proc)) {
+            // Not parked yet; switch_task wakes it in place.
+            uint64_t now = clock_now_ns();
+            proc->wake_ns = now ? now : 1;
+            if (runqueues[proc->current_cpu % MAX_CPUS].tick_stopped) {
+                scheduler_kick(proc->current_cpu);
+            }
+            spin_unlock(&sched_lock);
+            return 1;
+        }
+    } else if (proc->state != PROCESS_BLOCKED) {
         spin_unlock(&sched_lock);
         return 0;
     }
     
-    proc->state = PROCESS_READY;
-    proc->wake_tick = 0;
-    proc->boost = 0;
-    proc->ready_ticks = 0;
-    proc->time_remaining = proc->time_slice;
+    make_ready(proc);
     enqueue_task(proc);
     spin_unlock(&sched_lock);
     return 1;
@@ -430,12 +710,10 @@ void scheduler_yield(void) {
     process_t* current = scheduler_current();
     if (!current) return;
     
-    spin_lock(&sched_lock);
     current->time_remaining = 0;
-    spin_unlock(&sched_lock);
     
-    // Force a switch
-    asm volatile("int $0x20"); // Assuming timer vector, or just wait for tick
+    // Force a switch without counting a PIT tick
+    asm volatile("int %0" : : "i"(INT_LOCAL_TIMER));
 }
 
 void scheduler_loop(void) {
@@ -449,7 +727,9 @@ void scheduler_loop(void) {
         
         if (best) {
             // Trigger a context switch via interrupt
-            asm volatile("int $0x20");
+            asm volatile("int %0" : : "i"(INT_LOCAL_TIMER));
+        } else {
+            scheduler_rearm(cpu_get_id(), scheduler_current(), clock_now_ns());
         }
         
         asm volatile("sti");
@@ -457,125 +737,271 @@ void scheduler_loop(void) {
     }
 }
 
-static void scheduler_wake_sleepers(uint64_t now) {
-    if (!process_list) return;
-    process_t* it = process_list;
-    do {
-        if (it->state == PROCESS_SLEEPING && it->wake_tick != 0 && now >= it->wake_tick) {
-            it->state = PROCESS_READY;
-            it->wake_tick = 0;
+// Moves this CPU's sleepers whose wake time has passed onto runqueues, at
+// O(log n) per task woken and nothing when none are due.
+static void scheduler_wake_sleepers(uint32_t cpu, uint64_t now_ns) {
+    runqueue_t* rq = &runqueues[cpu];
+    process_t* woken = 0;
+    
+    uint32_t flags = spin_lock_irqsave(&rq->lock);
+    rb_node_t* n;
+    while ((n = rb_first(&rq->sleepers)) != 0) {
+        process_t* proc = rb_entry(n, process_t, sleep_node);
+        if (proc->wake_ns > now_ns) break;
+        rb_erase(&rq->sleepers, n);
+        proc->on_sleep = 0;
+        // A sleeper is on no runqueue, so run_next is free to chain them.
+        proc->run_next = woken;
+        woken = proc;
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+    
+    while (woken) {
+        process_t* next = woken->run_next;
+        woken->run_next = 0;
+        if (!woken->exited) {
+            make_ready(woken);
+            enqueue_task(woken);
+        }
+        woken = next;
+    }
+}
+
+// Charges the task running on this CPU for the jiffies since the last
+// event; with the tick stopped that can be many at once, or none for an
+// event between two jiffies. Queued tasks are not touched; their wait is
+// derived from ready_since when it matters.
+static void scheduler_account_tick(process_t* it, uint64_t now, uint64_t now_ns, uint64_t elapsed) {
+    if (it->state != PROCESS_RUNNING || elapsed == 0) return;
+    it->runtime_ticks += elapsed;
+    uint32_t share = it->cgroup_share ? it->cgroup_share : 1;
+    it->vruntime += elapsed * ((1024u / share) + 1u);
+    if ((it->sched_class == SCHED_CLASS_RT || it->sched_class == SCHED_CLASS_DEADLINE) && it->rt_period > 0) {
+        if (now >= it->rt_release + it->rt_period) {
+            it->rt_release = now;
+            it->rt_runtime = 0;
+        }
+        it->rt_runtime += elapsed;
+        if (it->rt_budget > 0 && it->rt_runtime >= it->rt_budget) {
+            it->wake_ns = now_ns + (it->rt_release + it->rt_period - now) * CLOCK_NS_PER_TICK;
+            it->time_remaining = 0;
             it->boost = 0;
             it->ready_ticks = 0;
-            it->time_remaining = it->time_slice;
-            enqueue_task(it);
+            it->state = PROCESS_SLEEPING;
         }
-        it = it->next;
-    } while (it != process_list);
+    }
 }
 
-static void scheduler_account_tick(void) {
-    if (!process_list) return;
-    uint64_t now = timer_get_ticks();
-    process_t* it = process_list;
-    do {
-        if (it->state == PROCESS_READY) {
-            it->ready_ticks++;
-            if (it->boost < MAX_PRIORITY_BOOST) {
-                it->boost++;
-            }
-        } else if (it->state == PROCESS_RUNNING) {
-            it->runtime_ticks++;
-            uint32_t share = it->cgroup_share ? it->cgroup_share : 1;
-            it->vruntime += (1024u / share) + 1u;
-            if ((it->sched_class == SCHED_CLASS_RT || it->sched_class == SCHED_CLASS_DEADLINE) && it->rt_period > 0) {
-                if (now >= it->rt_release + it->rt_period) {
-                    it->rt_release = now;
-                    it->rt_runtime = 0;
-                }
-                it->rt_runtime++;
-                if (it->rt_budget > 0 && it->rt_runtime >= it->rt_budget) {
-                    it->state = PROCESS_SLEEPING;
-                    it->wake_tick = it->rt_release + it->rt_period;
-                    it->time_remaining = 0;
-                    it->boost = 0;
-                    it->ready_ticks = 0;
-                }
-            }
+// Ages a queued task by how long it has waited, as the old per-tick walk
+// did one tick at a time.
+static void scheduler_age(process_t* proc, uint64_t now) {
+    uint64_t waited = now > proc->ready_since ? now - proc->ready_since : 0;
+    proc->ready_ticks = waited;
+    proc->boost = waited < MAX_PRIORITY_BOOST ? (uint32_t)waited : MAX_PRIORITY_BOOST;
+}
+
+// A task re-queued by its CPU's switch stays put until that CPU has left
+// its stack.
+static int can_steal(const process_t* proc, uint32_t cpu) {
+    return proc->state == PROCESS_READY && (proc->cpu_mask & (1u << cpu)) &&
+           !__atomic_load_n(&proc->on_cpu, __ATOMIC_ACQUIRE);
+}
+
+// Rebuilds the domain spans when CPUs come online or NUMA nodes appear.
+// Each level contains the one below it, so a task only moves further when
+// the nearer CPUs cannot take it.
+static void scheduler_build_domains(uint32_t online, uint32_t nodes) {
+    uint32_t flags = spin_lock_irqsave(&domain_lock);
+    if (domains_online == online && domains_nodes == nodes) {
+        spin_unlock_irqrestore(&domain_lock, flags);
+        return;
+    }
+    uint32_t smt_bits = 0;
+    uint32_t pkg_bits = 0;
+    cpu_get_topology(&smt_bits, &pkg_bits);
+    for (uint32_t i = 0; i < MAX_CPUS; ++i) {
+        if (!(online & (1u << i))) continue;
+        uint32_t span[SCHED_DOMAIN_LEVELS] = {0, 0, 0, online};
+        for (uint32_t j = 0; j < MAX_CPUS; ++j) {
+            if (!(online & (1u << j))) continue;
+            if ((i >> smt_bits) == (j >> smt_bits)) span[SCHED_DOMAIN_SMT] |= 1u << j;
+            if ((i >> pkg_bits) == (j >> pkg_bits)) span[SCHED_DOMAIN_PKG] |= 1u << j;
+            if (numa_preferred_node(i) == numa_preferred_node(j)) span[SCHED_DOMAIN_NUMA] |= 1u << j;
         }
-        it = it->next;
-    } while (it != process_list);
+        span[SCHED_DOMAIN_PKG] |= span[SCHED_DOMAIN_SMT];
+        span[SCHED_DOMAIN_NUMA] |= span[SCHED_DOMAIN_PKG];
+        for (uint32_t level = 0; level < SCHED_DOMAIN_LEVELS; ++level) {
+            domains[i][level] = domain_params[level];
+            domains[i][level].span = span[level];
+        }
+    }
+    domains_nodes = nodes;
+    __sync_synchronize();
+    domains_online = online;
+    spin_unlock_irqrestore(&domain_lock, flags);
 }
 
-void scheduler_balance_load(void) {
-    uint32_t this_cpu = cpu_get_id();
-    runqueue_t* this_rq = &runqueues[this_cpu];
-    
-    // Only balance if we are empty
-    if (this_rq->count > 0) return;
-    
+// Load a CPU carries: its queued weight plus whatever it is running.
+static uint32_t cpu_load(uint32_t cpu) {
+    return runqueues[cpu].load + runqueues[cpu].curr_weight;
+}
+
+// Recently switched out, so probably still in this CPU's caches. Tasks
+// that run whole slices at a time stay hot twice as long.
+static int task_hot(const process_t* proc, uint32_t cost, uint64_t now) {
+    if (cost == 0) return 0;
+    if (proc->avg_run >= proc->time_slice) cost *= 2;
+    return now - proc->last_ran < cost;
+}
+
+typedef struct {
+    runqueue_t* src;
+    runqueue_t* dst;
+    uint32_t cpu;
+    uint32_t cost;
+    uint64_t now;
+    int allow_hot;
+    uint32_t remaining;
+    uint32_t moved;
+} balance_env_t;
+
+// Moves proc if it fits what is left of the imbalance. Returns 1 once
+// nothing more should move. Both locks must be held.
+static int balance_try_move(balance_env_t* env, process_t* proc) {
+    if (!can_steal(proc, env->cpu)) return 0;
+    // Moving something much larger than the gap only flips the imbalance.
+    if (proc->run_weight / 2 > env->remaining) return 0;
+    if (!env->allow_hot && task_hot(proc, env->cost, env->now)) return 0;
+    uint64_t src_min = env->src->cfs.leftmost ? rb_entry(rb_first(&env->src->cfs), process_t, run_node)->run_key : 0;
+    rq_remove(env->src, proc);
+    // vruntime only means something against the queue it sits in: keep
+    // the task's lead over the source's minimum on the destination.
+    if (proc->run_class == SCHED_CLASS_CFS && env->dst->cfs.leftmost) {
+        uint64_t dst_min = rb_entry(rb_first(&env->dst->cfs), process_t, run_node)->run_key;
+        uint64_t lead = proc->vruntime > src_min ? proc->vruntime - src_min : 0;
+        proc->vruntime = dst_min + lead;
+    }
+    proc->current_cpu = env->cpu;
+    rq_add(env->dst, proc);
+    env->moved++;
+    env->remaining = proc->run_weight >= env->remaining ? 0 : env->remaining - proc->run_weight;
+    return env->remaining == 0 || env->moved >= SCHED_BALANCE_MAX_MOVES;
+}
+
+// CFS from the largest vruntime down, since those tasks have the longest
+// wait ahead of them anyway, then RT from the lowest level, then DEADLINE.
+static void balance_detach(balance_env_t* env) {
+    rb_node_t* n = rb_last(&env->src->cfs);
+    while (n) {
+        rb_node_t* prev = rb_prev(n);
+        if (balance_try_move(env, rb_entry(n, process_t, run_node))) return;
+        n = prev;
+    }
+    for (uint32_t level = 0; level < SCHED_RT_LEVELS; ++level) {
+        process_t* proc = env->src->rt_head[level];
+        while (proc) {
+            process_t* next = proc->run_next;
+            if (balance_try_move(env, proc)) return;
+            proc = next;
+        }
+    }
+    rb_node_t* d = rb_first(&env->src->dl);
+    while (d) {
+        rb_node_t* next = rb_next(d);
+        if (balance_try_move(env, rb_entry(d, process_t, run_node))) return;
+        d = next;
+    }
+}
+
+// Pulls load into this_cpu from the busiest CPU of one domain. Returns the
+// number of tasks moved.
+static uint32_t balance_domain(uint32_t this_cpu, sched_domain_t* sd, uint64_t now, int allow_hot) {
+    uint32_t this_load = cpu_load(this_cpu);
     uint32_t busiest_cpu = this_cpu;
-    uint32_t max_count = 0;
-    uint32_t online = smp_get_online_mask();
-    
-    for (uint32_t i = 0; i < MAX_CPUS; i++) {
-        if ((online & (1 << i)) && runqueues[i].count > max_count) {
-            max_count = runqueues[i].count;
+    uint32_t busiest_load = 0;
+    for (uint32_t i = 0; i < MAX_CPUS; ++i) {
+        // Only queued tasks can move, so a CPU with none is never busiest.
+        if (i == this_cpu || !(sd->span & (1u << i)) || runqueues[i].count == 0) continue;
+        uint32_t load = cpu_load(i);
+        if (load > busiest_load) {
+            busiest_load = load;
             busiest_cpu = i;
         }
     }
-    
-    if (busiest_cpu == this_cpu || max_count <= 1) return;
-    
-    runqueue_t* remote_rq = &runqueues[busiest_cpu];
-    
+    if (busiest_cpu == this_cpu) return 0;
+    // Not worth a migration unless the busiest is clearly ahead.
+    if ((uint64_t)busiest_load * 100u <= (uint64_t)this_load * sd->imbalance_pct) return 0;
+
+    balance_env_t env;
+    env.src = &runqueues[busiest_cpu];
+    env.dst = &runqueues[this_cpu];
+    env.cpu = this_cpu;
+    env.cost = sd->migration_cost;
+    env.now = now;
+    env.allow_hot = allow_hot || sd->failed > SCHED_BALANCE_FAIL_LIMIT;
+    env.remaining = (busiest_load - this_load) / 2;
+    env.moved = 0;
+    if (env.remaining == 0) return 0;
+
     // Lock ordering to prevent deadlocks
     uint32_t id1 = (this_cpu < busiest_cpu) ? this_cpu : busiest_cpu;
     uint32_t id2 = (this_cpu < busiest_cpu) ? busiest_cpu : this_cpu;
-    
     uint32_t flags = spin_lock_irqsave(&runqueues[id1].lock);
-    if (id1 != id2) spin_lock(&runqueues[id2].lock);
-    
-    // Try to find a victim in the remote queue
-    process_t* prev = 0;
-    process_t* victim = remote_rq->head;
-    
-    while (victim) {
-        if (victim->state == PROCESS_READY && (victim->cpu_mask & (1 << this_cpu))) {
-            // Found a victim!
-            if (prev) {
-                prev->run_next = victim->run_next;
-            } else {
-                remote_rq->head = victim->run_next;
-            }
-            
-            if (remote_rq->tail == victim) {
-                remote_rq->tail = prev;
-            }
-            
-            remote_rq->count--;
-            
-            // Add to local
-            victim->run_next = 0;
-            victim->current_cpu = this_cpu;
-            
-            if (!this_rq->head) {
-                this_rq->head = victim;
-                this_rq->tail = victim;
-            } else {
-                this_rq->tail->run_next = victim;
-                this_rq->tail = victim;
-            }
-            this_rq->count++;
-            
-            // For now, just steal one to keep it simple and fast
-            break;
+    spin_lock(&runqueues[id2].lock);
+    balance_detach(&env);
+    spin_unlock(&runqueues[id2].lock);
+    spin_unlock_irqrestore(&runqueues[id1].lock, flags);
+
+    // Only hot tasks in the way: after enough misses take them anyway.
+    sd->failed = env.moved ? 0 : sd->failed + 1;
+    return env.moved;
+}
+
+// Domains whose span adds nothing over the level below are skipped.
+static int domain_degenerate(const sched_domain_t* sd, uint32_t level, uint32_t cpu) {
+    if ((sd->span & ~(1u << cpu)) == 0) return 1;
+    return level > 0 && sd->span == domains[cpu][level - 1].span;
+}
+
+static void scheduler_refresh_domains(void) {
+    uint32_t online = smp_get_online_mask();
+    uint32_t nodes = numa_node_count();
+    if (online != domains_online || nodes != domains_nodes) {
+        scheduler_build_domains(online, nodes);
+    }
+}
+
+// Runs from the tick: each domain level is balanced on its own interval,
+// the nearest levels most often.
+static void scheduler_periodic_balance(uint32_t cpu, uint64_t now) {
+    scheduler_refresh_domains();
+    if (!(domains_online & (1u << cpu))) return;
+    runqueue_t* rq = &runqueues[cpu];
+    for (uint32_t level = 0; level < SCHED_DOMAIN_LEVELS; ++level) {
+        sched_domain_t* sd = &domains[cpu][level];
+        if (now < rq->next_balance[level] || domain_degenerate(sd, level, cpu)) continue;
+        rq->next_balance[level] = now + sd->interval;
+        balance_domain(cpu, sd, now, 0);
+    }
+}
+
+// Newly idle: pull from the nearest domain that has anything to give,
+// respecting cache-hot tasks on the first pass and not on the second, since
+// an idle CPU costs more than a cold cache.
+void scheduler_balance_load(void) {
+    uint32_t this_cpu = cpu_get_id();
+    if (runqueues[this_cpu].count > 0) return;
+    scheduler_refresh_domains();
+    if (!(domains_online & (1u << this_cpu))) return;
+
+    uint64_t now = timer_get_ticks();
+    for (int allow_hot = 0; allow_hot < 2; ++allow_hot) {
+        for (uint32_t level = 0; level < SCHED_DOMAIN_LEVELS; ++level) {
+            sched_domain_t* sd = &domains[this_cpu][level];
+            if (domain_degenerate(sd, level, this_cpu)) continue;
+            if (balance_domain(this_cpu, sd, now, allow_hot)) return;
         }
-        prev = victim;
-        victim = victim->run_next;
     }
-    
-    if (id1 != id2) spin_unlock(&runqueues[id2].lock);
-    spin_unlock_irqrestore(&runqueues[id1].lock, flags);
 }
 
 static uint32_t scheduler_effective_priority(const process_t* proc) {
@@ -586,106 +1012,169 @@ static uint32_t scheduler_effective_priority(const process_t* proc) {
     return value;
 }
 
+// A queued task this CPU may take: not still on another switch's stack.
+// current can be queued while on_cpu here, woken before it left the CPU.
+static int rq_can_run(const process_t* proc, const process_t* current) {
+    return proc == current || !__atomic_load_n(&proc->on_cpu, __ATOMIC_ACQUIRE);
+}
+
+// DEADLINE before RT before CFS. Within DEADLINE the earliest deadline
+// that still has budget; within RT the first task of the highest level;
+// within CFS the smallest vruntime. Tasks rq_can_run rejects are passed
+// over, so they never hide the ones queued behind them. rq->lock must be
+// held.
+static process_t* rq_pick(runqueue_t* rq, uint64_t now, const process_t* current) {
+    if (rq->dl.count) {
+        // Throttled tasks normally sleep out their period, so this loop
+        // rarely passes more than the first node.
+        for (rb_node_t* n = rb_first(&rq->dl); n; n = rb_next(n)) {
+            process_t* proc = rb_entry(n, process_t, run_node);
+            if (!dl_throttled(proc, now) && rq_can_run(proc, current)) {
+                return proc;
+            }
+        }
+    }
+    uint32_t bitmap = rq->rt_bitmap;
+    while (bitmap) {
+        uint32_t level = 31u - (uint32_t)__builtin_clz(bitmap);
+        for (process_t* proc = rq->rt_head[level]; proc; proc = proc->run_next) {
+            if (rq_can_run(proc, current)) {
+                return proc;
+            }
+        }
+        bitmap &= ~(1u << level);
+    }
+    for (rb_node_t* n = rb_first(&rq->cfs); n; n = rb_next(n)) {
+        process_t* proc = rb_entry(n, process_t, run_node);
+        if (rq_can_run(proc, current)) {
+            return proc;
+        }
+    }
+    return 0;
+}
+
 static process_t* scheduler_pick_best_ready(void) {
-    uint32_t cpu = cpu_get_id();
+    runqueue_t* rq = &runqueues[cpu_get_id()];
+    uint32_t flags = spin_lock_irqsave(&rq->lock);
+    process_t* best = rq_pick(rq, timer_get_ticks(), scheduler_current());
+    spin_unlock_irqrestore(&rq->lock, flags);
+    return best;
+}
+
+// Whether best should take the CPU from a current task that could keep
+// running.
+static int scheduler_should_preempt(process_t* current, process_t* best, uint64_t now) {
+    if (current->time_remaining == 0) return 1;
+    // Priority class overrides
+    if (best->sched_class > current->sched_class) return 1;
+    if (best->sched_class != current->sched_class) return 0;
+    if (best->sched_class == SCHED_CLASS_RT) {
+        scheduler_age(best, now);
+        return scheduler_effective_priority(best) > scheduler_effective_priority(current);
+    }
+    if (best->sched_class == SCHED_CLASS_CFS) {
+        return best->vruntime < current->vruntime;
+    }
+    return 0;
+}
+
+// Picks and removes the next task for cpu, or returns 0 when there is none
+// or a still-running current should keep the CPU. Returns current itself if
+// it was woken onto the queue before it left the CPU and is still the best
+// choice. Picking and removing under one hold of the lock keeps a balancing
+// CPU from stealing it in between.
+static process_t* scheduler_take_next(uint32_t cpu, process_t* current, uint64_t now) {
     runqueue_t* rq = &runqueues[cpu];
-    
     uint32_t flags = spin_lock_irqsave(&rq->lock);
-    
-    if (!rq->head) {
-        spin_unlock_irqrestore(&rq->lock, flags);
-        return 0;
+    process_t* best = rq_pick(rq, now, current);
+    if (best && current && current->state == PROCESS_RUNNING &&
+        !scheduler_should_preempt(current, best, now)) {
+        best = 0;
     }
-    
-    process_t* it = rq->head;
-    process_t* best = 0;
-    uint32_t best_prio = 0;
-    uint64_t best_vruntime = 0;
-    uint64_t best_deadline = 0;
-    uint64_t now = timer_get_ticks();
-    
-    while (it) {
-        // Deadline Logic
-        if (it->sched_class == SCHED_CLASS_DEADLINE) {
-            // Check if blocked by budget
-            if (it->rt_period > 0 && it->rt_budget > 0 && it->rt_runtime >= it->rt_budget && now < it->rt_release + it->rt_period) {
-                it = it->run_next;
-                continue;
-            }
-            
-            uint64_t abs_deadline = it->rt_release + (it->rt_deadline ? it->rt_deadline : it->rt_period);
-            if (!best || best->sched_class != SCHED_CLASS_DEADLINE || abs_deadline < best_deadline) {
-                best = it;
-                best_deadline = abs_deadline;
-            }
-        } 
-        // RT Logic
-        else if (it->sched_class == SCHED_CLASS_RT) {
-            if (best && best->sched_class == SCHED_CLASS_DEADLINE) {
-                // Deadline trumps RT
-            } else {
-                uint32_t prio = scheduler_effective_priority(it);
-                if (!best || best->sched_class != SCHED_CLASS_RT || prio > best_prio) {
-                    best = it;
-                    best_prio = prio;
-                }
-            }
-        } 
-        // CFS Logic
-        else {
-            if (best && (best->sched_class == SCHED_CLASS_RT || best->sched_class == SCHED_CLASS_DEADLINE)) {
-                // RT/Deadline trumps CFS
-            } else {
-                if (!best) {
-                    best = it;
-                    best_vruntime = it->vruntime;
-                } else if (it->vruntime < best_vruntime || (it->vruntime == best_vruntime && it->ready_ticks > best->ready_ticks)) {
-                    best = it;
-                    best_vruntime = it->vruntime;
-                }
-            }
-        }
-        it = it->run_next;
+    if (best) {
+        rq_remove(rq, best);
     }
-    
     spin_unlock_irqrestore(&rq->lock, flags);
-    
     return best;
 }
 
-process_t* switch_task(registers_t* saved_stack, process_t** previous) {
-    serial_write_string("S"); // S for switch
-    uint32_t flags = spin_lock_irqsave(&sched_lock);
-    
-    uint32_t cpu = cpu_get_id();
+// Arms this CPU's one-shot for its next event. With tasks queued it keeps
+// a tick every jiffy for slices and preemption; idle or with a single task
+// it stops the tick and only wakes for its earliest sleeper, at most
+// SCHED_MAX_IDLE_NS out. CPU0 keeps the PIT as its tick and the jiffy
+// clock, so there the one-shot only covers sleepers due between jiffies.
+static void scheduler_rearm(uint32_t cpu, process_t* running, uint64_t now_ns) {
+    if (clockevent_mode() == CLOCKEVENT_NONE) return;
+
+    runqueue_t* rq = &runqueues[cpu];
+    uint64_t next = now_ns + SCHED_MAX_IDLE_NS;
+    int need_tick = 0;
+    if (running && running->state == PROCESS_SLEEPING && running->wake_ns && running->wake_ns < next) {
+        next = running->wake_ns;
+    }
+    // Budgets are charged by the jiffy, so a budgeted RT or deadline task
+    // keeps the tick.
+    if (running && running->state == PROCESS_RUNNING && running->sched_class != SCHED_CLASS_CFS &&
+        running->rt_budget > 0) {
+        need_tick = 1;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&rq->lock);
+    rb_node_t* first = rb_first(&rq->sleepers);
+    if (first && rb_entry(first, process_t, sleep_node)->wake_ns < next) {
+        next = rb_entry(first, process_t, sleep_node)->wake_ns;
+    }
+    if (rq->count > 0) {
+        need_tick = 1;
+    }
+    // Under the lock, so enqueue_task either sees it set or its task was
+    // counted above.
+    rq->tick_stopped = !need_tick && cpu != 0;
+    spin_unlock_irqrestore(&rq->lock, flags);
+
+    if (need_tick && cpu != 0 && now_ns + CLOCK_NS_PER_TICK < next) {
+        next = now_ns + CLOCK_NS_PER_TICK;
+    }
+    clockevent_program(next);
+}
+
+static process_t* scheduler_switch(registers_t* saved_stack, process_t** previous, uint32_t cpu,
+                                   uint64_t now, uint64_t now_ns) {
     process_t* current = current_process[cpu];
-    
-    uint64_t now = timer_get_ticks();
-    scheduler_wake_sleepers(now);
-    scheduler_account_tick();
+    runqueue_t* rq = &runqueues[cpu];
+    uint64_t elapsed = now > rq->last_tick ? now - rq->last_tick : 0;
+    rq->last_tick = now;
+
+    scheduler_wake_sleepers(cpu, now_ns);
 
     if (!current) {
-        process_t* best = scheduler_pick_best_ready();
+        process_t* best = scheduler_take_next(cpu, 0, now);
         if (best) {
             serial_write_string("DEBUG: Initial switch to PID ");
             serial_write_hex32(best->pid);
             serial_write_string("\n");
-            dequeue_task(best);
             current_process[cpu] = best;
+            best->on_cpu = 1;
             best->state = PROCESS_RUNNING;
             best->time_remaining = best->time_slice;
+            best->run_start = best->runtime_ticks;
             if (previous) *previous = 0;
-            spin_unlock_irqrestore(&sched_lock, flags);
             return best;
         }
         if (previous) *previous = 0;
-        spin_unlock_irqrestore(&sched_lock, flags);
         return 0;
     }
 
+    scheduler_account_tick(current, now, now_ns, elapsed);
+    // Due (or woken early) before it was ever switched out, so it was never
+    // parked on the timer tree: it simply keeps the CPU.
+    if (current->state == PROCESS_SLEEPING && current->wake_ns && now_ns >= current->wake_ns) {
+        current->wake_ns = 0;
+        current->state = PROCESS_RUNNING;
+    }
+
     if (!process_list) {
         if (previous) *previous = current;
-        spin_unlock_irqrestore(&sched_lock, flags);
         return current;
     }
 
@@ -712,79 +1201,94 @@ process_t* switch_task(registers_t* saved_stack, process_t** previous) {
     current->ss = saved_stack->ss;
 
     if (current->state == PROCESS_RUNNING) {
-        if (current->time_remaining > 0) {
-            current->time_remaining--;
+        if (elapsed >= current->time_remaining) {
+            current->time_remaining = 0;
+        } else {
+            current->time_remaining -= (uint32_t)elapsed;
         }
     }
 
-    process_t* best = scheduler_pick_best_ready();
+    scheduler_periodic_balance(cpu, now);
+    process_t* best = scheduler_take_next(cpu, current, now);
     
     // SMP Load Balance if idle
     if (!best) {
         scheduler_balance_load();
-        best = scheduler_pick_best_ready();
+        best = scheduler_take_next(cpu, current, now);
     }
     
-    // Preemption Logic
+    if (best && best == current) {
+        // Blocked with nothing else to run, then woken and queued while it
+        // still held the CPU: it simply carries on.
+        current->state = PROCESS_RUNNING;
+        best = 0;
+    }
+
+    if (!best) {
+        // Nothing else to run: a running task carries on with a new slice,
+        // anything else idles in its own context until something wakes.
+        if (current->state == PROCESS_RUNNING && current->time_remaining == 0) {
+            current->time_remaining = current->time_slice;
+        }
+        return current;
+    }
+
     if (current->state == PROCESS_RUNNING) {
-        // If we still have time, check if someone BETTER showed up (preemption)
-        if (current->time_remaining > 0) {
-            uint32_t current_prio = scheduler_effective_priority(current);
-            uint32_t best_prio = best ? scheduler_effective_priority(best) : 0;
-            
-            int switch_needed = 0;
-            if (best) {
-                // Priority class overrides
-                if (best->sched_class > current->sched_class) switch_needed = 1; 
-                else if (best->sched_class == current->sched_class) {
-                     if (best->sched_class == SCHED_CLASS_RT && best_prio > current_prio) switch_needed = 1;
-                     else if (best->sched_class == SCHED_CLASS_CFS && best->vruntime < current->vruntime) switch_needed = 1;
-                }
-            }
-            
-            if (!switch_needed) {
-                spin_unlock_irqrestore(&sched_lock, flags);
-                return current;
-            }
-        } else {
+        if (current->time_remaining == 0) {
             // Time slice expired
             current->time_remaining = current->time_slice;
         }
         current->state = PROCESS_READY;
         current->boost = 0;
         current->ready_ticks = 0;
-        enqueue_task(current);
-    }
-
-    if (!best) {
-        // Idle?
-        spin_unlock_irqrestore(&sched_lock, flags);
-        return current;
+        // It no longer loads this CPU as the running task.
+        rq->curr_weight = 0;
+        requeue_outgoing(cpu, current);
+    } else if (current->state == PROCESS_SLEEPING && current->wake_ns) {
+        sleeper_add(cpu, current);
     }
 
     if (best != current) {
+        current->last_ran = now;
+        current->avg_run = (current->avg_run * 3 + (current->runtime_ticks - current->run_start)) / 4;
+        best->run_start = best->runtime_ticks;
         serial_write_string("DEBUG: Switching PID ");
         serial_write_hex32(current->pid);
         serial_write_string(" -> ");
         serial_write_hex32(best->pid);
         serial_write_string("\n");
-        // serial_write_string("DEBUG: Switching to process: ");
-        // serial_write_string(best->name);
-        // serial_write_string("\n");
     }
 
-    dequeue_task(best);
     current_process[cpu] = best;
+    best->on_cpu = 1;
+    if (best != current) {
+        switch_prev[cpu] = current;
+    }
     best->state = PROCESS_RUNNING;
     best->time_remaining = best->time_slice;
     best->boost = 0;
     best->ready_ticks = 0;
     best->switches++;
 
-    spin_unlock_irqrestore(&sched_lock, flags);
     return best;
 }
 
+// Runs on every CPU's tick or clock event without any global lock: it
+// wakes this CPU's due sleepers, charges only the running task and picks
+// from this CPU's runqueue, so its cost does not grow with the number of
+// processes. It then arms the CPU's next event.
+process_t* switch_task(registers_t* saved_stack, process_t** previous) {
+    serial_write_string("S"); // S for switch
+
+    uint32_t cpu = cpu_get_id();
+    uint64_t now = timer_get_ticks();
+    uint64_t now_ns = clock_now_ns();
+    process_t* next = scheduler_switch(saved_stack, previous, cpu, now, now_ns);
+    runqueues[cpu].curr_weight = next && next->state == PROCESS_RUNNING ? task_weight(next) : 0;
+    scheduler_rearm(cpu, next, now_ns);
+    return next;
+}
+
 process_t* process_fork(process_t* parent, registers_t* regs) {
     if (!parent) parent = scheduler_current();
     if (!parent) return 0;
@@ -838,10 +1342,11 @@ process_t* process_fork(process_t* parent, registers_t* regs) {
     }
     
     child->eax = 0; // Fork returns 0 to child
+    fpu_copy(child, parent);
     
     // Now make it ready
     child->state = PROCESS_READY;
-    child->wake_tick = 0;
+    child->wake_ns = 0;
     child->boost = 0;
     child->ready_ticks = 0;
     child->time_remaining = child->time_slice;
@@ -878,6 +1383,7 @@ registers_t* process_exec(process_t* proc, void (*entry)(void)) {
         frame->ss = 0;
         
         // Update process registers
+        fpu_reset(proc);
         proc->esp = (uint32_t)frame;
         proc->ebp = frame->ebp;
         proc->eip = frame->eip;
@@ -981,6 +1487,7 @@ registers_t* process_exec_elf(process_t* proc, const uint8_t* elf_data, uint32_t
         frame->eip = image.entry;
         frame->eflags = 0x202;
         
+        fpu_reset(proc);
         proc->esp = (uint32_t)frame;
         proc->eip = frame->eip;
         
@@ -999,6 +1506,8 @@ void process_exit(process_t* proc, uint32_t code) {
     proc->exit_code = code;
     proc->exited = 1;
     proc->state = PROCESS_BLOCKED;
+    // Covers signals as well as SYS_EXIT.
+    ai_session_destroy_owned(proc->pid);
     
     // Wake parent
     process_t* parent = find_process_by_pid(proc->parent_pid);
@@ -1079,6 +1588,10 @@ int process_wait(uint32_t pid, uint32_t* exit_code) {
         if (child != (process_t*)1 && child->exited) {
             // Found zombie
             if (exit_code) *exit_code = child->exit_code;
+            // Its last switch may still be running on its kernel stack.
+            while (__atomic_load_n(&child->on_cpu, __ATOMIC_ACQUIRE)) {
+                asm volatile("pause");
+            }
             
             // Remove from list
             list_remove(child);
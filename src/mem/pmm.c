@@ -145,6 +145,50 @@ uint32_t pmm_alloc_block(void) {
     return 0;
 }
 
+uint32_t pmm_alloc_contiguous(uint32_t count) {
+    if (count == 0) {
+        return 0;
+    }
+    if (count == 1) {
+        return pmm_alloc_block();
+    }
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    if (!pmm_bitmap || pmm_used_block_count + count > pmm_max_blocks) {
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        return 0;
+    }
+
+    // First-fit scan for a run of free blocks; full words break the run early.
+    uint32_t run_start = 0;
+    uint32_t run_len = 0;
+    for (uint32_t index = 0; index < pmm_max_blocks; ++index) {
+        if ((index % 32) == 0 && pmm_bitmap[index / 32] == 0xFFFFFFFFu) {
+            run_len = 0;
+            index += 31;
+            continue;
+        }
+        if (bitmap_test(index)) {
+            run_len = 0;
+            continue;
+        }
+        if (run_len == 0) {
+            run_start = index;
+        }
+        run_len++;
+        if (run_len == count) {
+            for (uint32_t i = run_start; i < run_start + count; ++i) {
+                bitmap_set(i);
+            }
+            pmm_used_block_count += count;
+            spin_unlock_irqrestore(&pmm_lock, flags);
+            return pmm_base + run_start * PMM_BLOCK_SIZE;
+        }
+    }
+
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return 0;
+}
+
 void pmm_free_block(uint32_t address) {
     uint32_t flags = spin_lock_irqsave(&pmm_lock);
     if (!pmm_bitmap) {
@@ -31,6 +31,9 @@ int vm_space_clone_cow(process_t* parent, process_t* child) {
     child->region_count = 0;
     for (uint32_t i = 0; i < parent->region_count; ++i) {
         vm_region_t region = parent->regions[i];
+        if (region.flags & VM_NOFORK) {
+            continue;
+        }
         if (region.flags & VM_SHARED) {
             if (!vm_map_shared(child, region.shared_id, region.start)) {
                 return 0;
@@ -81,13 +81,16 @@ int vm_unmap_region(process_t* proc, uint32_t start, uint32_t size) {
     for (uint32_t i = 0; i < proc->region_count; ++i) {
         vm_region_t* region = &proc->regions[i];
         if (region->start == base && region->end == end) {
-            if (!(region->flags & (VM_GUARD | VM_DEMAND | VM_SHARED))) {
+            if (!(region->flags & (VM_GUARD | VM_DEMAND))) {
                 uintptr_t* dir = (uintptr_t*)proc->page_directory;
                 if (!dir) dir = mmu_get_current_space();
                 for (uint32_t addr = base; addr < end; addr += VM_PAGE_SIZE) {
                     uintptr_t phys = mmu_get_phys_dir(dir, addr);
                     if (phys) {
-                        pmm_free_block((uint32_t)phys);
+                        // Shared pages stay with their segment.
+                        if (!(region->flags & VM_SHARED)) {
+                            pmm_free_block((uint32_t)phys);
+                        }
                         mmu_unmap_page_dir(dir, addr);
                     }
                 }
@@ -176,10 +179,15 @@ int vm_create_shared(uint32_t pages) {
 }
 
 int vm_map_shared(process_t* proc, uint32_t shared_id, uint32_t start) {
+    return vm_map_shared_ex(proc, shared_id, start, 0);
+}
+
+int vm_map_shared_ex(process_t* proc, uint32_t shared_id, uint32_t start, uint32_t extra_flags) {
     if (!proc || shared_id >= SHARED_MAX || shared_counts[shared_id] == 0) return 0;
+    if (proc->region_count >= PROCESS_MAX_REGIONS) return 0;
     
     uint32_t size = shared_counts[shared_id] * VM_PAGE_SIZE;
-    uint32_t flags = VM_READ | VM_WRITE | VM_USER | VM_SHARED;
+    uint32_t flags = VM_READ | VM_WRITE | VM_USER | VM_SHARED | extra_flags;
     
     vm_region_t* region = &proc->regions[proc->region_count++];
     region->start = start;
@@ -197,6 +205,11 @@ int vm_map_shared(process_t* proc, uint32_t shared_id, uint32_t start) {
     return 1;
 }
 
+uint32_t vm_shared_phys(uint32_t shared_id, uint32_t page) {
+    if (shared_id >= SHARED_MAX || page >= shared_counts[shared_id]) return 0;
+    return shared_pages[shared_id][page];
+}
+
 int paging_clone_cow_range(uint32_t* parent, uint32_t* child, uint32_t start, uint32_t end) {
     if (!parent || !child) return 0;
     uint32_t base = align_down(start, VM_PAGE_SIZE);
@@ -1,8 +1,12 @@
 #include "selftest.h"
+#include "ai/ai_math.h"
 #include "ai/ai_model.h"
+#include "ai/ai_quant.h"
 #include "diag.h"
 #include "fixedpoint.h"
 #include "ai/gguf.h"
+#include "kernel/rbtree.h"
+#include "arch/x86/clockevent.h"
 
 // Tracks the most recent self-test failure count.
 static uint32_t selftest_failures = 0;
@@ -29,13 +33,35 @@ static void selftest_fixedpoint(uint32_t* failures) {
     }
 }
 
+static void selftest_math(uint32_t* failures) {
+    if (!selftest_check_int("exp(0)", 65536, ai_exp_q16(0))) {
+        (*failures)++;
+    }
+    // e^-1 = 0.367879 -> 24109 in q16.16.
+    if (!selftest_check_int("exp(-1)", 24109, ai_exp_q16(q16_from_int(-1)))) {
+        (*failures)++;
+    }
+    if (!selftest_check_int("silu(0)", 0, ai_silu_q16(0))) {
+        (*failures)++;
+    }
+    // silu(2) = 1.761594 -> 115448.
+    if (!selftest_check_int("silu(2)", 115448, ai_silu_q16(q16_from_int(2)))) {
+        (*failures)++;
+    }
+    q16_16_t row[4] = { 0, 0, 0, 0 };
+    ai_softmax_q16(row, 4);
+    if (!selftest_check_int("softmax flat", 16384, row[3])) {
+        (*failures)++;
+    }
+}
+
 static void selftest_quant(uint32_t* failures) {
-    uint8_t block[20];
+    uint8_t block[18];
     for (uint32_t i = 0; i < sizeof(block); ++i) {
         block[i] = 0;
     }
-    *(uint32_t*)block = 0x3F800000u;
-    block[4] = 0x10;
+    *(uint16_t*)block = 0x3C00u;
+    block[3] = 0x01;
     q16_16_t out[2];
     uint32_t read = ai_quant_read_q16(GGML_TYPE_Q4_0, block, out, 2);
     if (read != 2) {
@@ -49,6 +75,26 @@ static void selftest_quant(uint32_t* failures) {
     if (!selftest_check_int("q4_0 val1", -7, q16_to_int(out[1]))) {
         (*failures)++;
     }
+    q16_16_t x[32];
+    for (uint32_t i = 0; i < 32; ++i) {
+        x[i] = i < 2 ? q16_from_int(1) : 0;
+    }
+    if (!selftest_check_int("q4_0 dot", -15, q16_to_int(ai_quant_dot_q16(GGML_TYPE_Q4_0, block, x, 32)))) {
+        (*failures)++;
+    }
+    // With a block max of 127 the int8 codes are the values themselves, so
+    // the W8A8 dot is exact: sum (i - 16)^2 over i < 31, plus 15 * 127.
+    uint8_t q8[34];
+    ai_q8_block_t xq;
+    *(uint16_t*)q8 = 0x3C00u;
+    for (uint32_t i = 0; i < 32; ++i) {
+        q8[2 + i] = (uint8_t)(int8_t)((int32_t)i - 16);
+        x[i] = q16_from_int(i < 31 ? (int32_t)i - 16 : 127);
+    }
+    ai_quant_x_q8(x, &xq, 32);
+    if (!selftest_check_int("q8_0 a8 dot", 4416, q16_to_int(ai_quant_dot_q8(GGML_TYPE_Q8_0, q8, &xq, 32)))) {
+        (*failures)++;
+    }
 }
 
 static void selftest_gguf(uint32_t* failures) {
@@ -67,12 +113,79 @@ static void selftest_gguf(uint32_t* failures) {
     }
 }
 
+typedef struct {
+    uint32_t key;
+    rb_node_t node;
+} selftest_rb_item_t;
+
+static int selftest_rb_less(const rb_node_t* a, const rb_node_t* b) {
+    return rb_entry(a, selftest_rb_item_t, node)->key < rb_entry(b, selftest_rb_item_t, node)->key;
+}
+
+static void selftest_rbtree(uint32_t* failures) {
+    selftest_rb_item_t items[16];
+    rb_tree_t tree;
+    rb_init(&tree);
+    for (uint32_t i = 0; i < 16; ++i) {
+        items[i].key = (i * 7u) % 16u;
+        rb_insert(&tree, &items[i].node, selftest_rb_less);
+    }
+    // Drop the even keys; the rest must come out as 1, 3, 5, ...
+    for (uint32_t i = 0; i < 16; ++i) {
+        if ((items[i].key & 1u) == 0) {
+            rb_erase(&tree, &items[i].node);
+        }
+    }
+    uint32_t expect = 1;
+    uint32_t ordered = 1;
+    for (rb_node_t* n = rb_first(&tree); n; n = rb_next(n)) {
+        if (rb_entry(n, selftest_rb_item_t, node)->key != expect) {
+            ordered = 0;
+        }
+        expect += 2;
+    }
+    if (!selftest_check_int("rbtree order", 1, (int32_t)(ordered && tree.count == 8 && expect == 17))) {
+        (*failures)++;
+    }
+    // And back down from the largest: 15, 13, ..., 1.
+    expect = 15;
+    ordered = 1;
+    uint32_t seen = 0;
+    for (rb_node_t* n = rb_last(&tree); n; n = rb_prev(n)) {
+        if (rb_entry(n, selftest_rb_item_t, node)->key != expect) {
+            ordered = 0;
+        }
+        expect -= 2;
+        ++seen;
+    }
+    if (!selftest_check_int("rbtree reverse", 1, (int32_t)(ordered && seen == 8))) {
+        (*failures)++;
+    }
+}
+
+static void selftest_clock(uint32_t* failures) {
+    // Without a calibrated TSC the delay waits on PIT ticks; skip it rather
+    // than hang with interrupts off.
+    if (!clock_tsc_khz()) {
+        return;
+    }
+    uint64_t start = clock_now_ns();
+    clock_delay_ns(1000000);
+    uint64_t elapsed = clock_now_ns() - start;
+    if (!selftest_check_int("clock delay", 1, (int32_t)(elapsed >= 1000000 && elapsed < 100000000))) {
+        (*failures)++;
+    }
+}
+
 uint32_t selftest_run(void) {
     uint32_t failures = 0;
     diag_log(DIAG_INFO, "selftest start");
     selftest_fixedpoint(&failures);
+    selftest_math(&failures);
     selftest_quant(&failures);
     selftest_gguf(&failures);
+    selftest_rbtree(&failures);
+    selftest_clock(&failures);
     if (failures == 0) {
         diag_log(DIAG_INFO, "selftest ok");
     } else {
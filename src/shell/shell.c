@@ -1,4 +1,9 @@
+#include "ai/ai_bench.h"
+#include "ai/ai_gemm.h"
 #include "ai/ai_model.h"
+#include "ai/ai_prefix_cache.h"
+#include "ai/ai_quant.h"
+#include "ai/ai_transformer.h"
 #include "bench.h"
 #include "diag.h"
 #include "debug.h"
@@ -49,6 +54,12 @@ static char cmd_sleep_name[] = "sleep";
 static char cmd_fdcat_name[] = "fdcat";
 static char cmd_brain_stats_name[] = "brain-stats";
 static char cmd_debug_ai_name[] = "debug-ai";
+static char cmd_ai_reset_name[] = "ai-reset";
+static char cmd_ai_sample_name[] = "ai-sample";
+static char cmd_ai_prefetch_name[] = "ai-prefetch";
+static char cmd_ai_prefix_name[] = "ai-prefix";
+static char cmd_ai_act_name[] = "ai-act";
+static char cmd_ai_bench_name[] = "ai-bench";
 static char cmd_log_name[] = "log";
 static char cmd_selftest_name[] = "selftest";
 static char cmd_bench_name[] = "bench";
@@ -96,6 +107,12 @@ static void cmd_sleep(int argc, char** argv);
 static void cmd_fdcat(int argc, char** argv);
 static void cmd_brain_stats(int argc, char** argv);
 static void cmd_debug_ai(int argc, char** argv);
+static void cmd_ai_reset(int argc, char** argv);
+static void cmd_ai_sample(int argc, char** argv);
+static void cmd_ai_prefetch(int argc, char** argv);
+static void cmd_ai_prefix(int argc, char** argv);
+static void cmd_ai_act(int argc, char** argv);
+static void cmd_ai_bench(int argc, char** argv);
 static void cmd_log(int argc, char** argv);
 static void cmd_selftest(int argc, char** argv);
 static void cmd_bench(int argc, char** argv);
@@ -146,6 +163,12 @@ static command_t commands[] = {
     { cmd_infer_name, cmd_infer },
     { cmd_brain_stats_name, cmd_brain_stats },
     { cmd_debug_ai_name, cmd_debug_ai },
+    { cmd_ai_reset_name, cmd_ai_reset },
+    { cmd_ai_sample_name, cmd_ai_sample },
+    { cmd_ai_prefetch_name, cmd_ai_prefetch },
+    { cmd_ai_prefix_name, cmd_ai_prefix },
+    { cmd_ai_act_name, cmd_ai_act },
+    { cmd_ai_bench_name, cmd_ai_bench },
     { cmd_log_name, cmd_log },
     { cmd_selftest_name, cmd_selftest },
     { cmd_bench_name, cmd_bench },
@@ -1147,6 +1170,144 @@ static void cmd_debug_ai(int argc, char** argv) {
     shell_write("\n");
 }
 
+static void cmd_ai_reset(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    shell_write("dropped ");
+    shell_write_uint64(ai_transformer_position());
+    shell_write(" cached tokens\n");
+    ai_transformer_reset();
+}
+
+// Sampler settings are given in hundredths: "ai-sample 70 40 90 110 7" is
+// temperature 0.70, top-k 40, top-p 0.90, repetition penalty 1.10, seed 7.
+static void cmd_ai_sample(int argc, char** argv) {
+    ai_sampler_t* sampler = ai_transformer_sampler();
+    ai_sampler_params_t params = sampler->params;
+    if (argc > 1) {
+        uint32_t temp;
+        uint32_t top_k;
+        uint32_t top_p;
+        uint32_t penalty;
+        if (argc < 5 || !shell_parse_u32(argv[1], &temp) || !shell_parse_u32(argv[2], &top_k) ||
+            !shell_parse_u32(argv[3], &top_p) || !shell_parse_u32(argv[4], &penalty) ||
+            (argc > 5 && !shell_parse_u32(argv[5], &params.seed))) {
+            shell_write("Usage: ai-sample [temp top_k top_p penalty [seed]] (x100)\n");
+            return;
+        }
+        params.temperature = (q16_16_t)((temp << 16) / 100);
+        params.top_k = top_k;
+        params.top_p = (q16_16_t)((top_p << 16) / 100);
+        params.repeat_penalty = (q16_16_t)((penalty << 16) / 100);
+        ai_sampler_init(sampler, &params);
+    }
+    shell_write("temp ");
+    shell_write_uint64(((uint64_t)(uint32_t)params.temperature * 100 + 32768) >> 16);
+    shell_write(" top_k ");
+    shell_write_uint64(params.top_k);
+    shell_write(" top_p ");
+    shell_write_uint64(((uint64_t)(uint32_t)params.top_p * 100 + 32768) >> 16);
+    shell_write(" penalty ");
+    shell_write_uint64(((uint64_t)(uint32_t)params.repeat_penalty * 100 + 32768) >> 16);
+    shell_write(" seed ");
+    shell_write_uint64(params.seed);
+    shell_write("\n");
+}
+
+// Toggle to compare `infer` tok/s with and without layer-ahead prefetch;
+// that comparison has not been recorded yet.
+static void cmd_ai_prefetch(int argc, char** argv) {
+    if (argc > 1) {
+        if (shell_strcmp(argv[1], "on") == 0) {
+            ai_transformer_set_prefetch(1);
+        } else if (shell_strcmp(argv[1], "off") == 0) {
+            ai_transformer_set_prefetch(0);
+        } else {
+            shell_write("Usage: ai-prefetch [on|off]\n");
+            return;
+        }
+    }
+    shell_write("prefetch ");
+    shell_write(ai_transformer_prefetch() ? "on\n" : "off\n");
+}
+
+static void cmd_ai_prefix(int argc, char** argv) {
+    if (argc > 1) {
+        if (shell_strcmp(argv[1], "clear") != 0) {
+            shell_write("Usage: ai-prefix [clear]\n");
+            return;
+        }
+        ai_prefix_cache_clear();
+    }
+    ai_prefix_stats_t stats;
+    ai_prefix_cache_stats(&stats);
+    shell_write("prefix entries ");
+    shell_write_uint64(stats.entries);
+    shell_write(" kb ");
+    shell_write_uint64(stats.bytes / 1024);
+    shell_write(" hits ");
+    shell_write_uint64(stats.hits);
+    shell_write(" misses ");
+    shell_write_uint64(stats.misses);
+    shell_write(" reused ");
+    shell_write_uint64(stats.tokens_reused);
+    shell_write(" evicted ");
+    shell_write_uint64(stats.evictions);
+    shell_write("\n");
+}
+
+// Switches decode projections between q16.16 and int8 activations, to
+// compare `infer` tok/s and answers between the two.
+static void cmd_ai_act(int argc, char** argv) {
+    if (argc > 1) {
+        if (shell_strcmp(argv[1], "q16") == 0) {
+            ai_quant_set_act_mode(AI_ACT_Q16);
+        } else if (shell_strcmp(argv[1], "q8") == 0) {
+            ai_quant_set_act_mode(AI_ACT_Q8);
+        } else {
+            shell_write("Usage: ai-act [q16|q8]\n");
+            return;
+        }
+    }
+    shell_write("activations ");
+    if (ai_quant_act_mode() == AI_ACT_Q8) {
+        shell_write(ai_quant_q8_simd() ? "q8 (ssse3)\n" : "q8 (scalar)\n");
+    } else {
+        shell_write("q16\n");
+    }
+}
+
+static void ai_bench_print(const ai_bench_result_t* r) {
+    shell_write(r->name);
+    shell_write(" cycles ");
+    shell_write_uint64(r->cycles);
+    if (r->tokens) {
+        shell_write(" tok/s ");
+        shell_write_uint64(r->tps_x100 / 100);
+        shell_write(".");
+        shell_write_two((uint32_t)(r->tps_x100 % 100));
+    } else {
+        shell_write(" mops ");
+        shell_write_uint64(r->mops);
+    }
+    shell_write("\n");
+}
+
+// The same results also go to serial as AIBENCH lines for scripts.
+static void cmd_ai_bench(int argc, char** argv) {
+    uint32_t reps = 8;
+    if (argc > 1 && (!shell_parse_u32(argv[1], &reps) || reps == 0)) {
+        shell_write("Usage: ai-bench [reps]\n");
+        return;
+    }
+    shell_write("tsc khz ");
+    shell_write_uint64(ai_bench_tsc_khz());
+    shell_write("\n");
+    if (!ai_bench_run(reps, ai_bench_print)) {
+        shell_write("ai-bench failed\n");
+    }
+}
+
 static void cmd_log(int argc, char** argv) {
     if (argc > 1 && shell_strcmp(argv[1], "clear") == 0) {
         diag_clear();
@@ -1175,19 +1336,31 @@ static void cmd_selftest(int argc, char** argv) {
 
 static void cmd_bench(int argc, char** argv) {
     uint32_t size = 32;
+    uint32_t reps = 32;
     if (argc > 1) {
         if (!shell_parse_u32(argv[1], &size)) {
-            shell_write("Usage: bench <size>\n");
+            shell_write("Usage: bench <size> [reps]\n");
             return;
         }
     }
-    uint64_t ticks = bench_matmul(size);
-    if (ticks == 0) {
+    if (argc > 2) {
+        if (!shell_parse_u32(argv[2], &reps)) {
+            shell_write("Usage: bench <size> [reps]\n");
+            return;
+        }
+    }
+    uint64_t strided = 0;
+    uint64_t packed = 0;
+    if (!bench_matmul_layouts(size, reps, &strided, &packed)) {
         shell_write("bench failed\n");
         return;
     }
-    shell_write("bench ticks ");
-    shell_write_uint64(ticks);
+    shell_write("bench ticks rowmajor ");
+    shell_write_uint64(strided);
+    shell_write(" packed ");
+    shell_write_uint64(packed);
+    shell_write(" gemm ");
+    shell_write(ai_gemm_isa_name(ai_gemm_isa()));
     shell_write("\n");
 }
 